@@ -0,0 +1,35 @@
+/*
+ * Copyright 2013 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MESSAGE_BODY_H__
+#define __MESSAGE_BODY_H__
+
+#include <glib.h>
+
+/* Messages with a body that is too long to be sent over the bus carry
+ * a placeholder instead: BODY_PLACEHOLDER followed by the size of the
+ * sealed memfd that GetBody hands out. That memfd contains the body
+ * including its trailing nul.
+ *
+ * Applications only send placeholders to services that list
+ * BODY_CAPABILITY in their Capabilities property.
+ *
+ * U+FDD0 is a noncharacter, which never appears in interchanged text. */
+#define BODY_PLACEHOLDER         "\xef\xb7\x90"
+#define BODY_PLACEHOLDER_FORMAT  BODY_PLACEHOLDER "%" G_GSIZE_FORMAT
+#define BODY_CAPABILITY          "get-body"
+
+#endif /* __MESSAGE_BODY_H__ */
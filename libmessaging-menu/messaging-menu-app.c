@@ -17,12 +17,31 @@
  *     Lars Uebernickel <lars.uebernickel@canonical.com>
  */
 
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#define _GNU_SOURCE
+
 #include "messaging-menu-app.h"
 #include "indicator-messages-service.h"
 #include "indicator-messages-application.h"
+#include "message-body.h"
 
 #include <gio/gdesktopappinfo.h>
+#include <gio/gunixfdlist.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/* Number of changes kept for GetChangesSince */
+#define MAX_CHANGES 1024
+
+/* Icons with more image data than this are not sent over the bus, but
+ * handed to the service as a sealed memfd on request (see GetIcon). */
+#define ICON_MEMFD_THRESHOLD (64 * 1024)
 
 /**
  * SECTION:messaging-menu-app
@@ -106,11 +125,22 @@ struct _MessagingMenuApp
   gboolean status_set;
   GDBusConnection *bus;
 
-  GHashTable *messages;
-  GList *sources;
+  GHashTable *messages;      /* id -> GSequenceIter in message_order */
+  GSequence *message_order;  /* oldest first */
+  guint max_messages;
+  GSequence *sources;
+  GHashTable *source_index;  /* id -> GSequenceIter in sources */
+  GHashTable *changed_sources;
+  guint update_depth;
+  guint flush_id;
+  GHashTable *icons;         /* icon ref -> Icon */
+  guint64 generation;        /* bumped on every change to sources or messages */
+  guint64 log_start;         /* changes after this generation are in @changes */
+  GQueue changes;            /* Change, oldest first */
   IndicatorMessagesApplication *app_interface;
 
   IndicatorMessagesService *messages_service;
+  gboolean service_gets_bodies;  /* the service supports GetBody */
   guint watch_id;
 
   GCancellable *cancellable;
@@ -139,6 +169,7 @@ typedef struct
 {
   gchar *id;
   GIcon *icon;
+  gchar *icon_ref;
   gchar *label;
 
   guint32 count;
@@ -151,8 +182,28 @@ static void global_status_changed (IndicatorMessagesService *service,
                                    const gchar *status_str,
                                    gpointer user_data);
 
+typedef struct
+{
+  guint64 generation;
+  gchar *message_id;     /* NULL for changes to sources */
+} Change;
+
+typedef struct
+{
+  GVariant *serialized;  /* as announced with IconRegistered */
+  GBytes *bytes;         /* image data of icons shared as memfd */
+  gint fd;               /* sealed memfd holding @bytes, or -1 */
+  guint ref_count;
+} Icon;
+
 /* in messaging-menu-message.c */
-GVariant * _messaging_menu_message_to_variant (MessagingMenuMessage *msg);
+GVariant *      _messaging_menu_message_to_variant      (MessagingMenuMessage *msg,
+                                                         gboolean              body_placeholder);
+GVariant *      _messaging_menu_serialize_icon          (GIcon                *icon,
+                                                         const gchar          *icon_ref);
+const gchar *   _messaging_menu_message_get_icon_ref    (MessagingMenuMessage *msg);
+void            _messaging_menu_message_set_icon_ref    (MessagingMenuMessage *msg,
+                                                         const gchar          *icon_ref);
 
 static void
 source_free (gpointer data)
@@ -163,36 +214,280 @@ source_free (gpointer data)
     {
       g_free (source->id);
       g_clear_object (&source->icon);
+      g_free (source->icon_ref);
       g_free (source->label);
       g_free (source->string);
       g_slice_free (Source, source);
     }
 }
 
+static void
+icon_free (gpointer data)
+{
+  Icon *icon = data;
+
+  g_variant_unref (icon->serialized);
+  if (icon->bytes)
+    g_bytes_unref (icon->bytes);
+  if (icon->fd >= 0)
+    close (icon->fd);
+  g_slice_free (Icon, icon);
+}
+
 static GVariant *
 source_to_variant (Source *source)
 {
   GVariant *v;
-  GVariant *serialized_icon;
-  GVariantBuilder builder;
 
-  serialized_icon = source->icon ? g_icon_serialize (source->icon) : NULL;
-  g_variant_builder_init (&builder, G_VARIANT_TYPE ("av"));
-  if (serialized_icon)
+  v = g_variant_new ("(ss@avuxsb)", source->id,
+                                    source->label,
+                                    _messaging_menu_serialize_icon (source->icon, source->icon_ref),
+                                    source->count,
+                                    source->time,
+                                    source->string ? source->string : "",
+                                    source->draws_attention);
+
+  return v;
+}
+
+/*
+ * Adds @icon to the icon table and returns its reference, or %NULL if
+ * @icon is cheap enough to be sent inline. Icons carrying image data
+ * are announced with IconRegistered the first time they are used, so
+ * that messages and sources sharing an image only send its hash.
+ */
+static gchar *
+messaging_menu_app_ref_icon (MessagingMenuApp *app,
+                             GIcon            *icon)
+{
+  Icon *entry;
+  GBytes *bytes;
+  gchar *ref;
+
+  if (!G_IS_BYTES_ICON (icon))
+    return NULL;
+
+  bytes = g_bytes_icon_get_bytes (G_BYTES_ICON (icon));
+  ref = g_compute_checksum_for_bytes (G_CHECKSUM_SHA256, bytes);
+
+  entry = g_hash_table_lookup (app->icons, ref);
+  if (entry == NULL)
     {
-      g_variant_builder_add (&builder, "v", serialized_icon);
-      g_variant_unref (serialized_icon);
+      entry = g_slice_new0 (Icon);
+      entry->fd = -1;
+
+#ifdef HAVE_MEMFD_CREATE
+      if (g_bytes_get_size (bytes) > ICON_MEMFD_THRESHOLD)
+        {
+          entry->bytes = g_bytes_ref (bytes);
+          entry->serialized = g_variant_new ("(sv)", "memfd",
+                                             g_variant_new_uint64 (g_bytes_get_size (bytes)));
+          g_variant_ref_sink (entry->serialized);
+        }
+      else
+#endif
+        entry->serialized = g_icon_serialize (icon);
+
+      g_hash_table_insert (app->icons, g_strdup (ref), entry);
+
+      indicator_messages_application_emit_icon_registered (app->app_interface, ref,
+                                                           entry->serialized);
     }
 
-  v = g_variant_new ("(ssavuxsb)", source->id,
-                                   source->label,
-                                   &builder,
-                                   source->count,
-                                   source->time,
-                                   source->string ? source->string : "",
-                                   source->draws_attention);
+  entry->ref_count++;
 
-  return v;
+  return ref;
+}
+
+static void
+messaging_menu_app_unref_icon (MessagingMenuApp *app,
+                               const gchar      *ref)
+{
+  Icon *entry;
+
+  entry = g_hash_table_lookup (app->icons, ref);
+  g_return_if_fail (entry != NULL);
+
+  if (--entry->ref_count == 0)
+    {
+      indicator_messages_application_emit_icon_unregistered (app->app_interface, ref);
+      g_hash_table_remove (app->icons, ref);
+    }
+}
+
+#ifdef HAVE_MEMFD_CREATE
+/* Returns a read-only, sealed memfd named @name containing @bytes, or -1 */
+static gint
+create_sealed_memfd (const gchar *name,
+                     GBytes      *bytes,
+                     GError     **error)
+{
+  const guint8 *data;
+  gsize size;
+  gint fd;
+
+  fd = memfd_create (name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd < 0)
+    goto error;
+
+  data = g_bytes_get_data (bytes, &size);
+  while (size > 0)
+    {
+      gssize n = write (fd, data, size);
+
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0)
+        goto error;
+
+      data += n;
+      size -= n;
+    }
+
+  if (fcntl (fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0)
+    goto error;
+
+  return fd;
+
+error:
+  g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+               "unable to create memfd: %s", g_strerror (errno));
+  if (fd >= 0)
+    close (fd);
+  return -1;
+}
+#endif
+
+static gboolean
+messaging_menu_app_get_icon (IndicatorMessagesApplication *app_interface,
+                             GDBusMethodInvocation        *invocation,
+                             GUnixFDList                  *fd_list,
+                             const gchar                  *icon_ref,
+                             gpointer                      user_data)
+{
+  MessagingMenuApp *app = user_data;
+  GUnixFDList *out_fd_list;
+  GError *error = NULL;
+  Icon *entry;
+  gint handle;
+
+  entry = g_hash_table_lookup (app->icons, icon_ref);
+  if (entry == NULL || entry->bytes == NULL)
+    {
+      g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+                                             "no memfd icon with reference '%s'", icon_ref);
+      return TRUE;
+    }
+
+#ifdef HAVE_MEMFD_CREATE
+  /* the memfd is sealed, so it can be handed out again */
+  if (entry->fd < 0)
+    entry->fd = create_sealed_memfd ("messaging-menu-icon", entry->bytes, &error);
+#endif
+
+  if (entry->fd < 0)
+    {
+      g_dbus_method_invocation_take_error (invocation, error);
+      return TRUE;
+    }
+
+  out_fd_list = g_unix_fd_list_new ();
+  handle = g_unix_fd_list_append (out_fd_list, entry->fd, &error);
+  if (handle < 0)
+    {
+      g_dbus_method_invocation_take_error (invocation, error);
+      g_object_unref (out_fd_list);
+      return TRUE;
+    }
+
+  indicator_messages_application_complete_get_icon (app_interface, invocation, out_fd_list,
+                                                    g_variant_new_handle (handle));
+
+  g_object_unref (out_fd_list);
+
+  return TRUE;
+}
+
+/* Hands out the body of a message that was too long to be sent inline,
+ * as a sealed memfd that includes the trailing nul. Bodies are only
+ * requested once, so unlike icon memfds, these are not kept around. */
+static gboolean
+messaging_menu_app_get_body (IndicatorMessagesApplication *app_interface,
+                             GDBusMethodInvocation        *invocation,
+                             GUnixFDList                  *fd_list,
+                             const gchar                  *message_id,
+                             gpointer                      user_data)
+{
+  MessagingMenuApp *app = user_data;
+  GSequenceIter *iter;
+  GUnixFDList *out_fd_list;
+  GError *error = NULL;
+  gint fd = -1;
+
+  iter = g_hash_table_lookup (app->messages, message_id);
+  if (iter == NULL)
+    {
+      g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+                                             "no message with id '%s'", message_id);
+      return TRUE;
+    }
+
+#ifdef HAVE_MEMFD_CREATE
+  {
+    const gchar *body;
+    GBytes *bytes;
+
+    body = messaging_menu_message_get_body (g_sequence_get (iter));
+    if (body == NULL)
+      body = "";
+    bytes = g_bytes_new_static (body, strlen (body) + 1);
+    fd = create_sealed_memfd ("messaging-menu-body", bytes, &error);
+    g_bytes_unref (bytes);
+  }
+#else
+  g_set_error_literal (&error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                       "memfds are not supported");
+#endif
+
+  if (fd < 0)
+    {
+      g_dbus_method_invocation_take_error (invocation, error);
+      return TRUE;
+    }
+
+  /* takes ownership of @fd */
+  out_fd_list = g_unix_fd_list_new_from_array (&fd, 1);
+
+  indicator_messages_application_complete_get_body (app_interface, invocation, out_fd_list,
+                                                    g_variant_new_handle (0));
+
+  g_object_unref (out_fd_list);
+
+  return TRUE;
+}
+
+static gboolean
+messaging_menu_app_list_icons (IndicatorMessagesApplication *app_interface,
+                               GDBusMethodInvocation        *invocation,
+                               gpointer                      user_data)
+{
+  MessagingMenuApp *app = user_data;
+  GVariantBuilder builder;
+  GHashTableIter iter;
+  const gchar *ref;
+  Icon *entry;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+
+  g_hash_table_iter_init (&iter, app->icons);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &ref, (gpointer *) &entry))
+    g_variant_builder_add (&builder, "{sv}", ref, entry->serialized);
+
+  indicator_messages_application_complete_list_icons (app_interface,
+                                                      invocation,
+                                                      g_variant_builder_end (&builder));
+
+  return TRUE;
 }
 
 static gchar *
@@ -318,9 +613,20 @@ messaging_menu_app_dispose (GObject *object)
     }
 
   g_clear_pointer (&app->messages, g_hash_table_unref);
+  g_clear_pointer (&app->message_order, g_sequence_free);
 
-  g_list_free_full (app->sources, source_free);
-  app->sources = NULL;
+  if (app->flush_id)
+    {
+      g_source_remove (app->flush_id);
+      app->flush_id = 0;
+    }
+
+  g_clear_pointer (&app->changed_sources, g_hash_table_unref);
+  g_clear_pointer (&app->source_index, g_hash_table_unref);
+  g_clear_pointer (&app->sources, g_sequence_free);
+  g_clear_pointer (&app->icons, g_hash_table_unref);
+  g_queue_foreach (&app->changes, (GFunc) change_free, NULL);
+  g_queue_clear (&app->changes);
 
   g_clear_object (&app->app_interface);
   g_clear_object (&app->appinfo);
@@ -394,6 +700,17 @@ messaging_menu_app_class_init (MessagingMenuAppClass *class)
                                           G_TYPE_NONE, 1, G_TYPE_INT);
 }
 
+static gboolean
+strv_contains (const gchar * const *strv,
+               const gchar         *str)
+{
+  for (; strv && *strv; strv++)
+    if (g_str_equal (*strv, str))
+      return TRUE;
+
+  return FALSE;
+}
+
 static void
 created_messages_service (GObject      *source_object,
                           GAsyncResult *result,
@@ -413,6 +730,10 @@ created_messages_service (GObject      *source_object,
   g_signal_connect (app->messages_service, "status-changed",
                     G_CALLBACK (global_status_changed), app);
 
+  /* older services show placeholders instead of fetching long bodies */
+  app->service_gets_bodies = strv_contains (indicator_messages_service_get_capabilities (app->messages_service),
+                                            BODY_CAPABILITY);
+
   /* sync current status */
   if (app->registered == TRUE)
     messaging_menu_app_register (app);
@@ -453,6 +774,47 @@ indicator_messages_vanished (GDBusConnection *bus,
                                             app);
       g_clear_object (&app->messages_service);
     }
+
+  app->service_gets_bodies = FALSE;
+}
+
+static void
+change_free (gpointer data)
+{
+  Change *change = data;
+
+  g_free (change->message_id);
+  g_slice_free (Change, change);
+}
+
+/* Records a change to the message with @message_id, or to the sources
+ * if @message_id is %NULL, in the log used by GetChangesSince. */
+static void
+messaging_menu_app_record_change (MessagingMenuApp *app,
+                                  const gchar      *message_id)
+{
+  Change *change;
+
+  /* GetChangesSince always returns all sources, so a run of changes to
+   * sources only needs the newest entry */
+  change = g_queue_peek_tail (&app->changes);
+  if (message_id == NULL && change && change->message_id == NULL)
+    {
+      change->generation = ++app->generation;
+      return;
+    }
+
+  change = g_slice_new (Change);
+  change->generation = ++app->generation;
+  change->message_id = g_strdup (message_id);
+  g_queue_push_tail (&app->changes, change);
+
+  if (app->changes.length > MAX_CHANGES)
+    {
+      change = g_queue_pop_head (&app->changes);
+      app->log_start = change->generation;
+      change_free (change);
+    }
 }
 
 static gboolean
@@ -462,12 +824,12 @@ messaging_menu_app_list_sources (IndicatorMessagesApplication *app_interface,
 {
   MessagingMenuApp *app = user_data;
   GVariantBuilder builder;
-  GList *it;
+  GSequenceIter *it;
 
   g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(ssavuxsb)"));
 
-  for (it = app->sources; it; it = it->next)
-    g_variant_builder_add_value (&builder, source_to_variant (it->data));
+  for (it = g_sequence_get_begin_iter (app->sources); !g_sequence_iter_is_end (it); it = g_sequence_iter_next (it))
+    g_variant_builder_add_value (&builder, source_to_variant (g_sequence_get (it)));
 
   indicator_messages_application_complete_list_sources (app_interface,
                                                         invocation,
@@ -476,38 +838,160 @@ messaging_menu_app_list_sources (IndicatorMessagesApplication *app_interface,
   return TRUE;
 }
 
-static gint
-compare_source_id (gconstpointer a,
-                   gconstpointer b)
-{
-  const Source *source = a;
-  const gchar *id = b;
-
-  return strcmp (source->id, id);
-}
-
 static gboolean
 messaging_menu_app_remove_source_internal (MessagingMenuApp *app,
                                            const gchar      *source_id)
 {
-  GList *node;
+  GSequenceIter *iter;
 
-  node = g_list_find_custom (app->sources, source_id, compare_source_id);
-  if (node)
+  iter = g_hash_table_lookup (app->source_index, source_id);
+  if (iter)
     {
-      source_free (node->data);
-      app->sources = g_list_delete_link (app->sources, node);
+      Source *source = g_sequence_get (iter);
+
+      if (source->icon_ref)
+        messaging_menu_app_unref_icon (app, source->icon_ref);
+      messaging_menu_app_record_change (app, NULL);
+
+      /* the index is keyed by the source's own id */
+      g_hash_table_remove (app->source_index, source_id);
+      g_hash_table_remove (app->changed_sources, source);
+      g_sequence_remove (iter);
       return TRUE;
     }
 
   return FALSE;
 }
 
+static gint
+compare_messages_by_time (gconstpointer a,
+                          gconstpointer b,
+                          gpointer      user_data)
+{
+  MessagingMenuMessage *msg_a = (MessagingMenuMessage *) a;
+  MessagingMenuMessage *msg_b = (MessagingMenuMessage *) b;
+  gint64 time_a = messaging_menu_message_get_time (msg_a);
+  gint64 time_b = messaging_menu_message_get_time (msg_b);
+
+  if (time_a != time_b)
+    return time_a < time_b ? -1 : 1;
+
+  return strcmp (messaging_menu_message_get_id (msg_a),
+                 messaging_menu_message_get_id (msg_b));
+}
+
+static MessagingMenuMessage *
+messaging_menu_app_lookup_message (MessagingMenuApp *app,
+                                   const gchar      *message_id)
+{
+  GSequenceIter *iter;
+
+  iter = g_hash_table_lookup (app->messages, message_id);
+
+  return iter ? g_sequence_get (iter) : NULL;
+}
+
+static GVariant *
+messaging_menu_app_serialize_message (MessagingMenuApp     *app,
+                                      MessagingMenuMessage *msg)
+{
+  return _messaging_menu_message_to_variant (msg, app->service_gets_bodies);
+}
+
+static void
+messaging_menu_app_insert_message_internal (MessagingMenuApp     *app,
+                                            MessagingMenuMessage *msg)
+{
+  GSequenceIter *iter;
+  GIcon *icon;
+
+  icon = messaging_menu_message_get_icon (msg);
+  if (icon)
+    {
+      gchar *icon_ref;
+
+      icon_ref = messaging_menu_app_ref_icon (app, icon);
+      _messaging_menu_message_set_icon_ref (msg, icon_ref);
+      g_free (icon_ref);
+    }
+
+  iter = g_sequence_insert_sorted (app->message_order, g_object_ref (msg),
+                                   compare_messages_by_time, NULL);
+  g_hash_table_insert (app->messages, g_strdup (messaging_menu_message_get_id (msg)), iter);
+
+  messaging_menu_app_record_change (app, messaging_menu_message_get_id (msg));
+}
+
 static gboolean
 messaging_menu_app_remove_message_internal (MessagingMenuApp *app,
                                             const gchar      *message_id)
 {
-  return g_hash_table_remove (app->messages, message_id);
+  GSequenceIter *iter;
+  MessagingMenuMessage *msg;
+
+  iter = g_hash_table_lookup (app->messages, message_id);
+  if (iter == NULL)
+    return FALSE;
+
+  msg = g_sequence_get (iter);
+  if (_messaging_menu_message_get_icon_ref (msg))
+    {
+      messaging_menu_app_unref_icon (app, _messaging_menu_message_get_icon_ref (msg));
+      _messaging_menu_message_set_icon_ref (msg, NULL);
+    }
+
+  messaging_menu_app_record_change (app, message_id);
+
+  /* @message_id might belong to the message, remove it from the index
+   * (which has its own copy) before dropping the message */
+  g_hash_table_remove (app->messages, message_id);
+  g_sequence_remove (iter);
+
+  return TRUE;
+}
+
+/*
+ * Removes the oldest messages until there are at most max_messages
+ * left and announces them in a single MessagesRemoved signal.
+ * Messages whose ids are in @unannounced (which may be %NULL) are
+ * removed silently, because the service hasn't been told about them
+ * yet.
+ */
+static void
+messaging_menu_app_evict_messages (MessagingMenuApp *app,
+                                   GHashTable       *unannounced)
+{
+  GPtrArray *evicted;
+
+  if (app->max_messages == 0 || g_hash_table_size (app->messages) <= app->max_messages)
+    return;
+
+  evicted = g_ptr_array_new_with_free_func (g_free);
+
+  while (g_hash_table_size (app->messages) > app->max_messages)
+    {
+      MessagingMenuMessage *oldest;
+      gchar *id;
+
+      oldest = g_sequence_get (g_sequence_get_begin_iter (app->message_order));
+      id = g_strdup (messaging_menu_message_get_id (oldest));
+
+      messaging_menu_app_remove_message_internal (app, id);
+
+      if (unannounced == NULL || !g_hash_table_contains (unannounced, id))
+        g_ptr_array_add (evicted, id);
+      else
+        g_free (id);
+    }
+
+  if (evicted->len > 0)
+    {
+      g_ptr_array_add (evicted, NULL);
+      indicator_messages_application_emit_messages_removed (app->app_interface,
+                                                            (const gchar * const *) evicted->pdata);
+    }
+
+  g_ptr_array_unref (evicted);
 }
 
 static gboolean
@@ -528,6 +1012,85 @@ messaging_menu_app_activate_source (IndicatorMessagesApplication *app_interface,
   return TRUE;
 }
 
+/*
+ * Returns everything that changed after generation @since: all sources
+ * (if any of them changed), the current state of all added or changed
+ * messages, and the ids of removed messages. @complete is FALSE if the
+ * log doesn't reach back to @since (or @since is from another instance
+ * of the application), in which case the caller has to list everything.
+ */
+static gboolean
+messaging_menu_app_get_changes_since (IndicatorMessagesApplication *app_interface,
+                                      GDBusMethodInvocation        *invocation,
+                                      guint64                       since,
+                                      gpointer                      user_data)
+{
+  MessagingMenuApp *app = user_data;
+  GVariantBuilder sources;
+  GVariantBuilder messages;
+  GVariantBuilder removed;
+  gboolean complete;
+  gboolean sources_changed = FALSE;
+
+  g_variant_builder_init (&sources, G_VARIANT_TYPE ("a(ssavuxsb)"));
+  g_variant_builder_init (&messages, G_VARIANT_TYPE ("a(savsssxaa{sv}b)"));
+  g_variant_builder_init (&removed, G_VARIANT_TYPE ("as"));
+
+  complete = since >= app->log_start && since <= app->generation;
+  if (complete)
+    {
+      GHashTable *seen;
+      GList *it;
+
+      seen = g_hash_table_new (g_str_hash, g_str_equal);
+
+      for (it = app->changes.tail; it && ((Change *) it->data)->generation > since; it = it->prev)
+        {
+          Change *change = it->data;
+          MessagingMenuMessage *msg;
+
+          if (change->message_id == NULL)
+            {
+              sources_changed = TRUE;
+              continue;
+            }
+
+          if (g_hash_table_contains (seen, change->message_id))
+            continue;
+          g_hash_table_add (seen, change->message_id);
+
+          msg = messaging_menu_app_lookup_message (app, change->message_id);
+          if (msg)
+            g_variant_builder_add_value (&messages, messaging_menu_app_serialize_message (app, msg));
+          else
+            g_variant_builder_add (&removed, "s", change->message_id);
+        }
+
+      g_hash_table_unref (seen);
+    }
+
+  if (sources_changed)
+    {
+      GSequenceIter *iter;
+
+      for (iter = g_sequence_get_begin_iter (app->sources);
+           !g_sequence_iter_is_end (iter);
+           iter = g_sequence_iter_next (iter))
+        g_variant_builder_add_value (&sources, source_to_variant (g_sequence_get (iter)));
+    }
+
+  indicator_messages_application_complete_get_changes_since (app_interface, invocation,
+                                                             app->generation, complete,
+                                                             sources_changed,
+                                                             g_variant_builder_end (&sources),
+                                                             g_variant_builder_end (&messages),
+                                                             g_variant_builder_end (&removed));
+
+  return TRUE;
+}
+
+/* Lists all messages, newest first, so that the service can append
+ * them to its menus without searching for their position. */
 static gboolean
 messaging_menu_app_list_messages (IndicatorMessagesApplication *app_interface,
                                   GDBusMethodInvocation        *invocation,
@@ -535,14 +1098,16 @@ messaging_menu_app_list_messages (IndicatorMessagesApplication *app_interface,
 {
   MessagingMenuApp *app = user_data;
   GVariantBuilder builder;
-  GHashTableIter iter;
-  MessagingMenuMessage *message;
+  GSequenceIter *iter;
 
   g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(savsssxaa{sv}b)"));
 
-  g_hash_table_iter_init (&iter, app->messages);
-  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &message))
-    g_variant_builder_add_value (&builder, _messaging_menu_message_to_variant (message));
+  iter = g_sequence_get_end_iter (app->message_order);
+  while (!g_sequence_iter_is_begin (iter))
+    {
+      iter = g_sequence_iter_prev (iter);
+      g_variant_builder_add_value (&builder, messaging_menu_app_serialize_message (app, g_sequence_get (iter)));
+    }
 
   indicator_messages_application_complete_list_messages (app_interface,
                                                          invocation,
@@ -551,6 +1116,62 @@ messaging_menu_app_list_messages (IndicatorMessagesApplication *app_interface,
   return TRUE;
 }
 
+/* Lists at most @limit messages that are older than the message with
+ * @time and @message_id, newest first. The message itself doesn't have
+ * to exist anymore, so that the service can page through the messages
+ * while some of them are removed. An empty @message_id with a @time of
+ * G_MAXINT64 starts with the newest message. */
+static gboolean
+messaging_menu_app_list_messages_before (IndicatorMessagesApplication *app_interface,
+                                         GDBusMethodInvocation        *invocation,
+                                         gint64                        time,
+                                         const gchar                  *message_id,
+                                         guint                         limit,
+                                         gpointer                      user_data)
+{
+  MessagingMenuApp *app = user_data;
+  GVariantBuilder builder;
+  GSequenceIter *iter;
+  guint i;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(savsssxaa{sv}b)"));
+
+  if (time == G_MAXINT64 && message_id[0] == '\0')
+    {
+      iter = g_sequence_get_end_iter (app->message_order);
+    }
+  else
+    {
+      MessagingMenuMessage *key;
+
+      key = messaging_menu_message_new (message_id, NULL, "", NULL, NULL, time);
+
+      /* @iter is past all messages that aren't newer than @key */
+      iter = g_sequence_search (app->message_order, key, compare_messages_by_time, NULL);
+      if (!g_sequence_iter_is_begin (iter))
+        {
+          GSequenceIter *prev = g_sequence_iter_prev (iter);
+
+          if (compare_messages_by_time (g_sequence_get (prev), key, NULL) == 0)
+            iter = prev;
+        }
+
+      g_object_unref (key);
+    }
+
+  for (i = 0; i < limit && !g_sequence_iter_is_begin (iter); i++)
+    {
+      iter = g_sequence_iter_prev (iter);
+      g_variant_builder_add_value (&builder, messaging_menu_app_serialize_message (app, g_sequence_get (iter)));
+    }
+
+  indicator_messages_application_complete_list_messages_before (app_interface,
+                                                                invocation,
+                                                                g_variant_builder_end (&builder));
+
+  return TRUE;
+}
+
 static gboolean
 messaging_menu_app_activate_message (IndicatorMessagesApplication *app_interface,
                                      GDBusMethodInvocation        *invocation,
@@ -562,7 +1183,7 @@ messaging_menu_app_activate_message (IndicatorMessagesApplication *app_interface
   MessagingMenuApp *app = user_data;
   MessagingMenuMessage *msg;
 
-  msg = g_hash_table_lookup (app->messages, message_id);
+  msg = messaging_menu_app_lookup_message (app, message_id);
   if (msg)
     {
       if (*action_id)
@@ -627,18 +1248,39 @@ messaging_menu_app_init (MessagingMenuApp *app)
   app->cancellable = g_cancellable_new ();
 
   app->app_interface = indicator_messages_application_skeleton_new ();
+  g_signal_connect (app->app_interface, "handle-list-icons",
+                    G_CALLBACK (messaging_menu_app_list_icons), app);
+  g_signal_connect (app->app_interface, "handle-get-icon",
+                    G_CALLBACK (messaging_menu_app_get_icon), app);
+  g_signal_connect (app->app_interface, "handle-get-body",
+                    G_CALLBACK (messaging_menu_app_get_body), app);
   g_signal_connect (app->app_interface, "handle-list-sources",
                     G_CALLBACK (messaging_menu_app_list_sources), app);
+  g_signal_connect (app->app_interface, "handle-get-changes-since",
+                    G_CALLBACK (messaging_menu_app_get_changes_since), app);
   g_signal_connect (app->app_interface, "handle-activate-source",
                     G_CALLBACK (messaging_menu_app_activate_source), app);
   g_signal_connect (app->app_interface, "handle-list-messages",
                     G_CALLBACK (messaging_menu_app_list_messages), app);
+  g_signal_connect (app->app_interface, "handle-list-messages-before",
+                    G_CALLBACK (messaging_menu_app_list_messages_before), app);
   g_signal_connect (app->app_interface, "handle-activate-message",
                     G_CALLBACK (messaging_menu_app_activate_message), app);
   g_signal_connect (app->app_interface, "handle-dismiss",
                     G_CALLBACK (messaging_menu_app_dismiss), app);
 
-  app->messages = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
+  app->messages = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  app->message_order = g_sequence_new (g_object_unref);
+  app->sources = g_sequence_new (source_free);
+  app->source_index = g_hash_table_new (g_str_hash, g_str_equal);
+  app->changed_sources = g_hash_table_new (NULL, NULL);
+  app->icons = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, icon_free);
+
+  /* start from the current time, so that generations of different
+   * instances of the application don't overlap */
+  app->generation = g_get_real_time ();
+  app->log_start = app->generation;
+  g_queue_init (&app->changes);
 
   app->watch_id = g_bus_watch_name (G_BUS_TYPE_SESSION,
                                     "com.canonical.indicator.messages",
@@ -815,11 +1457,11 @@ static Source *
 messaging_menu_app_lookup_source (MessagingMenuApp *app,
                                   const gchar      *id)
 {
-  GList *node;
+  GSequenceIter *iter;
 
-  node = g_list_find_custom (app->sources, id, compare_source_id);
+  iter = g_hash_table_lookup (app->source_index, id);
 
-  return node ? node->data : NULL;
+  return iter ? g_sequence_get (iter) : NULL;
 }
 
 static Source *
@@ -835,12 +1477,49 @@ messaging_menu_app_get_source (MessagingMenuApp *app,
   return source;
 }
 
+static void
+messaging_menu_app_flush_changed_sources (MessagingMenuApp *app)
+{
+  GHashTableIter iter;
+  Source *source;
+
+  g_hash_table_iter_init (&iter, app->changed_sources);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &source, NULL))
+    indicator_messages_application_emit_source_changed (app->app_interface,
+                                                        source_to_variant (source));
+
+  g_hash_table_remove_all (app->changed_sources);
+}
+
+static gboolean
+messaging_menu_app_flush_idle (gpointer user_data)
+{
+  MessagingMenuApp *app = user_data;
+
+  app->flush_id = 0;
+
+  /* messaging_menu_app_commit_update() flushes */
+  if (app->update_depth == 0)
+    messaging_menu_app_flush_changed_sources (app);
+
+  return G_SOURCE_REMOVE;
+}
+
+/*
+ * Changes to sources are not sent right away, so that setting several
+ * properties of a source (or changing many sources) only sends one
+ * SourceChanged per source, from an idle handler or at the end of an
+ * update (see messaging_menu_app_begin_update()).
+ */
 static void
 messaging_menu_app_notify_source_changed (MessagingMenuApp *app,
                                           Source           *source)
 {
-  indicator_messages_application_emit_source_changed (app->app_interface,
-                                                      source_to_variant (source));
+  g_hash_table_add (app->changed_sources, source);
+  messaging_menu_app_record_change (app, NULL);
+
+  if (app->update_depth == 0 && app->flush_id == 0)
+    app->flush_id = g_idle_add (messaging_menu_app_flush_idle, app);
 }
 
 static void
@@ -854,6 +1533,7 @@ messaging_menu_app_insert_source_internal (MessagingMenuApp *app,
                                            const gchar      *string)
 {
   Source *source;
+  GSequenceIter *iter;
 
   g_return_if_fail (MESSAGING_MENU_IS_APP (app));
   g_return_if_fail (id != NULL);
@@ -869,11 +1549,18 @@ messaging_menu_app_insert_source_internal (MessagingMenuApp *app,
   source->id = g_strdup (id);
   source->label = g_strdup (label);
   if (icon)
-    source->icon = g_object_ref (icon);
+    {
+      source->icon = g_object_ref (icon);
+      source->icon_ref = messaging_menu_app_ref_icon (app, icon);
+    }
   source->count = count;
   source->time = time;
   source->string = g_strdup (string);
-  app->sources = g_list_insert (app->sources, source, position);
+
+  /* a negative or too large position yields the end iterator */
+  iter = g_sequence_insert_before (g_sequence_get_iter_at_pos (app->sources, position), source);
+  g_hash_table_insert (app->source_index, source->id, iter);
+  messaging_menu_app_record_change (app, NULL);
 
   indicator_messages_application_emit_source_added (app->app_interface,
                                                     position,
@@ -1177,6 +1864,16 @@ messaging_menu_app_set_source_icon (MessagingMenuApp *app,
   source = messaging_menu_app_get_source (app, source_id);
   if (source)
     {
+      gchar *icon_ref;
+
+      /* take the new reference first, so that an unchanged image isn't
+       * unregistered and registered again */
+      icon_ref = icon ? messaging_menu_app_ref_icon (app, icon) : NULL;
+      if (source->icon_ref)
+        messaging_menu_app_unref_icon (app, source->icon_ref);
+      g_free (source->icon_ref);
+      source->icon_ref = icon_ref;
+
       g_clear_object (&source->icon);
       if (icon)
         source->icon = g_object_ref (icon);
@@ -1321,6 +2018,58 @@ messaging_menu_app_remove_attention (MessagingMenuApp *app,
     }
 }
 
+/**
+ * messaging_menu_app_begin_update:
+ * @app: a #MessagingMenuApp
+ *
+ * Starts an update of the sources of @app.  Changes made to sources
+ * until the matching call to messaging_menu_app_commit_update() are
+ * sent to the Messaging Menu together, with every source that was
+ * changed being sent only once.
+ *
+ * Updates can be nested.  Changes are sent when the outermost update
+ * is committed.
+ *
+ * Even without calling this function, changes to sources are gathered
+ * and sent when the main loop is idle.  Use it to make sure that
+ * changes are sent at a specific point.
+ */
+void
+messaging_menu_app_begin_update (MessagingMenuApp *app)
+{
+  g_return_if_fail (MESSAGING_MENU_IS_APP (app));
+
+  app->update_depth++;
+}
+
+/**
+ * messaging_menu_app_commit_update:
+ * @app: a #MessagingMenuApp
+ *
+ * Ends an update started with messaging_menu_app_begin_update().  If
+ * this ends the outermost update, all changed sources are sent to the
+ * Messaging Menu.
+ */
+void
+messaging_menu_app_commit_update (MessagingMenuApp *app)
+{
+  g_return_if_fail (MESSAGING_MENU_IS_APP (app));
+  g_return_if_fail (app->update_depth > 0);
+
+  app->update_depth--;
+
+  if (app->update_depth == 0)
+    {
+      if (app->flush_id)
+        {
+          g_source_remove (app->flush_id);
+          app->flush_id = 0;
+        }
+
+      messaging_menu_app_flush_changed_sources (app);
+    }
+}
+
 /**
  * messaging_menu_app_append_message:
  * @app: a #MessagingMenuApp
@@ -1351,15 +2100,28 @@ messaging_menu_app_append_message (MessagingMenuApp     *app,
 
   id = messaging_menu_message_get_id (msg);
 
-  if (g_hash_table_lookup (app->messages, id))
+  if (g_hash_table_contains (app->messages, id))
     {
       g_warning ("a message with id '%s' already exists", id);
       return;
     }
 
-  g_hash_table_insert (app->messages, g_strdup (id), g_object_ref (msg));
-  indicator_messages_application_emit_message_added (app->app_interface,
-                                                     _messaging_menu_message_to_variant (msg));
+  messaging_menu_app_insert_message_internal (app, msg);
+
+  if (app->max_messages > 0 && g_hash_table_size (app->messages) > app->max_messages)
+    {
+      GHashTable *unannounced;
+
+      unannounced = g_hash_table_new (g_str_hash, g_str_equal);
+      g_hash_table_add (unannounced, (gpointer) id);
+      messaging_menu_app_evict_messages (app, unannounced);
+      g_hash_table_unref (unannounced);
+    }
+
+  /* @msg might have been the oldest message */
+  if (g_hash_table_contains (app->messages, id))
+    indicator_messages_application_emit_message_added (app->app_interface,
+                                                       messaging_menu_app_serialize_message (app, msg));
 
   if (source_id)
     {
@@ -1374,6 +2136,107 @@ messaging_menu_app_append_message (MessagingMenuApp     *app,
     }
 }
 
+/**
+ * messaging_menu_app_append_messages:
+ * @app: a #MessagingMenuApp
+ * @messages: (element-type MessagingMenuMessage): the messages to append
+ * @source_id: (allow-none): the source id to which @messages are added, or NULL
+ * @notify: whether notification bubbles should be shown for these
+ *          messages
+ *
+ * Appends all messages in @messages to the source with id @source_id
+ * of @app.  This is equivalent to calling
+ * messaging_menu_app_append_message() for each message, but sends all
+ * of them to the Messaging Menu at once.
+ *
+ * If @source_id has a count associated with it, that count will be
+ * increased by the number of messages that were appended.
+ */
+void
+messaging_menu_app_append_messages (MessagingMenuApp *app,
+                                    GList            *messages,
+                                    const gchar      *source_id,
+                                    gboolean          notify)
+{
+  GVariantBuilder builder;
+  GHashTable *added;
+  GList *survivors = NULL;
+  GHashTableIter iter;
+  MessagingMenuMessage *msg;
+  guint n_added;
+  GList *it;
+
+  g_return_if_fail (MESSAGING_MENU_IS_APP (app));
+
+  added = g_hash_table_new (g_str_hash, g_str_equal);
+
+  for (it = messages; it; it = it->next)
+    {
+      MessagingMenuMessage *msg = it->data;
+      const gchar *id;
+
+      if (!MESSAGING_MENU_IS_MESSAGE (msg))
+        {
+          g_critical ("%s: element of messages is not a MessagingMenuMessage", G_STRFUNC);
+          continue;
+        }
+
+      id = messaging_menu_message_get_id (msg);
+
+      if (g_hash_table_contains (app->messages, id))
+        {
+          g_warning ("a message with id '%s' already exists", id);
+          continue;
+        }
+
+      messaging_menu_app_insert_message_internal (app, msg);
+      g_hash_table_insert (added, (gpointer) id, msg);
+    }
+
+  n_added = g_hash_table_size (added);
+  if (n_added == 0)
+    {
+      g_hash_table_unref (added);
+      return;
+    }
+
+  messaging_menu_app_evict_messages (app, added);
+
+  g_hash_table_iter_init (&iter, added);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &msg))
+    {
+      if (g_hash_table_contains (app->messages, messaging_menu_message_get_id (msg)))
+        survivors = g_list_prepend (survivors, msg);
+    }
+
+  /* announce them newest first, like ListMessages */
+  survivors = g_list_sort_with_data (survivors, compare_messages_by_time, NULL);
+  survivors = g_list_reverse (survivors);
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(savsssxaa{sv}b)"));
+
+  for (it = survivors; it; it = it->next)
+    g_variant_builder_add_value (&builder, messaging_menu_app_serialize_message (app, it->data));
+
+  indicator_messages_application_emit_messages_added (app->app_interface,
+                                                      g_variant_builder_end (&builder));
+
+  g_list_free (survivors);
+  g_hash_table_unref (added);
+
+  if (source_id)
+    {
+      Source *source;
+
+      source = messaging_menu_app_get_source (app, source_id);
+      if (source)
+        {
+          source->count += n_added;
+          messaging_menu_app_notify_source_changed (app, source);
+        }
+    }
+}
+
 /**
  * messaging_menu_app_get_message:
  * @app: a #MessagingMenuApp
@@ -1392,7 +2255,7 @@ messaging_menu_app_get_message (MessagingMenuApp *app,
   g_return_val_if_fail (MESSAGING_MENU_IS_APP (app), NULL);
   g_return_val_if_fail (id != NULL, NULL);
 
-  return g_hash_table_lookup (app->messages, id);
+  return messaging_menu_app_lookup_message (app, id);
 }
 
 /**
@@ -1436,3 +2299,85 @@ messaging_menu_app_remove_message_by_id (MessagingMenuApp     *app,
   if (messaging_menu_app_remove_message_internal (app, id))
     indicator_messages_application_emit_message_removed (app->app_interface, id);
 }
+
+/**
+ * messaging_menu_app_remove_messages:
+ * @app: a #MessagingMenuApp
+ * @ids: (array zero-terminated=1): a %NULL-terminated array of message ids
+ *
+ * Removes all messages with ids in @ids from @app.  This is equivalent
+ * to calling messaging_menu_app_remove_message_by_id() for each id, but
+ * tells the Messaging Menu about all removed messages at once.
+ */
+void
+messaging_menu_app_remove_messages (MessagingMenuApp    *app,
+                                    const gchar * const *ids)
+{
+  GPtrArray *removed;
+  const gchar * const *it;
+
+  g_return_if_fail (MESSAGING_MENU_IS_APP (app));
+  g_return_if_fail (ids != NULL);
+
+  /* @ids might point into the messages that are removed */
+  removed = g_ptr_array_new_with_free_func (g_free);
+
+  for (it = ids; *it; it++)
+    {
+      gchar *id = g_strdup (*it);
+
+      if (messaging_menu_app_remove_message_internal (app, id))
+        g_ptr_array_add (removed, id);
+      else
+        g_free (id);
+    }
+
+  if (removed->len > 0)
+    {
+      g_ptr_array_add (removed, NULL);
+      indicator_messages_application_emit_messages_removed (app->app_interface,
+                                                            (const gchar * const *) removed->pdata);
+    }
+
+  g_ptr_array_free (removed, TRUE);
+}
+
+/**
+ * messaging_menu_app_set_max_messages:
+ * @app: a #MessagingMenuApp
+ * @max_messages: the maximum number of messages, or 0 for no limit
+ *
+ * Limits the number of messages @app keeps to @max_messages.  When a
+ * message is appended while the limit is reached, the oldest messages
+ * (by their time) are removed to make room.  If the current number of
+ * messages exceeds @max_messages, the oldest ones are removed right
+ * away.
+ *
+ * Note that the Messaging Menu applies its own limit as well.
+ *
+ * By default, the number of messages is not limited.
+ */
+void
+messaging_menu_app_set_max_messages (MessagingMenuApp *app,
+                                     guint             max_messages)
+{
+  g_return_if_fail (MESSAGING_MENU_IS_APP (app));
+
+  app->max_messages = max_messages;
+  messaging_menu_app_evict_messages (app, NULL);
+}
+
+/**
+ * messaging_menu_app_get_max_messages:
+ * @app: a #MessagingMenuApp
+ *
+ * Returns: the maximum number of messages @app keeps, or 0 if there
+ * is no limit.  See messaging_menu_app_set_max_messages().
+ */
+guint
+messaging_menu_app_get_max_messages (MessagingMenuApp *app)
+{
+  g_return_val_if_fail (MESSAGING_MENU_IS_APP (app), 0);
+
+  return app->max_messages;
+}
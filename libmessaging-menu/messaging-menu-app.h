@@ -144,11 +144,20 @@ void                messaging_menu_app_draw_attention            (MessagingMenuA
 void                messaging_menu_app_remove_attention          (MessagingMenuApp *app,
                                                                   const gchar      *source_id);
 
+void                messaging_menu_app_begin_update              (MessagingMenuApp *app);
+
+void                messaging_menu_app_commit_update             (MessagingMenuApp *app);
+
 void                messaging_menu_app_append_message            (MessagingMenuApp     *app,
                                                                   MessagingMenuMessage *msg,
                                                                   const gchar          *source_id,
                                                                   gboolean              notify);
 
+void                messaging_menu_app_append_messages           (MessagingMenuApp *app,
+                                                                  GList            *messages,
+                                                                  const gchar      *source_id,
+                                                                  gboolean          notify);
+
 MessagingMenuMessage * messaging_menu_app_get_message            (MessagingMenuApp *app,
                                                                   const gchar      *id);
 
@@ -158,6 +167,14 @@ void                messaging_menu_app_remove_message            (MessagingMenuA
 void                messaging_menu_app_remove_message_by_id      (MessagingMenuApp     *app,
                                                                   const gchar          *id);
 
+void                messaging_menu_app_remove_messages           (MessagingMenuApp    *app,
+                                                                  const gchar * const *ids);
+
+void                messaging_menu_app_set_max_messages          (MessagingMenuApp *app,
+                                                                  guint             max_messages);
+
+guint               messaging_menu_app_get_max_messages          (MessagingMenuApp *app);
+
 G_END_DECLS
 
 #endif
@@ -17,7 +17,18 @@
  *     Lars Uebernickel <lars.uebernickel@canonical.com>
  */
 
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
 #include "messaging-menu-message.h"
+#include "message-body.h"
+
+#include <string.h>
+
+/* Bodies longer than this are not sent over the bus. They are handed
+ * to the service as a sealed memfd on request (see message-body.h) */
+#define BODY_MEMFD_THRESHOLD (64 * 1024)
 
 /**
  * SECTION:messaging-menu-message
@@ -41,6 +52,10 @@ struct _MessagingMenuMessage
   gboolean draws_attention;
 
   GSList *actions;
+
+  gchar *icon_ref;       /* set by the app the message was appended to */
+  GVariant *serialized;  /* cache for _messaging_menu_message_to_variant() */
+  gboolean serialized_with_placeholder;
 };
 
 G_DEFINE_TYPE (MessagingMenuMessage, messaging_menu_message, G_TYPE_OBJECT);
@@ -104,10 +119,13 @@ messaging_menu_message_finalize (GObject *object)
   g_free (msg->title);
   g_free (msg->subtitle);
   g_free (msg->body);
+  g_free (msg->icon_ref);
 
   g_slist_free_full (msg->actions, action_free);
   msg->actions = NULL;
 
+  g_clear_pointer (&msg->serialized, g_variant_unref);
+
   G_OBJECT_CLASS (messaging_menu_message_parent_class)->finalize (object);
 }
 
@@ -428,6 +446,7 @@ messaging_menu_message_set_draws_attention  (MessagingMenuMessage *msg,
   g_return_if_fail (MESSAGING_MENU_IS_MESSAGE (msg));
 
   msg->draws_attention = draws_attention;
+  g_clear_pointer (&msg->serialized, g_variant_unref);
   g_object_notify_by_pspec (G_OBJECT (msg), properties[PROP_DRAWS_ATTENTION]);
 }
 
@@ -473,6 +492,7 @@ messaging_menu_message_add_action (MessagingMenuMessage *msg,
   action->parameter_hint = parameter_hint ? g_variant_ref_sink (parameter_hint) : NULL;
 
   msg->actions = g_slist_append (msg->actions, action);
+  g_clear_pointer (&msg->serialized, g_variant_unref);
 }
 
 static GVariant *
@@ -500,9 +520,85 @@ action_to_variant (Action *action)
   return g_variant_builder_end (&builder);
 }
 
+/*<internal>
+ * _messaging_menu_serialize_icon:
+ * @icon: (allow-none): a #GIcon
+ * @icon_ref: (allow-none): the reference under which @icon was
+ *   announced with IconRegistered
+ *
+ * Serializes @icon into the fake-maybe (av) format used for messages
+ * and sources. If @icon_ref is given, only the reference is sent, in
+ * the form ('icon-ref', <@icon_ref>), and the service looks up the
+ * actual image in its icon table.
+ *
+ * Returns: (transfer floating): a #GVariant of type av
+ */
+GVariant *
+_messaging_menu_serialize_icon (GIcon       *icon,
+                                const gchar *icon_ref)
+{
+  GVariantBuilder builder;
+  GVariant *serialized_icon;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("av"));
+
+  if (icon_ref)
+    {
+      g_variant_builder_add (&builder, "v", g_variant_new ("(sv)", "icon-ref",
+                                                           g_variant_new_string (icon_ref)));
+    }
+  else if (icon && (serialized_icon = g_icon_serialize (icon)))
+    {
+      g_variant_builder_add (&builder, "v", serialized_icon);
+      g_variant_unref (serialized_icon);
+    }
+
+  return g_variant_builder_end (&builder);
+}
+
+/*<internal>
+ * _messaging_menu_message_get_icon_ref:
+ * @msg: a #MessagingMenuMessage
+ *
+ * Returns: the reference of @msg's icon in the icon table of the
+ * #MessagingMenuApp it was appended to, or %NULL
+ */
+const gchar *
+_messaging_menu_message_get_icon_ref (MessagingMenuMessage *msg)
+{
+  g_return_val_if_fail (MESSAGING_MENU_IS_MESSAGE (msg), NULL);
+
+  return msg->icon_ref;
+}
+
+/*<internal>
+ * _messaging_menu_message_set_icon_ref:
+ * @msg: a #MessagingMenuMessage
+ * @icon_ref: (allow-none): a reference to @msg's icon
+ *
+ * Makes @msg refer to its icon by @icon_ref instead of sending the
+ * icon inline.
+ */
+void
+_messaging_menu_message_set_icon_ref (MessagingMenuMessage *msg,
+                                      const gchar          *icon_ref)
+{
+  g_return_if_fail (MESSAGING_MENU_IS_MESSAGE (msg));
+
+  if (g_strcmp0 (msg->icon_ref, icon_ref) == 0)
+    return;
+
+  g_free (msg->icon_ref);
+  msg->icon_ref = g_strdup (icon_ref);
+
+  g_clear_pointer (&msg->serialized, g_variant_unref);
+}
+
 /*<internal>
  * _messaging_menu_message_to_variant:
  * @msg: a #MessagingMenuMessage
+ * @body_placeholder: whether a long body may be replaced with a
+ *   placeholder (the service supports GetBody)
  *
  * Serializes @msg to a #GVariant of the form (savsssxaa{sv}b):
  *
@@ -510,37 +606,49 @@ action_to_variant (Action *action)
  *   icon (fake-maybe)
  *   title
  *   subtitle
- *   body
+ *   body (or a placeholder, if it is too long to be sent inline and
+ *         @body_placeholder is %TRUE)
  *   time
  *   array of action dictionaries
  *   draws_attention
  *
- * Returns: a new floating #GVariant instance
+ * The result is cached until @msg changes, so that messages can be
+ * sent again (for example, when the service restarts) without
+ * serializing them (and their icons) anew.
+ *
+ * Returns: (transfer none): a #GVariant owned by @msg
  */
 GVariant *
-_messaging_menu_message_to_variant (MessagingMenuMessage *msg)
+_messaging_menu_message_to_variant (MessagingMenuMessage *msg,
+                                    gboolean              body_placeholder)
 {
   GVariantBuilder builder;
   GSList *it;
-  GVariant *serialized_icon;
-  GVariantBuilder icon_builder;
 
   g_return_val_if_fail (MESSAGING_MENU_IS_MESSAGE (msg), NULL);
 
-  serialized_icon = msg->icon ? g_icon_serialize (msg->icon) : NULL;
-  g_variant_builder_init (&icon_builder, G_VARIANT_TYPE ("av"));
-  if (serialized_icon)
-    {
-      g_variant_builder_add (&icon_builder, "v", serialized_icon);
-      g_variant_unref (serialized_icon);
-    }
+  if (msg->serialized && msg->serialized_with_placeholder == body_placeholder)
+    return msg->serialized;
+
+  g_clear_pointer (&msg->serialized, g_variant_unref);
 
   g_variant_builder_init (&builder, G_VARIANT_TYPE ("(savsssxaa{sv}b)"));
   g_variant_builder_add (&builder, "s", msg->id);
-  g_variant_builder_add (&builder, "av", &icon_builder);
+  g_variant_builder_add_value (&builder, _messaging_menu_serialize_icon (msg->icon, msg->icon_ref));
   g_variant_builder_add (&builder, "s", msg->title ? msg->title : "");
   g_variant_builder_add (&builder, "s", msg->subtitle ? msg->subtitle : "");
-  g_variant_builder_add (&builder, "s", msg->body ? msg->body : "");
+#ifdef HAVE_MEMFD_CREATE
+  if (body_placeholder && msg->body && strlen (msg->body) > BODY_MEMFD_THRESHOLD)
+    {
+      gchar *placeholder;
+
+      placeholder = g_strdup_printf (BODY_PLACEHOLDER_FORMAT, strlen (msg->body) + 1);
+      g_variant_builder_add (&builder, "s", placeholder);
+      g_free (placeholder);
+    }
+  else
+#endif
+    g_variant_builder_add (&builder, "s", msg->body ? msg->body : "");
   g_variant_builder_add (&builder, "x", msg->time);
 
   g_variant_builder_open (&builder, G_VARIANT_TYPE ("aa{sv}"));
@@ -550,5 +658,8 @@ _messaging_menu_message_to_variant (MessagingMenuMessage *msg)
 
   g_variant_builder_add (&builder, "b", msg->draws_attention);
 
-  return g_variant_builder_end (&builder);
+  msg->serialized = g_variant_ref_sink (g_variant_builder_end (&builder));
+  msg->serialized_with_placeholder = body_placeholder;
+
+  return msg->serialized;
 }
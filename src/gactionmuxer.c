@@ -44,6 +44,17 @@
  *
  * Activations and state change requests on the #GActionMuxer are wired
  * through to the underlying action group in the expected way.
+ *
+ * Changes to the set of actions can be grouped with
+ * g_action_muxer_begin_batch() and g_action_muxer_end_batch().  While a
+ * batch is in progress, no #GActionGroup::action-added or
+ * #GActionGroup::action-removed signals are emitted.  Instead, all
+ * changes are collected and announced at the end of the batch with a
+ * single #GActionMuxer::actions-changed signal.  Inserting or removing
+ * a whole group is always done in a batch.
+ *
+ * Muxers nested in other muxers forward their batches to the parent
+ * as one batch.
  */
 
 typedef GObjectClass GActionMuxerClass;
@@ -54,8 +65,23 @@ struct _GActionMuxer
   GActionGroup *global_actions;
   GHashTable *groups;  /* prefix -> subgroup */
   GHashTable *reverse; /* subgroup -> prefix */
+  GHashTable *actions; /* set of full action names */
+
+  guint batch_depth;
+  GHashTable *batch_added;   /* full names added in the current batch */
+  GHashTable *batch_removed; /* full names removed in the current batch */
+  gboolean flushing;
+  gboolean grouped_signals;
+};
+
+enum
+{
+  ACTIONS_CHANGED,
+  N_SIGNALS
 };
 
+static guint signals[N_SIGNALS];
+
 
 static void     g_action_muxer_group_init             (GActionGroupInterface *iface);
 static void     g_action_muxer_dispose                (GObject *object);
@@ -90,6 +116,10 @@ static void     g_action_muxer_action_enabled_changed (GActionGroup *group,
                                                        gchar        *action_name,
                                                        gboolean      enabled,
                                                        gpointer      user_data);
+static void     g_action_muxer_actions_changed        (GActionMuxer *subgroup,
+                                                       gchar       **removed,
+                                                       gchar       **added,
+                                                       gpointer      user_data);
 
 G_DEFINE_TYPE_WITH_CODE (GActionMuxer, g_action_muxer, G_TYPE_OBJECT,
                          G_IMPLEMENT_INTERFACE (G_TYPE_ACTION_GROUP, g_action_muxer_group_init));
@@ -100,6 +130,32 @@ g_action_muxer_class_init (GObjectClass *klass)
 {
   klass->dispose = g_action_muxer_dispose;
   klass->finalize = g_action_muxer_finalize;
+
+  /*
+   * GActionMuxer::actions-changed:
+   * @muxer: the #GActionMuxer
+   * @removed: the full names of actions that were removed
+   * @added: the full names of actions that were added
+   *
+   * Emitted at the end of a batch (see g_action_muxer_begin_batch()) in
+   * which actions were added or removed.  An action that was added and
+   * removed again in the same batch doesn't appear in either list.  An
+   * action that was replaced appears in both.
+   *
+   * Unless g_action_muxer_set_grouped_signals() was used to turn it
+   * off, the individual ::action-removed and ::action-added signals
+   * are emitted right after this signal.
+   */
+  signals[ACTIONS_CHANGED] = g_signal_new ("actions-changed",
+                                           G_TYPE_FROM_CLASS (klass),
+                                           G_SIGNAL_RUN_LAST,
+                                           0,
+                                           NULL, NULL,
+                                           g_cclosure_marshal_generic,
+                                           G_TYPE_NONE,
+                                           2,
+                                           G_TYPE_STRV,
+                                           G_TYPE_STRV);
 }
 
 static void
@@ -108,6 +164,9 @@ g_action_muxer_init (GActionMuxer *muxer)
   muxer->global_actions = NULL;
   muxer->groups = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
   muxer->reverse = g_hash_table_new (g_direct_hash, g_direct_equal);
+  muxer->actions = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  muxer->batch_added = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  muxer->batch_removed = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 }
 
 static void
@@ -138,6 +197,7 @@ g_action_muxer_dispose (GObject *object)
 
   g_hash_table_remove_all (muxer->groups);
   g_hash_table_remove_all (muxer->reverse);
+  g_hash_table_remove_all (muxer->actions);
 }
 
 static void
@@ -147,6 +207,9 @@ g_action_muxer_finalize (GObject *object)
 
   g_hash_table_unref (muxer->groups);
   g_hash_table_unref (muxer->reverse);
+  g_hash_table_unref (muxer->actions);
+  g_hash_table_unref (muxer->batch_added);
+  g_hash_table_unref (muxer->batch_removed);
 
   G_OBJECT_CLASS (g_action_muxer_parent_class)->finalize (object);
 }
@@ -196,6 +259,126 @@ g_action_muxer_lookup_full_name (GActionMuxer *muxer,
   return NULL;
 }
 
+static gchar **
+g_action_muxer_steal_names (GHashTable *names)
+{
+  GHashTableIter it;
+  gchar *name;
+  gchar **strv;
+  guint i = 0;
+
+  strv = g_new (gchar *, g_hash_table_size (names) + 1);
+
+  g_hash_table_iter_init (&it, names);
+  while (g_hash_table_iter_next (&it, (gpointer *) &name, NULL))
+    {
+      strv[i++] = name;
+      g_hash_table_iter_steal (&it);
+    }
+  strv[i] = NULL;
+
+  return strv;
+}
+
+/* Announces all changes that were collected since the batch started.
+ * This doesn't end the batch. */
+static void
+g_action_muxer_flush_batch (GActionMuxer *muxer)
+{
+  gchar **removed;
+  gchar **added;
+  gchar **it;
+
+  if (g_hash_table_size (muxer->batch_added) == 0 &&
+      g_hash_table_size (muxer->batch_removed) == 0)
+    return;
+
+  removed = g_action_muxer_steal_names (muxer->batch_removed);
+  added = g_action_muxer_steal_names (muxer->batch_added);
+
+  muxer->flushing = TRUE;
+
+  g_signal_emit (muxer, signals[ACTIONS_CHANGED], 0, removed, added);
+
+  if (!muxer->grouped_signals)
+    {
+      for (it = removed; *it; it++)
+        g_action_group_action_removed (G_ACTION_GROUP (muxer), *it);
+
+      for (it = added; *it; it++)
+        g_action_group_action_added (G_ACTION_GROUP (muxer), *it);
+    }
+
+  muxer->flushing = FALSE;
+
+  g_strfreev (removed);
+  g_strfreev (added);
+}
+
+static void
+g_action_muxer_notify_added (GActionMuxer *muxer,
+                             const gchar  *full_name)
+{
+  g_hash_table_add (muxer->actions, g_strdup (full_name));
+
+  if (muxer->batch_depth > 0)
+    g_hash_table_add (muxer->batch_added, g_strdup (full_name));
+  else
+    g_action_group_action_added (G_ACTION_GROUP (muxer), full_name);
+}
+
+static void
+g_action_muxer_notify_removed (GActionMuxer *muxer,
+                               const gchar  *full_name)
+{
+  if (muxer->batch_depth > 0)
+    {
+      /* no need to announce the removal of an action that nobody
+       * has heard about yet */
+      if (!g_hash_table_remove (muxer->batch_added, full_name))
+        g_hash_table_add (muxer->batch_removed, g_strdup (full_name));
+    }
+  else
+    {
+      /* emitted before the action is gone, as GActionGroup requires */
+      g_action_group_action_removed (G_ACTION_GROUP (muxer), full_name);
+    }
+
+  g_hash_table_remove (muxer->actions, full_name);
+}
+
+static void
+g_action_muxer_forward_added (GActionMuxer *muxer,
+                              GActionGroup *subgroup,
+                              const gchar  *action_name)
+{
+  gchar *full_name;
+
+  full_name = g_action_muxer_lookup_full_name (muxer, subgroup, action_name);
+
+  if (full_name)
+    {
+      g_action_muxer_notify_added (muxer, full_name);
+      g_free (full_name);
+    }
+}
+
+static void
+g_action_muxer_forward_removed (GActionMuxer *muxer,
+                                GActionGroup *subgroup,
+                                const gchar  *action_name)
+{
+  gchar *full_name;
+
+  full_name = g_action_muxer_lookup_full_name (muxer, subgroup, action_name);
+
+  if (full_name)
+    {
+      g_action_muxer_notify_removed (muxer, full_name);
+      g_free (full_name);
+    }
+}
+
 static void
 g_action_muxer_disconnect_group (GActionMuxer *muxer,
                                  GActionGroup *subgroup)
@@ -203,54 +386,43 @@ g_action_muxer_disconnect_group (GActionMuxer *muxer,
   gchar **actions;
   gchar **action;
 
+  /* Make sure a nested muxer has told us about everything it contains
+   * before we use its list of actions to remove ours. */
+  if (G_IS_ACTION_MUXER (subgroup))
+    g_action_muxer_flush_batch (G_ACTION_MUXER (subgroup));
+
   actions = g_action_group_list_actions (subgroup);
   for (action = actions; *action; action++)
-    g_action_muxer_action_removed (subgroup, *action, muxer);
+    g_action_muxer_forward_removed (muxer, subgroup, *action);
   g_strfreev (actions);
 
   g_signal_handlers_disconnect_by_func (subgroup, g_action_muxer_action_added, muxer);
   g_signal_handlers_disconnect_by_func (subgroup, g_action_muxer_action_removed, muxer);
   g_signal_handlers_disconnect_by_func (subgroup, g_action_muxer_action_enabled_changed, muxer);
   g_signal_handlers_disconnect_by_func (subgroup, g_action_muxer_action_state_changed, muxer);
+  g_signal_handlers_disconnect_by_func (subgroup, g_action_muxer_actions_changed, muxer);
 }
 
+/* The flattened list of action names is kept in muxer->actions and
+ * updated from the action-added and action-removed handlers below, so
+ * that listing doesn't have to recurse into every subgroup. */
 static gchar **
 g_action_muxer_list_actions (GActionGroup *group)
 {
   GActionMuxer *muxer = G_ACTION_MUXER (group);
   GHashTableIter it;
-  GArray *all_actions;
-  gchar *prefix;
-  GActionGroup *subgroup;
+  const gchar *name;
   gchar **actions;
-  gchar **a;
+  guint i = 0;
 
-  all_actions = g_array_sized_new (TRUE, FALSE, sizeof (gchar *), 8);
+  actions = g_new (gchar *, g_hash_table_size (muxer->actions) + 1);
 
-  if (muxer->global_actions)
-    {
-      actions = g_action_group_list_actions (muxer->global_actions);
-      for (a = actions; *a; a++)
-        {
-          gchar *name = g_strdup (*a);
-          g_array_append_val (all_actions, name);
-        }
-      g_strfreev (actions);
-    }
+  g_hash_table_iter_init (&it, muxer->actions);
+  while (g_hash_table_iter_next (&it, (gpointer *) &name, NULL))
+    actions[i++] = g_strdup (name);
+  actions[i] = NULL;
 
-  g_hash_table_iter_init (&it, muxer->groups);
-  while (g_hash_table_iter_next (&it, (gpointer *) &prefix, (gpointer *) &subgroup))
-    {
-      actions = g_action_group_list_actions (subgroup);
-      for (a = actions; *a; a++)
-        {
-          gchar *full_name = g_strdup_printf ("%s.%s", prefix, *a);
-          g_array_append_val (all_actions, full_name);
-        }
-      g_strfreev (actions);
-    }
-
-  return (gchar **) g_array_free (all_actions, FALSE);
+  return actions;
 }
 
 static void
@@ -311,21 +483,24 @@ g_action_muxer_query_action (GActionGroup        *group,
                                       state_type, state_hint, state);
 }
 
+/* A nested muxer replays the contents of its ::actions-changed signal
+ * as individual signals.  Those have already been handled in
+ * g_action_muxer_actions_changed(). */
+static gboolean
+g_action_muxer_is_flushing (GActionGroup *group)
+{
+  return G_IS_ACTION_MUXER (group) && G_ACTION_MUXER (group)->flushing;
+}
+
 static void
 g_action_muxer_action_added (GActionGroup *group,
                              gchar        *action_name,
                              gpointer      user_data)
 {
   GActionMuxer *muxer = user_data;
-  gchar *full_name;
 
-  full_name = g_action_muxer_lookup_full_name (muxer, group, action_name);
-
-  if (full_name)
-    {
-      g_action_group_action_added (G_ACTION_GROUP (muxer), full_name);
-      g_free (full_name);
-    }
+  if (!g_action_muxer_is_flushing (group))
+    g_action_muxer_forward_added (muxer, group, action_name);
 }
 
 static void
@@ -334,15 +509,29 @@ g_action_muxer_action_removed (GActionGroup *group,
                                gpointer      user_data)
 {
   GActionMuxer *muxer = user_data;
-  gchar *full_name;
 
-  full_name = g_action_muxer_lookup_full_name (muxer, group, action_name);
+  if (!g_action_muxer_is_flushing (group))
+    g_action_muxer_forward_removed (muxer, group, action_name);
+}
 
-  if (full_name)
-    {
-      g_action_group_action_removed (G_ACTION_GROUP (muxer), full_name);
-      g_free (full_name);
-    }
+static void
+g_action_muxer_actions_changed (GActionMuxer  *subgroup,
+                                gchar        **removed,
+                                gchar        **added,
+                                gpointer       user_data)
+{
+  GActionMuxer *muxer = user_data;
+  gchar **it;
+
+  g_action_muxer_begin_batch (muxer);
+
+  for (it = removed; *it; it++)
+    g_action_muxer_forward_removed (muxer, G_ACTION_GROUP (subgroup), *it);
+
+  for (it = added; *it; it++)
+    g_action_muxer_forward_added (muxer, G_ACTION_GROUP (subgroup), *it);
+
+  g_action_muxer_end_batch (muxer);
 }
 
 static void
@@ -356,11 +545,12 @@ g_action_muxer_action_state_changed (GActionGroup *group,
 
   full_name = g_action_muxer_lookup_full_name (muxer, group, action_name);
 
-  if (full_name)
-    {
-      g_action_group_action_state_changed (G_ACTION_GROUP (muxer), full_name, value);
-      g_free (full_name);
-    }
+  /* actions added in the current batch will be announced with their
+   * current state when the batch ends */
+  if (full_name && !g_hash_table_contains (muxer->batch_added, full_name))
+    g_action_group_action_state_changed (G_ACTION_GROUP (muxer), full_name, value);
+
+  g_free (full_name);
 }
 
 static void
@@ -374,11 +564,10 @@ g_action_muxer_action_enabled_changed (GActionGroup *group,
 
   full_name = g_action_muxer_lookup_full_name (muxer, group, action_name);
 
-  if (full_name)
-    {
-      g_action_group_action_enabled_changed (G_ACTION_GROUP (muxer), full_name, enabled);
-      g_free (full_name);
-    }
+  if (full_name && !g_hash_table_contains (muxer->batch_added, full_name))
+    g_action_group_action_enabled_changed (G_ACTION_GROUP (muxer), full_name, enabled);
+
+  g_free (full_name);
 }
 
 /*
@@ -431,10 +620,15 @@ g_action_muxer_insert (GActionMuxer *muxer,
   g_return_if_fail (G_IS_ACTION_MUXER (muxer));
   g_return_if_fail (group == NULL || G_IS_ACTION_GROUP (group));
 
+  g_action_muxer_begin_batch (muxer);
+
   g_action_muxer_remove (muxer, prefix);
 
   if (group == NULL)
-    return;
+    {
+      g_action_muxer_end_batch (muxer);
+      return;
+    }
 
   if (prefix)
     {
@@ -445,15 +639,25 @@ g_action_muxer_insert (GActionMuxer *muxer,
   else
     muxer->global_actions = g_object_ref (group);
 
+  /* flush a nested muxer first, so that the list of actions below
+   * agrees with the changes it will announce later on */
+  if (G_IS_ACTION_MUXER (group))
+    g_action_muxer_flush_batch (G_ACTION_MUXER (group));
+
   actions = g_action_group_list_actions (group);
   for (action = actions; *action; action++)
-    g_action_muxer_action_added (group, *action, muxer);
+    g_action_muxer_forward_added (muxer, group, *action);
   g_strfreev (actions);
 
   g_signal_connect (group, "action-added", G_CALLBACK (g_action_muxer_action_added), muxer);
   g_signal_connect (group, "action-removed", G_CALLBACK (g_action_muxer_action_removed), muxer);
   g_signal_connect (group, "action-enabled-changed", G_CALLBACK (g_action_muxer_action_enabled_changed), muxer);
   g_signal_connect (group, "action-state-changed", G_CALLBACK (g_action_muxer_action_state_changed), muxer);
+
+  if (G_IS_ACTION_MUXER (group))
+    g_signal_connect (group, "actions-changed", G_CALLBACK (g_action_muxer_actions_changed), muxer);
+
+  g_action_muxer_end_batch (muxer);
 }
 
 /*
@@ -475,6 +679,8 @@ g_action_muxer_remove (GActionMuxer *muxer,
   if (!subgroup)
     return;
 
+  g_action_muxer_begin_batch (muxer);
+
   g_action_muxer_disconnect_group (muxer, subgroup);
 
   if (prefix)
@@ -484,6 +690,8 @@ g_action_muxer_remove (GActionMuxer *muxer,
     }
   else
     g_clear_object (&muxer->global_actions);
+
+  g_action_muxer_end_batch (muxer);
 }
 
 GActionGroup *
@@ -494,3 +702,110 @@ g_action_muxer_get_group (GActionMuxer *muxer,
 
   return prefix ? g_hash_table_lookup (muxer->groups, prefix) : muxer->global_actions;
 }
+
+/*
+ * g_action_muxer_get_n_actions:
+ * @muxer: a #GActionMuxer
+ *
+ * Returns the number of actions in @muxer, including those of all
+ * subgroups.  This is equivalent to the length of the array returned by
+ * g_action_group_list_actions(), but doesn't allocate.
+ */
+guint
+g_action_muxer_get_n_actions (GActionMuxer *muxer)
+{
+  g_return_val_if_fail (G_IS_ACTION_MUXER (muxer), 0);
+
+  return g_hash_table_size (muxer->actions);
+}
+
+/*
+ * g_action_muxer_iter_init:
+ * @iter: an uninitialized #GActionMuxerIter
+ * @muxer: a #GActionMuxer
+ *
+ * Initializes @iter to iterate over the full names of all actions in
+ * @muxer.  The muxer must not be modified while iterating.
+ */
+void
+g_action_muxer_iter_init (GActionMuxerIter *iter,
+                          GActionMuxer     *muxer)
+{
+  g_return_if_fail (iter != NULL);
+  g_return_if_fail (G_IS_ACTION_MUXER (muxer));
+
+  g_hash_table_iter_init (&iter->it, muxer->actions);
+}
+
+/*
+ * g_action_muxer_iter_next:
+ * @iter: a #GActionMuxerIter
+ * @action_name: (out): return location for the action name
+ *
+ * Advances @iter and stores the next action name in @action_name.  The
+ * name is owned by the muxer.
+ *
+ * Returns: %FALSE if the end of the list has been reached
+ */
+gboolean
+g_action_muxer_iter_next (GActionMuxerIter  *iter,
+                          const gchar      **action_name)
+{
+  g_return_val_if_fail (iter != NULL, FALSE);
+
+  return g_hash_table_iter_next (&iter->it, (gpointer *) action_name, NULL);
+}
+
+/*
+ * g_action_muxer_begin_batch:
+ * @muxer: a #GActionMuxer
+ *
+ * Starts collecting added and removed actions of @muxer, until the
+ * matching call to g_action_muxer_end_batch().  Batches can be nested;
+ * changes are announced when the outermost batch ends.
+ */
+void
+g_action_muxer_begin_batch (GActionMuxer *muxer)
+{
+  g_return_if_fail (G_IS_ACTION_MUXER (muxer));
+
+  muxer->batch_depth++;
+}
+
+/*
+ * g_action_muxer_end_batch:
+ * @muxer: a #GActionMuxer
+ *
+ * Ends a batch started with g_action_muxer_begin_batch().  If this was
+ * the outermost batch, emits #GActionMuxer::actions-changed with all
+ * changes that happened in the meantime.
+ */
+void
+g_action_muxer_end_batch (GActionMuxer *muxer)
+{
+  g_return_if_fail (G_IS_ACTION_MUXER (muxer));
+  g_return_if_fail (muxer->batch_depth > 0);
+
+  if (--muxer->batch_depth == 0)
+    g_action_muxer_flush_batch (muxer);
+}
+
+/*
+ * g_action_muxer_set_grouped_signals:
+ * @muxer: a #GActionMuxer
+ * @grouped: whether to only announce batches with ::actions-changed
+ *
+ * By default, the changes of a batch are announced with
+ * #GActionMuxer::actions-changed followed by the individual
+ * #GActionGroup signals for each action, so that consumers that don't
+ * know about batches keep working.  If every consumer of @muxer handles
+ * ::actions-changed, set @grouped to %TRUE to skip the latter.
+ */
+void
+g_action_muxer_set_grouped_signals (GActionMuxer *muxer,
+                                    gboolean      grouped)
+{
+  g_return_if_fail (G_IS_ACTION_MUXER (muxer));
+
+  muxer->grouped_signals = grouped;
+}
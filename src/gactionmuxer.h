@@ -29,6 +29,12 @@
 
 typedef struct _GActionMuxer GActionMuxer;
 
+typedef struct
+{
+  /*< private >*/
+  GHashTableIter it;
+} GActionMuxerIter;
+
 GType          g_action_muxer_get_type (void) G_GNUC_CONST;
 
 GActionMuxer * g_action_muxer_new      (void);
@@ -43,5 +49,20 @@ void           g_action_muxer_remove   (GActionMuxer *muxer,
 GActionGroup * g_action_muxer_get_group (GActionMuxer *muxer,
                                          const gchar  *prefix);
 
+guint          g_action_muxer_get_n_actions (GActionMuxer *muxer);
+
+void           g_action_muxer_iter_init (GActionMuxerIter *iter,
+                                         GActionMuxer     *muxer);
+
+gboolean       g_action_muxer_iter_next (GActionMuxerIter  *iter,
+                                         const gchar      **action_name);
+
+void           g_action_muxer_begin_batch (GActionMuxer *muxer);
+
+void           g_action_muxer_end_batch   (GActionMuxer *muxer);
+
+void           g_action_muxer_set_grouped_signals (GActionMuxer *muxer,
+                                                   gboolean      grouped);
+
 #endif
 
@@ -104,3 +104,225 @@ g_settings_strv_remove (GSettings   *settings,
 
   g_strfreev (strv);
 }
+
+/* Seconds to wait for more changes before writing a GSettingsStrvSet */
+#define G_SETTINGS_STRV_SET_FLUSH_DELAY 2
+
+struct _GSettingsStrvSet
+{
+  GSettings *settings;
+  gchar *key;
+  GPtrArray *items;     /* in the order they were added */
+  GHashTable *index;    /* the strings in @items */
+  guint flush_id;
+  gulong changed_id;
+};
+
+static void
+g_settings_strv_set_load (GSettingsStrvSet *set)
+{
+  gchar **strv;
+  gchar **it;
+
+  g_hash_table_remove_all (set->index);
+  g_ptr_array_set_size (set->items, 0);
+
+  strv = g_settings_get_strv (set->settings, set->key);
+  for (it = strv; *it; it++)
+    {
+      if (!g_hash_table_contains (set->index, *it))
+        {
+          g_ptr_array_add (set->items, *it);
+          g_hash_table_add (set->index, *it);
+        }
+      else
+        g_free (*it);
+    }
+
+  /* the strings are owned by @items now */
+  g_free (strv);
+}
+
+static void
+g_settings_strv_set_changed (GSettings   *settings,
+                             const gchar *key,
+                             gpointer     user_data)
+{
+  GSettingsStrvSet *set = user_data;
+
+  /* pending changes win over changes made by someone else */
+  if (set->flush_id == 0)
+    g_settings_strv_set_load (set);
+}
+
+/**
+ * g_settings_strv_set_new:
+ * @settings: a #GSettings object
+ * @key: the key at which @settings contains a string array
+ *
+ * Creates an in-memory set of the strings at @key.  Changes to the set
+ * are written back to @settings in one go, a few seconds after the
+ * last one, or when g_settings_strv_set_flush() is called.
+ *
+ * Returns: a new #GSettingsStrvSet
+ */
+GSettingsStrvSet *
+g_settings_strv_set_new (GSettings   *settings,
+                         const gchar *key)
+{
+  GSettingsStrvSet *set;
+  gchar *signal;
+
+  g_return_val_if_fail (G_IS_SETTINGS (settings), NULL);
+  g_return_val_if_fail (key != NULL, NULL);
+
+  set = g_slice_new0 (GSettingsStrvSet);
+  set->settings = g_object_ref (settings);
+  set->key = g_strdup (key);
+  set->items = g_ptr_array_new_with_free_func (g_free);
+  set->index = g_hash_table_new (g_str_hash, g_str_equal);
+
+  g_settings_strv_set_load (set);
+
+  signal = g_strconcat ("changed::", key, NULL);
+  set->changed_id = g_signal_connect (settings, signal, G_CALLBACK (g_settings_strv_set_changed), set);
+  g_free (signal);
+
+  return set;
+}
+
+/**
+ * g_settings_strv_set_free:
+ * @set: a #GSettingsStrvSet
+ *
+ * Writes pending changes and frees @set.
+ */
+void
+g_settings_strv_set_free (GSettingsStrvSet *set)
+{
+  g_return_if_fail (set != NULL);
+
+  g_settings_strv_set_flush (set);
+
+  g_signal_handler_disconnect (set->settings, set->changed_id);
+  g_object_unref (set->settings);
+  g_free (set->key);
+  g_hash_table_unref (set->index);
+  g_ptr_array_unref (set->items);
+  g_slice_free (GSettingsStrvSet, set);
+}
+
+static void
+g_settings_strv_set_write (GSettingsStrvSet *set)
+{
+  g_ptr_array_add (set->items, NULL);
+
+  /* @set is up to date, so don't reload it from the change
+   * notification */
+  g_signal_handler_block (set->settings, set->changed_id);
+  g_settings_set_strv (set->settings, set->key, (const gchar * const *) set->items->pdata);
+  g_signal_handler_unblock (set->settings, set->changed_id);
+
+  g_ptr_array_set_size (set->items, set->items->len - 1);
+}
+
+static gboolean
+g_settings_strv_set_flush_timeout (gpointer user_data)
+{
+  GSettingsStrvSet *set = user_data;
+
+  set->flush_id = 0;
+  g_settings_strv_set_write (set);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+g_settings_strv_set_schedule_flush (GSettingsStrvSet *set)
+{
+  if (set->flush_id == 0)
+    set->flush_id = g_timeout_add_seconds (G_SETTINGS_STRV_SET_FLUSH_DELAY,
+                                           g_settings_strv_set_flush_timeout, set);
+}
+
+/**
+ * g_settings_strv_set_add:
+ * @set: a #GSettingsStrvSet
+ * @item: the string to add
+ *
+ * Adds @item to @set.  This is cheap if @item is in @set already.
+ *
+ * Returns: TRUE if @item was added, FALSE if it already existed.
+ */
+gboolean
+g_settings_strv_set_add (GSettingsStrvSet *set,
+                         const gchar      *item)
+{
+  gchar *copy;
+
+  g_return_val_if_fail (set != NULL, FALSE);
+  g_return_val_if_fail (item != NULL, FALSE);
+
+  if (g_hash_table_contains (set->index, item))
+    return FALSE;
+
+  copy = g_strdup (item);
+  g_ptr_array_add (set->items, copy);
+  g_hash_table_add (set->index, copy);
+
+  g_settings_strv_set_schedule_flush (set);
+
+  return TRUE;
+}
+
+/**
+ * g_settings_strv_set_remove:
+ * @set: a #GSettingsStrvSet
+ * @item: the string to remove
+ *
+ * Removes @item from @set.
+ *
+ * Returns: TRUE if @item was removed, FALSE if it wasn't in @set.
+ */
+gboolean
+g_settings_strv_set_remove (GSettingsStrvSet *set,
+                            const gchar      *item)
+{
+  gchar *stored;
+
+  g_return_val_if_fail (set != NULL, FALSE);
+  g_return_val_if_fail (item != NULL, FALSE);
+
+  stored = g_hash_table_lookup (set->index, item);
+  if (stored == NULL)
+    return FALSE;
+
+  g_hash_table_remove (set->index, item);
+  g_ptr_array_remove (set->items, stored);
+
+  g_settings_strv_set_schedule_flush (set);
+
+  return TRUE;
+}
+
+/**
+ * g_settings_strv_set_flush:
+ * @set: a #GSettingsStrvSet
+ *
+ * Writes pending changes of @set to its #GSettings right away and
+ * waits until they are stored.
+ */
+void
+g_settings_strv_set_flush (GSettingsStrvSet *set)
+{
+  g_return_if_fail (set != NULL);
+
+  if (set->flush_id == 0)
+    return;
+
+  g_source_remove (set->flush_id);
+  set->flush_id = 0;
+
+  g_settings_strv_set_write (set);
+  g_settings_sync ();
+}
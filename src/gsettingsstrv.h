@@ -30,4 +30,19 @@ void            g_settings_strv_remove          (GSettings   *settings,
                                                  const gchar *key,
                                                  const gchar *item);
 
+typedef struct _GSettingsStrvSet GSettingsStrvSet;
+
+GSettingsStrvSet * g_settings_strv_set_new      (GSettings        *settings,
+                                                 const gchar      *key);
+
+void            g_settings_strv_set_free        (GSettingsStrvSet *set);
+
+gboolean        g_settings_strv_set_add         (GSettingsStrvSet *set,
+                                                 const gchar      *item);
+
+gboolean        g_settings_strv_set_remove      (GSettingsStrvSet *set,
+                                                 const gchar      *item);
+
+void            g_settings_strv_set_flush       (GSettingsStrvSet *set);
+
 #endif
@@ -0,0 +1,524 @@
+/*
+ * Copyright 2013 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "im-action-exporter.h"
+#include "gactionmuxer.h"
+
+/*
+ * Exports a #GActionGroup on the org.gtk.Actions interface, like
+ * g_dbus_connection_export_action_group().
+ *
+ * Changes to the action group are not sent right away.  They are
+ * collected per action and sent in a single Changed signal once the
+ * main loop is idle.  Intermediate states of an action are never sent,
+ * as its state is only looked up when the signal is built.  Actions
+ * that are added and removed again before that don't show up at all.
+ *
+ * Batches of a #GActionMuxer (see #GActionMuxer::actions-changed) are
+ * understood, so muxers exported this way can be set to grouped
+ * signals.
+ *
+ * Use g_dbus_connection_unregister_object() with the returned id to
+ * stop exporting the group.
+ */
+
+enum
+{
+  ACTION_ADDED           = 1 << 0,
+  ACTION_REMOVED         = 1 << 1,
+  ACTION_STATE_CHANGED   = 1 << 2,
+  ACTION_ENABLED_CHANGED = 1 << 3
+};
+
+typedef struct
+{
+  GActionGroup *action_group;
+  GDBusConnection *connection;
+  GMainContext *context;
+  gchar *object_path;
+  GHashTable *pending;      /* action name -> event mask */
+  GSource *pending_source;
+} ImActionExporter;
+
+static const gchar introspection_xml[] =
+  "<node>"
+  "  <interface name='org.gtk.Actions'>"
+  "    <method name='List'>"
+  "      <arg type='as' name='list' direction='out'/>"
+  "    </method>"
+  "    <method name='Describe'>"
+  "      <arg type='s' name='action_name' direction='in'/>"
+  "      <arg type='(bgav)' name='description' direction='out'/>"
+  "    </method>"
+  "    <method name='DescribeAll'>"
+  "      <arg type='a{s(bgav)}' name='descriptions' direction='out'/>"
+  "    </method>"
+  "    <method name='Activate'>"
+  "      <arg type='s' name='action_name' direction='in'/>"
+  "      <arg type='av' name='parameter' direction='in'/>"
+  "      <arg type='a{sv}' name='platform_data' direction='in'/>"
+  "    </method>"
+  "    <method name='SetState'>"
+  "      <arg type='s' name='action_name' direction='in'/>"
+  "      <arg type='v' name='value' direction='in'/>"
+  "      <arg type='a{sv}' name='platform_data' direction='in'/>"
+  "    </method>"
+  "    <signal name='Changed'>"
+  "      <arg type='as' name='removals'/>"
+  "      <arg type='a{sb}' name='enable_changes'/>"
+  "      <arg type='a{sv}' name='state_changes'/>"
+  "      <arg type='a{s(bgav)}' name='additions'/>"
+  "    </signal>"
+  "  </interface>"
+  "</node>";
+
+static GDBusInterfaceInfo *
+im_action_exporter_get_interface_info (void)
+{
+  static GDBusInterfaceInfo *info;
+
+  if (g_once_init_enter (&info))
+    {
+      GDBusNodeInfo *node;
+      GDBusInterfaceInfo *iface;
+
+      node = g_dbus_node_info_new_for_xml (introspection_xml, NULL);
+      iface = g_dbus_interface_info_ref (node->interfaces[0]);
+      g_dbus_node_info_unref (node);
+
+      g_once_init_leave (&info, iface);
+    }
+
+  return info;
+}
+
+static GVariant *
+im_action_exporter_describe (GActionGroup *action_group,
+                             const gchar  *action_name)
+{
+  GVariantBuilder builder;
+  gboolean enabled;
+  const GVariantType *parameter_type;
+  GVariant *state;
+
+  if (!g_action_group_query_action (action_group, action_name, &enabled,
+                                    &parameter_type, NULL, NULL, &state))
+    return NULL;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("(bgav)"));
+
+  g_variant_builder_add (&builder, "b", enabled);
+
+  if (parameter_type)
+    {
+      gchar *type_string;
+
+      type_string = g_variant_type_dup_string (parameter_type);
+      g_variant_builder_add (&builder, "g", type_string);
+      g_free (type_string);
+    }
+  else
+    g_variant_builder_add (&builder, "g", "");
+
+  g_variant_builder_open (&builder, G_VARIANT_TYPE ("av"));
+  if (state)
+    {
+      g_variant_builder_add (&builder, "v", state);
+      g_variant_unref (state);
+    }
+  g_variant_builder_close (&builder);
+
+  return g_variant_builder_end (&builder);
+}
+
+static gboolean
+im_action_exporter_dispatch (gpointer user_data)
+{
+  ImActionExporter *exporter = user_data;
+  GVariantBuilder removals;
+  GVariantBuilder enable_changes;
+  GVariantBuilder state_changes;
+  GVariantBuilder additions;
+  GHashTableIter it;
+  const gchar *action_name;
+  gpointer value;
+
+  g_variant_builder_init (&removals, G_VARIANT_TYPE_STRING_ARRAY);
+  g_variant_builder_init (&enable_changes, G_VARIANT_TYPE ("a{sb}"));
+  g_variant_builder_init (&state_changes, G_VARIANT_TYPE ("a{sv}"));
+  g_variant_builder_init (&additions, G_VARIANT_TYPE ("a{s(bgav)}"));
+
+  g_hash_table_iter_init (&it, exporter->pending);
+  while (g_hash_table_iter_next (&it, (gpointer *) &action_name, &value))
+    {
+      guint events = GPOINTER_TO_UINT (value);
+
+      if (events & ACTION_REMOVED)
+        g_variant_builder_add (&removals, "s", action_name);
+
+      if (events & ACTION_ENABLED_CHANGED)
+        {
+          gboolean enabled;
+
+          enabled = g_action_group_get_action_enabled (exporter->action_group, action_name);
+          g_variant_builder_add (&enable_changes, "{sb}", action_name, enabled);
+        }
+
+      if (events & ACTION_STATE_CHANGED)
+        {
+          GVariant *state;
+
+          state = g_action_group_get_action_state (exporter->action_group, action_name);
+          if (state)
+            {
+              g_variant_builder_add (&state_changes, "{sv}", action_name, state);
+              g_variant_unref (state);
+            }
+        }
+
+      if (events & ACTION_ADDED)
+        {
+          GVariant *description;
+
+          description = im_action_exporter_describe (exporter->action_group, action_name);
+          if (description)
+            g_variant_builder_add (&additions, "{s@(bgav)}", action_name, description);
+        }
+    }
+
+  g_dbus_connection_emit_signal (exporter->connection, NULL, exporter->object_path,
+                                 "org.gtk.Actions", "Changed",
+                                 g_variant_new ("(asa{sb}a{sv}a{s(bgav)})",
+                                                &removals, &enable_changes,
+                                                &state_changes, &additions),
+                                 NULL);
+
+  g_hash_table_remove_all (exporter->pending);
+  exporter->pending_source = NULL;
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+im_action_exporter_set_events (ImActionExporter *exporter,
+                               const gchar      *action_name,
+                               guint             events)
+{
+  if (events)
+    g_hash_table_insert (exporter->pending, g_strdup (action_name), GUINT_TO_POINTER (events));
+  else
+    g_hash_table_remove (exporter->pending, action_name);
+
+  /* an idle source, so that a burst of incoming calls (each of which
+   * might change actions) is handled before anything is sent */
+  if (exporter->pending_source == NULL && g_hash_table_size (exporter->pending) > 0)
+    {
+      exporter->pending_source = g_idle_source_new ();
+      g_source_set_callback (exporter->pending_source, im_action_exporter_dispatch, exporter, NULL);
+      g_source_attach (exporter->pending_source, exporter->context);
+      g_source_unref (exporter->pending_source);
+    }
+}
+
+static guint
+im_action_exporter_get_events (ImActionExporter *exporter,
+                               const gchar      *action_name)
+{
+  return GPOINTER_TO_UINT (g_hash_table_lookup (exporter->pending, action_name));
+}
+
+static void
+im_action_exporter_action_added (GActionGroup *action_group,
+                                 const gchar  *action_name,
+                                 gpointer      user_data)
+{
+  ImActionExporter *exporter = user_data;
+  guint events;
+
+  /* the description sent with the addition includes the current
+   * state and enabled flag */
+  events = im_action_exporter_get_events (exporter, action_name);
+  events &= ~(ACTION_STATE_CHANGED | ACTION_ENABLED_CHANGED);
+  events |= ACTION_ADDED;
+
+  im_action_exporter_set_events (exporter, action_name, events);
+}
+
+static void
+im_action_exporter_action_removed (GActionGroup *action_group,
+                                   const gchar  *action_name,
+                                   gpointer      user_data)
+{
+  ImActionExporter *exporter = user_data;
+  guint events;
+
+  events = im_action_exporter_get_events (exporter, action_name);
+
+  /* clients have never seen an action that is still waiting to be
+   * added, but they might have seen one that was removed before it */
+  if (events & ACTION_ADDED)
+    events &= ~ACTION_ADDED;
+  else
+    events = ACTION_REMOVED;
+
+  im_action_exporter_set_events (exporter, action_name, events);
+}
+
+static void
+im_action_exporter_action_state_changed (GActionGroup *action_group,
+                                         const gchar  *action_name,
+                                         GVariant     *value,
+                                         gpointer      user_data)
+{
+  ImActionExporter *exporter = user_data;
+  guint events;
+
+  events = im_action_exporter_get_events (exporter, action_name);
+  if (~events & ACTION_ADDED)
+    im_action_exporter_set_events (exporter, action_name, events | ACTION_STATE_CHANGED);
+}
+
+static void
+im_action_exporter_action_enabled_changed (GActionGroup *action_group,
+                                           const gchar  *action_name,
+                                           gboolean      enabled,
+                                           gpointer      user_data)
+{
+  ImActionExporter *exporter = user_data;
+  guint events;
+
+  events = im_action_exporter_get_events (exporter, action_name);
+  if (~events & ACTION_ADDED)
+    im_action_exporter_set_events (exporter, action_name, events | ACTION_ENABLED_CHANGED);
+}
+
+static void
+im_action_exporter_actions_changed (GActionMuxer  *muxer,
+                                    gchar        **removed,
+                                    gchar        **added,
+                                    gpointer       user_data)
+{
+  gchar **it;
+
+  for (it = removed; *it; it++)
+    im_action_exporter_action_removed (G_ACTION_GROUP (muxer), *it, user_data);
+
+  for (it = added; *it; it++)
+    im_action_exporter_action_added (G_ACTION_GROUP (muxer), *it, user_data);
+}
+
+static GVariant *
+im_action_exporter_list (ImActionExporter *exporter)
+{
+  GVariantBuilder builder;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE_STRING_ARRAY);
+
+  if (G_IS_ACTION_MUXER (exporter->action_group))
+    {
+      GActionMuxerIter it;
+      const gchar *action_name;
+
+      g_action_muxer_iter_init (&it, G_ACTION_MUXER (exporter->action_group));
+      while (g_action_muxer_iter_next (&it, &action_name))
+        g_variant_builder_add (&builder, "s", action_name);
+    }
+  else
+    {
+      gchar **actions;
+      gchar **it;
+
+      actions = g_action_group_list_actions (exporter->action_group);
+      for (it = actions; *it; it++)
+        g_variant_builder_add (&builder, "s", *it);
+      g_strfreev (actions);
+    }
+
+  return g_variant_builder_end (&builder);
+}
+
+static GVariant *
+im_action_exporter_describe_all (ImActionExporter *exporter)
+{
+  GVariantBuilder builder;
+  GVariant *list;
+  GVariantIter it;
+  const gchar *action_name;
+
+  list = im_action_exporter_list (exporter);
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{s(bgav)}"));
+
+  g_variant_iter_init (&it, list);
+  while (g_variant_iter_next (&it, "&s", &action_name))
+    {
+      GVariant *description;
+
+      description = im_action_exporter_describe (exporter->action_group, action_name);
+      if (description)
+        g_variant_builder_add (&builder, "{s@(bgav)}", action_name, description);
+    }
+
+  g_variant_unref (list);
+
+  return g_variant_builder_end (&builder);
+}
+
+static void
+im_action_exporter_method_call (GDBusConnection       *connection,
+                                const gchar           *sender,
+                                const gchar           *object_path,
+                                const gchar           *interface_name,
+                                const gchar           *method_name,
+                                GVariant              *parameters,
+                                GDBusMethodInvocation *invocation,
+                                gpointer               user_data)
+{
+  ImActionExporter *exporter = user_data;
+  GVariant *result = NULL;
+
+  if (g_str_equal (method_name, "List"))
+    {
+      result = g_variant_new ("(@as)", im_action_exporter_list (exporter));
+    }
+  else if (g_str_equal (method_name, "Describe"))
+    {
+      const gchar *action_name;
+      GVariant *description;
+
+      g_variant_get (parameters, "(&s)", &action_name);
+      description = im_action_exporter_describe (exporter->action_group, action_name);
+      if (description == NULL)
+        {
+          g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+                                                 "The named action ('%s') does not exist.", action_name);
+          return;
+        }
+
+      result = g_variant_new ("(@(bgav))", description);
+    }
+  else if (g_str_equal (method_name, "DescribeAll"))
+    {
+      result = g_variant_new ("(@a{s(bgav)})", im_action_exporter_describe_all (exporter));
+    }
+  else if (g_str_equal (method_name, "Activate"))
+    {
+      const gchar *action_name;
+      GVariant *parameter = NULL;
+      GVariantIter *iter;
+
+      g_variant_get (parameters, "(&sav@a{sv})", &action_name, &iter, NULL);
+      g_variant_iter_next (iter, "v", &parameter);
+      g_variant_iter_free (iter);
+
+      g_action_group_activate_action (exporter->action_group, action_name, parameter);
+
+      if (parameter)
+        g_variant_unref (parameter);
+    }
+  else if (g_str_equal (method_name, "SetState"))
+    {
+      const gchar *action_name;
+      GVariant *state;
+
+      g_variant_get (parameters, "(&sv@a{sv})", &action_name, &state, NULL);
+      g_action_group_change_action_state (exporter->action_group, action_name, state);
+      g_variant_unref (state);
+    }
+  else
+    g_assert_not_reached ();
+
+  g_dbus_method_invocation_return_value (invocation, result);
+}
+
+static void
+im_action_exporter_free (gpointer user_data)
+{
+  ImActionExporter *exporter = user_data;
+
+  g_signal_handlers_disconnect_by_data (exporter->action_group, exporter);
+
+  if (exporter->pending_source)
+    g_source_destroy (exporter->pending_source);
+
+  g_hash_table_unref (exporter->pending);
+  g_free (exporter->object_path);
+  g_main_context_unref (exporter->context);
+  g_object_unref (exporter->connection);
+  g_object_unref (exporter->action_group);
+
+  g_slice_free (ImActionExporter, exporter);
+}
+
+/**
+ * im_action_exporter_export:
+ * @connection: a #GDBusConnection
+ * @object_path: a D-Bus object path
+ * @action_group: a #GActionGroup
+ * @error: a pointer to a %NULL #GError, or %NULL
+ *
+ * Exports @action_group on @connection at @object_path, coalescing
+ * changes into one Changed signal per main loop iteration.
+ *
+ * Returns: the ID of the export (never zero), or 0 in case of failure
+ */
+guint
+im_action_exporter_export (GDBusConnection  *connection,
+                           const gchar      *object_path,
+                           GActionGroup     *action_group,
+                           GError          **error)
+{
+  const GDBusInterfaceVTable vtable = {
+    im_action_exporter_method_call
+  };
+  ImActionExporter *exporter;
+  guint id;
+
+  g_return_val_if_fail (G_IS_DBUS_CONNECTION (connection), 0);
+  g_return_val_if_fail (g_variant_is_object_path (object_path), 0);
+  g_return_val_if_fail (G_IS_ACTION_GROUP (action_group), 0);
+
+  exporter = g_slice_new0 (ImActionExporter);
+  exporter->action_group = g_object_ref (action_group);
+  exporter->connection = g_object_ref (connection);
+  exporter->context = g_main_context_ref_thread_default ();
+  exporter->object_path = g_strdup (object_path);
+  exporter->pending = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  id = g_dbus_connection_register_object (connection, object_path,
+                                          im_action_exporter_get_interface_info (),
+                                          &vtable, exporter, im_action_exporter_free, error);
+  if (id == 0)
+    {
+      im_action_exporter_free (exporter);
+      return 0;
+    }
+
+  g_signal_connect (action_group, "action-added",
+                    G_CALLBACK (im_action_exporter_action_added), exporter);
+  g_signal_connect (action_group, "action-removed",
+                    G_CALLBACK (im_action_exporter_action_removed), exporter);
+  g_signal_connect (action_group, "action-state-changed",
+                    G_CALLBACK (im_action_exporter_action_state_changed), exporter);
+  g_signal_connect (action_group, "action-enabled-changed",
+                    G_CALLBACK (im_action_exporter_action_enabled_changed), exporter);
+
+  if (G_IS_ACTION_MUXER (action_group))
+    g_signal_connect (action_group, "actions-changed",
+                      G_CALLBACK (im_action_exporter_actions_changed), exporter);
+
+  return id;
+}
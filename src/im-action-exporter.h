@@ -0,0 +1,27 @@
+/*
+ * Copyright 2013 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __IM_ACTION_EXPORTER_H__
+#define __IM_ACTION_EXPORTER_H__
+
+#include <gio/gio.h>
+
+guint           im_action_exporter_export       (GDBusConnection  *connection,
+                                                 const gchar      *object_path,
+                                                 GActionGroup     *action_group,
+                                                 GError          **error);
+
+#endif
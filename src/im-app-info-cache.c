@@ -0,0 +1,138 @@
+/*
+ * Copyright 2013 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "im-app-info-cache.h"
+
+/*
+ * A process-wide cache of #GDesktopAppInfo, keyed by desktop id.
+ *
+ * Looking up a desktop file searches all XDG data directories and
+ * parses the file it finds, which is too expensive to do for every
+ * D-Bus request that only needs to canonicalize an id.  Lookups that
+ * fail are cached as well.
+ *
+ * The cache is dropped completely whenever something changes in one of
+ * the applications directories, because a new file can shadow one in
+ * a directory with lower precedence.  Subdirectories (which result in
+ * ids like "kde4-foo.desktop") are not watched.
+ *
+ * The cache may be used from any thread.  The file monitors deliver
+ * their events to the global default main context.
+ */
+
+static GMutex cache_lock;
+static GHashTable *cache;       /* desktop id -> GDesktopAppInfo, or NULL if not installed */
+static guint cache_serial;      /* bumped on every invalidation */
+static GPtrArray *monitors;
+
+static void
+app_info_unref (gpointer data)
+{
+  if (data)
+    g_object_unref (data);
+}
+
+static void
+im_app_info_cache_invalidate (GFileMonitor      *monitor,
+                              GFile             *file,
+                              GFile             *other_file,
+                              GFileMonitorEvent  event,
+                              gpointer           user_data)
+{
+  g_mutex_lock (&cache_lock);
+  g_hash_table_remove_all (cache);
+  cache_serial++;
+  g_mutex_unlock (&cache_lock);
+}
+
+static void
+im_app_info_cache_watch (const gchar *data_dir)
+{
+  gchar *path;
+  GFile *dir;
+  GFileMonitor *monitor;
+
+  path = g_build_filename (data_dir, "applications", NULL);
+  dir = g_file_new_for_path (path);
+
+  monitor = g_file_monitor_directory (dir, G_FILE_MONITOR_NONE, NULL, NULL);
+  if (monitor)
+    {
+      g_signal_connect (monitor, "changed", G_CALLBACK (im_app_info_cache_invalidate), NULL);
+      g_ptr_array_add (monitors, monitor);
+    }
+
+  g_object_unref (dir);
+  g_free (path);
+}
+
+/* must be called with cache_lock held */
+static void
+im_app_info_cache_ensure (void)
+{
+  const gchar * const *dirs;
+
+  if (cache)
+    return;
+
+  cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, app_info_unref);
+
+  monitors = g_ptr_array_new_with_free_func (g_object_unref);
+  im_app_info_cache_watch (g_get_user_data_dir ());
+  for (dirs = g_get_system_data_dirs (); *dirs; dirs++)
+    im_app_info_cache_watch (*dirs);
+}
+
+/*
+ * Returns: (transfer full) (allow-none): the #GDesktopAppInfo for
+ * @desktop_id, or %NULL if no such application is installed
+ */
+GDesktopAppInfo *
+im_app_info_cache_lookup (const gchar *desktop_id)
+{
+  GDesktopAppInfo *info;
+  gpointer cached;
+  guint serial;
+
+  g_return_val_if_fail (desktop_id != NULL, NULL);
+
+  g_mutex_lock (&cache_lock);
+
+  im_app_info_cache_ensure ();
+
+  if (g_hash_table_lookup_extended (cache, desktop_id, NULL, &cached))
+    {
+      info = cached ? g_object_ref (cached) : NULL;
+      g_mutex_unlock (&cache_lock);
+      return info;
+    }
+
+  serial = cache_serial;
+  g_mutex_unlock (&cache_lock);
+
+  /* don't hold the lock while searching, so that other threads can
+   * look up other applications in the meantime */
+  info = g_desktop_app_info_new (desktop_id);
+
+  /* the result might be outdated if the cache was invalidated while
+   * searching */
+  g_mutex_lock (&cache_lock);
+  if (serial == cache_serial)
+    g_hash_table_insert (cache, g_strdup (desktop_id), info ? g_object_ref (info) : NULL);
+  g_mutex_unlock (&cache_lock);
+
+  return info;
+}
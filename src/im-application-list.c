@@ -17,15 +17,25 @@
  *     Lars Uebernickel <lars.uebernickel@canonical.com>
  */
 
+#define _GNU_SOURCE
+
 #include "im-application-list.h"
 
 #include "indicator-messages-application.h"
 #include "gactionmuxer.h"
 #include "indicator-desktop-shortcuts.h"
 #include "im-accounts-service.h"
+#include "im-app-info-cache.h"
+#include "im-message-actions.h"
+#include "im-message-store.h"
+#include "message-body.h"
 
 #include <gio/gdesktopappinfo.h>
+#include <gio/gunixfdlist.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "glib/gi18n.h"
 
@@ -44,10 +54,22 @@ struct _ImApplicationList
   GHashTable *app_status;
 
   ImAccountsService * as;
+
+  guint max_messages;
+  guint signal_rate;            /* signals per second and application, 0 for no limit */
+  guint signal_burst;
+
+  gchar *snapshot_path;
+  guint snapshot_id;
+  GVariant *snapshot;           /* restored, until snapshot_expiry_id fires */
+  guint snapshot_expiry_id;
+
+  GHashTable *loading;          /* ids of applications added with im_application_list_add_async() */
+
+  ImMessageStore *messages;     /* messages of all applications, by action name */
 };
 
 G_DEFINE_TYPE (ImApplicationList, im_application_list, G_TYPE_OBJECT);
-G_DEFINE_QUARK (draws_attention, message_action_draws_attention);
 
 enum
 {
@@ -56,6 +78,7 @@ enum
   SOURCE_REMOVED,
   MESSAGE_ADDED,
   MESSAGE_REMOVED,
+  MESSAGES_REMOVED,
   APP_ADDED,
   APP_STOPPED,
   REMOVE_ALL,
@@ -73,18 +96,242 @@ typedef struct
   IndicatorMessagesApplication *proxy;
   GActionMuxer *muxer;
   GSimpleActionGroup *source_actions;
-  GSimpleActionGroup *message_actions;
-  GActionMuxer *message_sub_actions;
+  ImMessageActions *message_actions;
   GCancellable *cancellable;
   gboolean draws_attention;
   IndicatorDesktopShortcuts * shortcuts;
+  GQueue pending_messages;      /* DecodedMessage, fetched but not added yet */
+  guint ingest_id;
+  gint64 page_time;             /* key of the last fetched message, */
+  gchar *page_id;               /* or NULL to start with the newest */
+  guint n_fetched;              /* messages fetched since the first page */
+  guint page_serial;            /* bumped to drop pages that are in flight */
+  GHashTable *icons;            /* icon ref -> serialized icon */
+  GHashTable *pending_icons;    /* refs of icons whose memfd is being fetched */
+  GHashTable *pending_bodies;   /* message id -> BodyRequest, of messages held back for their body */
+  guint64 generation;           /* of the application's state we have, or 0 */
+  GSequence *sources;           /* source variants in menu order, for snapshots */
+  gboolean restored;            /* state was restored from a snapshot */
+  gdouble tokens;               /* token bucket for incoming signals */
+  gint64 tokens_updated;
+  GHashTable *deferred_sources; /* source id -> last throttled SourceChanged */
+  guint drain_id;
+  guint64 throttled;            /* number of signals that were throttled */
 } Application;
 
+typedef struct
+{
+  gchar *escaped_name;
+  GVariant *label;
+  gchar *parameter_type;
+  GVariant *parameter_hint;
+} DecodedAction;
+
+/* A message that was taken apart into what the main thread needs to
+ * add it. Decoding happens on a worker thread for messages that arrive
+ * in bulk; the main thread only reads the decoded fields once @decoded
+ * was set (on the main thread). */
+typedef struct
+{
+  gint ref_count;
+  gboolean decoded;
+  gboolean listed;              /* from ListMessagesBefore or ListMessages */
+  GVariant *message;
+  const gchar *id;              /* points into @message */
+
+  gchar *action_name;
+  GVariant *maybe_serialized_icon;
+  GVariant *title;
+  GVariant *subtitle;
+  GVariant *body;
+  gint64 time;
+  gboolean draws_attention;
+  DecodedAction *actions;
+  guint n_actions;
+} DecodedMessage;
+
+/* Messages of newly started applications are fetched in pages of this
+ * size, newest first */
+#define MESSAGES_PAGE_SIZE 50
+
+/* Maximum time spent adding fetched messages per main loop iteration,
+ * in microseconds */
+#define MESSAGES_INGEST_TIME_SLICE 5000
+
+/* The state of all applications is written to the snapshot file this
+ * many seconds after it changed */
+#define SNAPSHOT_DELAY 1
+
+/* Seconds after which state restored from a snapshot is dropped for
+ * applications that haven't come back */
+#define SNAPSHOT_GRACE_PERIOD 10
+
+/* (id, generation, sources, messages (newest first), icons) of every
+ * application */
+#define SNAPSHOT_TYPE "a(sta(ssavuxsb)a(savsssxaa{sv}b)a{sv})"
+
+/* The snapshot file holds (SNAPSHOT_VERSION, snapshot). Bump the
+ * version whenever the layout of the snapshot changes, so that files
+ * written by other versions of the service are ignored instead of being
+ * misread. */
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_FILE_TYPE "(u" SNAPSHOT_TYPE ")"
+
+/* Interval in which signals that were throttled are applied, in
+ * milliseconds */
+#define THROTTLE_DRAIN_INTERVAL 200
+
 
 /* Prototypes */
 static void         status_activated           (GSimpleAction *    action,
                                                 GVariant *         param,
                                                 gpointer           user_data);
+static void         im_application_list_schedule_snapshot (ImApplicationList *list);
+static void         decoded_message_unref      (gpointer data);
+
+/* Keeps the message in list->messages, which menus use to find the
+ * position of its item, and from where the oldest ones are evicted
+ * when @app has too many. A message that is sent again replaces the
+ * old one, whose item is removed while it can still be found. */
+static void
+application_track_message (Application *app,
+                           const gchar *action_name,
+                           gint64       time,
+                           GVariant    *message)
+{
+  ImMessageStore *store = app->list->messages;
+  gint row;
+
+  row = im_message_store_lookup (store, app->id, action_name);
+  if (row >= 0)
+    {
+      g_signal_emit (app->list, signals[MESSAGE_REMOVED], 0, app->id, action_name);
+      im_message_store_remove_row (store, row);
+    }
+
+  im_message_store_insert (store, app->id, action_name, time, message);
+
+  im_application_list_schedule_snapshot (app->list);
+}
+
+static void
+application_untrack_message (Application *app,
+                             const gchar *action_name)
+{
+  ImMessageStore *store = app->list->messages;
+  gint row;
+
+  row = im_message_store_lookup (store, app->id, action_name);
+  if (row >= 0)
+    {
+      im_message_store_remove_row (store, row);
+
+      im_application_list_schedule_snapshot (app->list);
+    }
+}
+
+/* Returns the (escaped) action names of all messages of @app, newest
+ * first. Free with g_strfreev(). */
+static gchar **
+application_list_tracked_messages (Application *app)
+{
+  ImMessageStore *store = app->list->messages;
+  gchar **action_names;
+  guint *rows;
+  guint n_rows;
+  guint i;
+
+  rows = im_message_store_get_app_rows (store, app->id, &n_rows);
+
+  action_names = g_new (gchar *, n_rows + 1);
+  for (i = 0; i < n_rows; i++)
+    action_names[i] = g_strdup (im_message_store_get_id (store, rows[i]));
+  action_names[n_rows] = NULL;
+
+  g_free (rows);
+
+  return action_names;
+}
+
+static GSequenceIter *
+application_lookup_source (Application *app,
+                           const gchar *id)
+{
+  GSequenceIter *iter;
+
+  for (iter = g_sequence_get_begin_iter (app->sources);
+       !g_sequence_iter_is_end (iter);
+       iter = g_sequence_iter_next (iter))
+    {
+      const gchar *source_id;
+
+      g_variant_get_child (g_sequence_get (iter), 0, "&s", &source_id);
+      if (g_str_equal (source_id, id))
+        return iter;
+    }
+
+  return NULL;
+}
+
+/* Returns the icon in the fake-maybe @maybe_serialized_icon. Icons that
+ * were sent as ('icon-ref', <ref>) are looked up in the icon table, so
+ * that all messages and sources with the same image share one copy. */
+static GVariant *
+application_resolve_icon (Application *app,
+                          GVariant    *maybe_serialized_icon)
+{
+  GVariant *serialized_icon;
+  const gchar *ref;
+  GVariant *icon;
+
+  g_variant_get_child (maybe_serialized_icon, 0, "v", &serialized_icon);
+
+  if (!g_variant_is_of_type (serialized_icon, G_VARIANT_TYPE ("(sv)")))
+    return serialized_icon;
+
+  g_variant_get (serialized_icon, "(&sv)", &ref, &icon);
+  if (!g_str_equal (ref, "icon-ref") || !g_variant_is_of_type (icon, G_VARIANT_TYPE_STRING))
+    {
+      g_variant_unref (icon);
+      return serialized_icon;
+    }
+
+  ref = g_variant_get_string (icon, NULL);
+  g_variant_unref (serialized_icon);
+  serialized_icon = g_hash_table_lookup (app->icons, ref);
+  if (serialized_icon)
+    g_variant_ref (serialized_icon);
+  else if (!g_hash_table_contains (app->pending_icons, ref))
+    g_warning ("application '%s' refers to unknown icon '%s'", app->id, ref);
+
+  g_variant_unref (icon);
+
+  return serialized_icon;
+}
+
+static void
+application_clear_pending_messages (Application *app)
+{
+  g_queue_foreach (&app->pending_messages, (GFunc) decoded_message_unref, NULL);
+  g_queue_clear (&app->pending_messages);
+  g_hash_table_remove_all (app->pending_bodies);
+
+  if (app->ingest_id)
+    {
+      g_source_remove (app->ingest_id);
+      app->ingest_id = 0;
+    }
+}
+
+/* Starts over with the newest message on the next fetch, and drops the
+ * pages of earlier fetches that are still in flight */
+static void
+application_reset_paging (Application *app)
+{
+  g_clear_pointer (&app->page_id, g_free);
+  app->n_fetched = 0;
+  app->page_serial++;
+}
 
 static void
 application_free (gpointer data)
@@ -111,11 +358,22 @@ application_free (gpointer data)
       g_object_unref (app->muxer);
       g_object_unref (app->source_actions);
       g_object_unref (app->message_actions);
-      g_object_unref (app->message_sub_actions);
     }
 
   g_clear_object (&app->shortcuts);
 
+  application_clear_pending_messages (app);
+  g_free (app->page_id);
+
+  g_hash_table_unref (app->icons);
+  g_hash_table_unref (app->pending_icons);
+  g_hash_table_unref (app->pending_bodies);
+  g_sequence_free (app->sources);
+
+  if (app->drain_id)
+    g_source_remove (app->drain_id);
+  g_hash_table_unref (app->deferred_sources);
+
   g_slice_free (Application, app);
 }
 
@@ -190,6 +448,118 @@ unescape_action_name (const gchar *name)
   return g_string_free (unescaped, FALSE);
 }
 
+static DecodedMessage *
+decoded_message_new (GVariant *message)
+{
+  DecodedMessage *decoded;
+
+  decoded = g_slice_new0 (DecodedMessage);
+  decoded->ref_count = 1;
+  decoded->message = g_variant_ref (message);
+  g_variant_get_child (message, 0, "&s", &decoded->id);
+
+  return decoded;
+}
+
+static DecodedMessage *
+decoded_message_ref (DecodedMessage *decoded)
+{
+  g_atomic_int_inc (&decoded->ref_count);
+
+  return decoded;
+}
+
+static void
+decoded_message_unref (gpointer data)
+{
+  DecodedMessage *decoded = data;
+  guint i;
+
+  if (!g_atomic_int_dec_and_test (&decoded->ref_count))
+    return;
+
+  for (i = 0; i < decoded->n_actions; i++)
+    {
+      g_free (decoded->actions[i].escaped_name);
+      if (decoded->actions[i].label)
+        g_variant_unref (decoded->actions[i].label);
+      g_free (decoded->actions[i].parameter_type);
+      if (decoded->actions[i].parameter_hint)
+        g_variant_unref (decoded->actions[i].parameter_hint);
+    }
+  g_free (decoded->actions);
+
+  g_free (decoded->action_name);
+  if (decoded->maybe_serialized_icon)
+    {
+      g_variant_unref (decoded->maybe_serialized_icon);
+      g_variant_unref (decoded->title);
+      g_variant_unref (decoded->subtitle);
+      g_variant_unref (decoded->body);
+    }
+  g_variant_unref (decoded->message);
+
+  g_slice_free (DecodedMessage, decoded);
+}
+
+/* Fills in the fields of @decoded from its message. Doesn't touch any
+ * state but @decoded's, so that it can run on any thread. */
+static void
+decoded_message_decode (DecodedMessage *decoded)
+{
+  GVariantIter *action_iter;
+  GVariant *entry;
+  guint i = 0;
+
+  /* title, subtitle and body are passed on as they are, so that the
+   * menus reference the strings in the received message */
+  g_variant_get (decoded->message, "(&s@av@s@s@sxaa{sv}b)",
+                 NULL, &decoded->maybe_serialized_icon, &decoded->title, &decoded->subtitle,
+                 &decoded->body, &decoded->time, &action_iter, &decoded->draws_attention);
+
+  decoded->action_name = escape_action_name (decoded->id);
+  decoded->actions = g_new0 (DecodedAction, g_variant_iter_n_children (action_iter));
+
+  while ((entry = g_variant_iter_next_value (action_iter)))
+    {
+      DecodedAction *action = &decoded->actions[i];
+      const gchar *name;
+      const gchar *type = NULL;
+
+      if (g_variant_lookup (entry, "name", "&s", &name))
+        {
+          action->escaped_name = escape_action_name (name);
+          action->label = g_variant_lookup_value (entry, "label", G_VARIANT_TYPE_STRING);
+          if (g_variant_lookup (entry, "parameter-type", "&g", &type))
+            action->parameter_type = g_strdup (type);
+          action->parameter_hint = g_variant_lookup_value (entry, "parameter-hint", NULL);
+          i++;
+        }
+      else
+        {
+          g_warning ("action dictionary for message '%s' is missing 'name' key", decoded->id);
+        }
+
+      g_variant_unref (entry);
+    }
+
+  decoded->n_actions = i;
+  g_variant_iter_free (action_iter);
+}
+
+/* Decodes @message right away, on the calling thread */
+static DecodedMessage *
+decoded_message_new_decoded (GVariant *message)
+{
+  DecodedMessage *decoded;
+
+  decoded = decoded_message_new (message);
+  decoded_message_decode (decoded);
+  decoded->decoded = TRUE;
+
+  return decoded;
+}
+
 /* Check to see if either of our action groups has any actions, if
    so return TRUE so we get chosen! */
 static gboolean
@@ -200,7 +570,7 @@ application_has_items (gpointer key,
   Application *app = value;
 
   return _g_action_group_has_actions(G_ACTION_GROUP(app->source_actions)) ||
-    _g_action_group_has_actions(G_ACTION_GROUP(app->message_actions));
+    im_message_actions_get_n_messages (app->message_actions) > 0;
 }
 
 static gboolean
@@ -307,15 +677,6 @@ app_source_action_check_draw (Application * app, const gchar * action_name)
   return draws_attention;
 }
 
-/* Check a message action to see if it draws */
-static gboolean
-app_message_action_check_draw (Application * app, const gchar * action_name)
-{
-  GAction * action = NULL;
-  action = g_action_map_lookup_action (G_ACTION_MAP (app->message_actions), action_name);
-  return GPOINTER_TO_INT(g_object_get_qdata(G_OBJECT(action), message_action_draws_attention_quark()));
-}
-
 /* Regenerate the draw attention flag based on the sources and messages
  * that we have in the action groups.
  *
@@ -325,7 +686,6 @@ static gboolean
 application_update_draws_attention (Application * app)
 {
   gchar **source_actions = NULL;
-  gchar **message_actions = NULL;
   gchar **it;
   gboolean was_drawing_attention = app->draws_attention;
 
@@ -335,23 +695,41 @@ application_update_draws_attention (Application * app)
   for (it = source_actions; *it && !app->draws_attention; it++)
     app->draws_attention = app_source_action_check_draw (app, *it);
 
-  message_actions = g_action_group_list_actions (G_ACTION_GROUP (app->message_actions));
-  for (it = message_actions; *it && !app->draws_attention; it++)
-    app->draws_attention = app_message_action_check_draw (app, *it);
+  if (!app->draws_attention)
+    app->draws_attention = im_message_actions_get_draws_attention (app->message_actions);
 
   g_strfreev (source_actions);
-  g_strfreev (message_actions);
 
   return was_drawing_attention != app->draws_attention;
 }
 
+/* Removes the source with @action_name, without updating the draws
+ * attention flag and the root action */
 static void
-im_application_list_source_removed_action (Application *app,
-                                           const gchar *action_name)
+application_remove_source_action (Application *app,
+                                  const gchar *action_name)
 {
+  GSequenceIter *iter;
+  gchar *id;
+
   g_action_map_remove_action (G_ACTION_MAP(app->source_actions), action_name);
   g_signal_emit (app->list, signals[SOURCE_REMOVED], 0, app->id, action_name);
 
+  id = unescape_action_name (action_name);
+  if ((iter = application_lookup_source (app, id)))
+    {
+      g_sequence_remove (iter);
+      im_application_list_schedule_snapshot (app->list);
+    }
+  g_free (id);
+}
+
+static void
+im_application_list_source_removed_action (Application *app,
+                                           const gchar *action_name)
+{
+  application_remove_source_action (app, action_name);
+
   application_update_draws_attention (app);
   im_application_list_update_root_action (app->list);
 }
@@ -364,6 +742,8 @@ im_application_list_source_removed (Application *app,
 {
   gchar *action_name;
 
+  g_hash_table_remove (app->deferred_sources, id);
+
   action_name = escape_action_name (id);
 
   im_application_list_source_removed_action (app, action_name);
@@ -407,13 +787,35 @@ static void
 im_application_list_message_removed_action (Application *app,
                                             const gchar *action_name)
 {
-  g_action_map_remove_action (G_ACTION_MAP(app->message_actions), action_name);
-  g_action_muxer_remove (app->message_sub_actions, action_name);
+  im_message_actions_remove (app->message_actions, action_name);
+
+  /* menus look up the message to remove its item */
+  g_signal_emit (app->list, signals[MESSAGE_REMOVED], 0, app->id, action_name);
+  application_untrack_message (app, action_name);
 
   application_update_draws_attention (app);
   im_application_list_update_root_action (app->list);
+}
 
-  g_signal_emit (app->list, signals[MESSAGE_REMOVED], 0, app->id, action_name);
+/* Drops the message with @id from the messages that were fetched but
+ * not added yet, so that it doesn't reappear after being removed. */
+static void
+application_drop_pending_message (Application *app,
+                                  const gchar *id)
+{
+  GList *it;
+
+  for (it = app->pending_messages.head; it; it = it->next)
+    {
+      DecodedMessage *pending = it->data;
+
+      if (g_str_equal (pending->id, id))
+        {
+          decoded_message_unref (pending);
+          g_queue_delete_link (&app->pending_messages, it);
+          return;
+        }
+    }
 }
 
 static void
@@ -422,6 +824,9 @@ im_application_list_message_removed (Application *app,
 {
   gchar *action_name;
 
+  application_drop_pending_message (app, id);
+  g_hash_table_remove (app->pending_bodies, id);
+
   action_name = escape_action_name (id);
 
   im_application_list_message_removed_action(app, action_name);
@@ -429,19 +834,141 @@ im_application_list_message_removed (Application *app,
   g_free (action_name);
 }
 
+/* Removes the messages with the (escaped) @action_names with one batch
+ * of action changes and one update of the draws attention flag, but
+ * without updating the root action. */
+static void
+application_remove_message_actions (Application         *app,
+                                    const gchar * const *action_names)
+{
+  const gchar * const *it;
+
+  g_action_muxer_begin_batch (app->muxer);
+
+  for (it = action_names; *it; it++)
+    im_message_actions_remove (app->message_actions, *it);
+
+  g_action_muxer_end_batch (app->muxer);
+
+  /* menus look up the messages to remove their items */
+  g_signal_emit (app->list, signals[MESSAGES_REMOVED], 0, app->id, action_names);
+
+  for (it = action_names; *it; it++)
+    application_untrack_message (app, *it);
+
+  application_update_draws_attention (app);
+}
+
+static void
+im_application_list_remove_message_actions (Application         *app,
+                                            const gchar * const *action_names)
+{
+  application_remove_message_actions (app, action_names);
+  im_application_list_update_root_action (app->list);
+}
+
+/* Removes all messages of @app, announcing it with messages-removed */
+static void
+im_application_list_remove_all_messages (Application *app)
+{
+  gchar **action_names;
+
+  if (im_message_store_get_n_app_messages (app->list->messages, app->id) == 0)
+    return;
+
+  action_names = application_list_tracked_messages (app);
+  im_application_list_remove_message_actions (app, (const gchar * const *) action_names);
+  g_strfreev (action_names);
+}
+
+static void
+im_application_list_messages_removed (Application         *app,
+                                      const gchar * const *ids)
+{
+  gchar **action_names;
+  guint n_ids;
+  guint i;
+
+  n_ids = g_strv_length ((gchar **) ids);
+  action_names = g_new (gchar *, n_ids + 1);
+
+  for (i = 0; i < n_ids; i++)
+    {
+      if (!g_queue_is_empty (&app->pending_messages))
+        application_drop_pending_message (app, ids[i]);
+      g_hash_table_remove (app->pending_bodies, ids[i]);
+
+      action_names[i] = escape_action_name (ids[i]);
+    }
+  action_names[n_ids] = NULL;
+
+  im_application_list_remove_message_actions (app, (const gchar * const *) action_names);
+
+  g_strfreev (action_names);
+}
+
+/* Removes the oldest messages of @app until it has at most
+ * list->max_messages. */
+static void
+im_application_list_evict_messages (Application *app)
+{
+  ImMessageStore *store = app->list->messages;
+  guint max_messages = app->list->max_messages;
+  gchar **action_names;
+  guint *rows;
+  guint n_rows;
+  guint i;
+
+  if (max_messages == 0 || im_message_store_get_n_app_messages (store, app->id) <= max_messages)
+    return;
+
+  rows = im_message_store_get_app_rows (store, app->id, &n_rows);
+
+  /* oldest first */
+  action_names = g_new (gchar *, n_rows - max_messages + 1);
+  for (i = 0; i < n_rows - max_messages; i++)
+    action_names[i] = g_strdup (im_message_store_get_id (store, rows[n_rows - 1 - i]));
+  action_names[i] = NULL;
+
+  im_application_list_remove_message_actions (app, (const gchar * const *) action_names);
+
+  g_strfreev (action_names);
+  g_free (rows);
+}
+
 static void
-im_application_list_message_activated (GSimpleAction *action,
-                                       GVariant      *parameter,
-                                       gpointer       user_data)
+im_application_list_message_activated (ImMessageActions *actions,
+                                       const gchar      *action_name,
+                                       const gchar      *message_id,
+                                       const gchar      *sub_action_name,
+                                       GVariant         *parameter,
+                                       gpointer          user_data)
 {
   Application *app = user_data;
-  const gchar *action_name;
-  gchar *message_id;
 
-  action_name = g_action_get_name (G_ACTION (action));
-  message_id = unescape_action_name (action_name);
+  if (sub_action_name)
+    {
+      gchar *action_id;
+      GVariantBuilder builder;
 
-  if (g_variant_get_boolean (parameter))
+      action_id = unescape_action_name (sub_action_name);
+
+      g_variant_builder_init (&builder, G_VARIANT_TYPE ("av"));
+      if (parameter)
+        g_variant_builder_add (&builder, "v", parameter);
+
+      indicator_messages_application_call_activate_message (app->proxy,
+                                                            message_id,
+                                                            action_id,
+                                                            g_variant_builder_end (&builder),
+                                                            app->cancellable,
+                                                            NULL, NULL);
+
+      im_application_list_message_removed (app, message_id);
+
+      g_free (action_id);
+    }
+  else if (g_variant_get_boolean (parameter))
     {
       indicator_messages_application_call_activate_message (app->proxy,
                                                             message_id,
@@ -449,6 +976,8 @@ im_application_list_message_activated (GSimpleAction *action,
                                                             g_variant_new_array (G_VARIANT_TYPE_VARIANT, NULL, 0),
                                                             app->cancellable,
                                                             NULL, NULL);
+
+      im_application_list_message_removed_action (app, action_name);
     }
   else
     {
@@ -456,40 +985,29 @@ im_application_list_message_activated (GSimpleAction *action,
       const gchar *messages[] = { message_id, NULL };
       indicator_messages_application_call_dismiss (app->proxy, sources, messages,
                                                    app->cancellable, NULL, NULL);
-    }
-
-  im_application_list_message_removed_action (app, action_name);
 
-  g_free (message_id);
+      im_application_list_message_removed_action (app, action_name);
+    }
 }
 
-static void
-im_application_list_sub_message_activated (GSimpleAction *action,
-                                           GVariant      *parameter,
-                                           gpointer       user_data)
+/* Returns the keys of @set as a NULL-terminated array, which only
+ * needs to be freed with g_free() */
+static const gchar **
+string_set_get_keys (GHashTable *set)
 {
-  Application *app = user_data;
-  const gchar *message_id;
-  gchar *action_id;
-  GVariantBuilder builder;
-
-  message_id = g_object_get_data (G_OBJECT (action), "message");
-  action_id = unescape_action_name (g_action_get_name (G_ACTION (action)));
-
-  g_variant_builder_init (&builder, G_VARIANT_TYPE ("av"));
-  if (parameter)
-    g_variant_builder_add (&builder, "v", parameter);
+  GHashTableIter iter;
+  const gchar **keys;
+  gpointer key;
+  guint i = 0;
 
-  indicator_messages_application_call_activate_message (app->proxy,
-                                                        message_id,
-                                                        action_id,
-                                                        g_variant_builder_end (&builder),
-                                                        app->cancellable,
-                                                        NULL, NULL);
+  keys = g_new (const gchar *, g_hash_table_size (set) + 1);
 
-  im_application_list_message_removed (app, message_id);
+  g_hash_table_iter_init (&iter, set);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    keys[i++] = key;
+  keys[i] = NULL;
 
-  g_free (action_id);
+  return keys;
 }
 
 static void
@@ -502,75 +1020,204 @@ im_application_list_remove_all (GSimpleAction *action,
   Application *app;
 
   g_signal_emit (list, signals[REMOVE_ALL], 0);
+  im_message_store_remove_all (list->messages);
 
   g_hash_table_iter_init (&iter, list->applications);
   while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &app))
     {
+      GHashTable *dismissed_sources;
+      GHashTable *dismissed_messages;
+      GHashTableIter pending_iter;
+      gpointer id;
       gchar **source_actions;
       gchar **message_actions;
       gchar **it;
+      GList *l;
+
+      /* unescaped ids, including those of sources and messages that
+       * were received but not added yet */
+      dismissed_sources = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+      dismissed_messages = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+      g_hash_table_iter_init (&pending_iter, app->deferred_sources);
+      while (g_hash_table_iter_next (&pending_iter, &id, NULL))
+        g_hash_table_add (dismissed_sources, g_strdup (id));
+
+      for (l = app->pending_messages.head; l; l = l->next)
+        g_hash_table_add (dismissed_messages, g_strdup (((DecodedMessage *) l->data)->id));
 
-      app->draws_attention = FALSE;
+      g_hash_table_iter_init (&pending_iter, app->pending_bodies);
+      while (g_hash_table_iter_next (&pending_iter, &id, NULL))
+        g_hash_table_add (dismissed_messages, g_strdup (id));
+
+      /* nothing that was queued comes back after clearing */
+      application_clear_pending_messages (app);
+      g_hash_table_remove_all (app->deferred_sources);
+      application_reset_paging (app);
+
+      g_action_muxer_begin_batch (app->muxer);
 
       source_actions = g_action_group_list_actions (G_ACTION_GROUP (app->source_actions));
       for (it = source_actions; *it; it++)
-        im_application_list_source_removed_action (app, *it);
+        {
+          application_remove_source_action (app, *it);
+          g_hash_table_add (dismissed_sources, unescape_action_name (*it));
+        }
 
-      message_actions = g_action_group_list_actions (G_ACTION_GROUP (app->message_actions));
+      message_actions = im_message_actions_list_messages (app->message_actions);
       for (it = message_actions; *it; it++)
-        im_application_list_message_removed_action (app, *it);
+        g_hash_table_add (dismissed_messages, unescape_action_name (*it));
+      application_remove_message_actions (app, (const gchar * const *) message_actions);
+
+      g_action_muxer_end_batch (app->muxer);
 
       if (app->proxy != NULL) /* If it is remote, we tell the app we've cleared */
         {
-          guint i;
-          gchar **unescaped_source_actions;
-          gchar **unescaped_message_actions;
-
-          /* Unescape action names */
-          unescaped_source_actions = g_new0 (gchar *, g_strv_length (source_actions) + 1);
-          for (i = 0; source_actions[i]; i++)
-            unescaped_source_actions[i] = unescape_action_name (source_actions[i]);
-
-          unescaped_message_actions = g_new0 (gchar *, g_strv_length (message_actions) + 1);
-          for (i = 0; message_actions[i]; i++)
-            unescaped_message_actions[i] = unescape_action_name (message_actions[i]);
-
-          indicator_messages_application_call_dismiss (app->proxy, 
-                                                       (const gchar * const *) unescaped_source_actions,
-                                                       (const gchar * const *) unescaped_message_actions,
+          const gchar **sources;
+          const gchar **messages;
+
+          sources = string_set_get_keys (dismissed_sources);
+          messages = string_set_get_keys (dismissed_messages);
+
+          indicator_messages_application_call_dismiss (app->proxy, sources, messages,
                                                        app->cancellable, NULL, NULL);
 
-          g_strfreev (unescaped_source_actions);
-          g_strfreev (unescaped_message_actions);
+          g_free (sources);
+          g_free (messages);
         }
 
       g_strfreev (source_actions);
       g_strfreev (message_actions);
+      g_hash_table_unref (dismissed_sources);
+      g_hash_table_unref (dismissed_messages);
     }
 
   im_application_list_update_root_action (list);
 }
 
-static void
-im_application_list_dispose (GObject *object)
+/* Writes the state of all applications to list->snapshot_path, in a
+ * form that can be mapped and used without parsing. */
+static gboolean
+im_application_list_write_snapshot (gpointer user_data)
 {
-  ImApplicationList *list = IM_APPLICATION_LIST (object);
+  ImApplicationList *list = user_data;
+  GVariantBuilder builder;
+  GHashTableIter iter;
+  Application *app;
+  GVariant *snapshot;
+  gchar *dirname;
+  GError *error = NULL;
 
-  g_clear_object (&list->statusaction);
-  g_clear_object (&list->globalactions);
-  g_clear_pointer (&list->app_status, g_hash_table_unref);
+  list->snapshot_id = 0;
 
-  g_clear_pointer (&list->applications, g_hash_table_unref);
-  g_clear_object (&list->muxer);
+  g_variant_builder_init (&builder, G_VARIANT_TYPE (SNAPSHOT_TYPE));
 
-  g_clear_object (&list->as);
+  g_hash_table_iter_init (&iter, list->applications);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &app))
+    {
+      GSequenceIter *it;
+      GHashTableIter icon_iter;
+      const gchar *ref;
+      GVariant *icon;
+      guint *rows;
+      guint n_rows;
+      guint i;
+
+      if (g_sequence_get_length (app->sources) == 0 &&
+          im_message_store_get_n_app_messages (list->messages, app->id) == 0)
+        continue;
+
+      g_variant_builder_open (&builder, G_VARIANT_TYPE ("(sta(ssavuxsb)a(savsssxaa{sv}b)a{sv})"));
+      g_variant_builder_add (&builder, "s", app->id);
+      g_variant_builder_add (&builder, "t", app->generation);
+
+      g_variant_builder_open (&builder, G_VARIANT_TYPE ("a(ssavuxsb)"));
+      for (it = g_sequence_get_begin_iter (app->sources); !g_sequence_iter_is_end (it); it = g_sequence_iter_next (it))
+        g_variant_builder_add_value (&builder, g_sequence_get (it));
+      g_variant_builder_close (&builder);
+
+      g_variant_builder_open (&builder, G_VARIANT_TYPE ("a(savsssxaa{sv}b)"));
+      rows = im_message_store_get_app_rows (list->messages, app->id, &n_rows);
+      for (i = 0; i < n_rows; i++)
+        g_variant_builder_add_value (&builder, im_message_store_get_message (list->messages, rows[i]));
+      g_free (rows);
+      g_variant_builder_close (&builder);
+
+      g_variant_builder_open (&builder, G_VARIANT_TYPE ("a{sv}"));
+      g_hash_table_iter_init (&icon_iter, app->icons);
+      while (g_hash_table_iter_next (&icon_iter, (gpointer *) &ref, (gpointer *) &icon))
+        g_variant_builder_add (&builder, "{sv}", ref, icon);
+      g_variant_builder_close (&builder);
+
+      g_variant_builder_close (&builder);
+    }
 
-  G_OBJECT_CLASS (im_application_list_parent_class)->dispose (object);
-}
+  snapshot = g_variant_ref_sink (g_variant_new ("(u@" SNAPSHOT_TYPE ")",
+                                                SNAPSHOT_VERSION, g_variant_builder_end (&builder)));
+
+  dirname = g_path_get_dirname (list->snapshot_path);
+  g_mkdir_with_parents (dirname, 0700);
+
+  if (!g_file_set_contents (list->snapshot_path,
+                            g_variant_get_data (snapshot), g_variant_get_size (snapshot),
+                            &error))
+    {
+      g_warning ("unable to write snapshot: %s", error->message);
+      g_error_free (error);
+    }
+
+  g_free (dirname);
+  g_variant_unref (snapshot);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+im_application_list_schedule_snapshot (ImApplicationList *list)
+{
+  if (list->snapshot_path && list->snapshot_id == 0)
+    list->snapshot_id = g_timeout_add_seconds (SNAPSHOT_DELAY, im_application_list_write_snapshot, list);
+}
+
+static void
+im_application_list_dispose (GObject *object)
+{
+  ImApplicationList *list = IM_APPLICATION_LIST (object);
+
+  if (list->snapshot_id)
+    {
+      g_source_remove (list->snapshot_id);
+      im_application_list_write_snapshot (list);
+    }
+
+  if (list->snapshot_expiry_id)
+    {
+      g_source_remove (list->snapshot_expiry_id);
+      list->snapshot_expiry_id = 0;
+    }
+
+  g_clear_object (&list->statusaction);
+  g_clear_object (&list->globalactions);
+  g_clear_pointer (&list->app_status, g_hash_table_unref);
+
+  g_clear_pointer (&list->applications, g_hash_table_unref);
+  g_clear_pointer (&list->loading, g_hash_table_unref);
+  g_clear_pointer (&list->snapshot, g_variant_unref);
+  g_clear_object (&list->muxer);
+
+  g_clear_object (&list->as);
+
+  G_OBJECT_CLASS (im_application_list_parent_class)->dispose (object);
+}
 
 static void
 im_application_list_finalize (GObject *object)
 {
+  ImApplicationList *list = IM_APPLICATION_LIST (object);
+
+  g_free (list->snapshot_path);
+  im_message_store_free (list->messages);
+
   G_OBJECT_CLASS (im_application_list_parent_class)->finalize (object);
 }
 
@@ -633,9 +1280,9 @@ im_application_list_class_init (ImApplicationListClass *klass)
                                          G_TYPE_ICON,
                                          G_TYPE_STRING,
                                          G_TYPE_VARIANT,
-                                         G_TYPE_STRING,
-                                         G_TYPE_STRING,
-                                         G_TYPE_STRING,
+                                         G_TYPE_VARIANT,
+                                         G_TYPE_VARIANT,
+                                         G_TYPE_VARIANT,
                                          G_TYPE_VARIANT,
                                          G_TYPE_INT64,
                                          G_TYPE_BOOLEAN);
@@ -651,6 +1298,17 @@ im_application_list_class_init (ImApplicationListClass *klass)
                                            G_TYPE_STRING,
                                            G_TYPE_STRING);
 
+  signals[MESSAGES_REMOVED] = g_signal_new ("messages-removed",
+                                            IM_TYPE_APPLICATION_LIST,
+                                            G_SIGNAL_RUN_FIRST,
+                                            0,
+                                            NULL, NULL,
+                                            g_cclosure_marshal_generic,
+                                            G_TYPE_NONE,
+                                            2,
+                                            G_TYPE_STRING,
+                                            G_TYPE_STRV);
+
   signals[APP_ADDED] = g_signal_new ("app-added",
                                      IM_TYPE_APPLICATION_LIST,
                                      G_SIGNAL_RUN_FIRST,
@@ -700,7 +1358,9 @@ im_application_list_init (ImApplicationList *list)
   };
 
   list->applications = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, application_free);
+  list->loading = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
   list->app_status = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  list->messages = im_message_store_new ();
 
   list->globalactions = g_simple_action_group_new ();
   {
@@ -713,7 +1373,9 @@ im_application_list_init (ImApplicationList *list)
   g_signal_connect(list->statusaction, "activate", G_CALLBACK(status_activated), list);
   g_action_map_add_action(G_ACTION_MAP(list->globalactions), G_ACTION(list->statusaction));
 
+  /* exported with im_action_exporter_export(), which understands batches */
   list->muxer = g_action_muxer_new ();
+  g_action_muxer_set_grouped_signals (list->muxer, TRUE);
   g_action_muxer_insert (list->muxer, NULL, G_ACTION_GROUP (list->globalactions));
 
   list->as = im_accounts_service_ref_default();
@@ -788,50 +1450,93 @@ im_application_list_activate_app_action (GSimpleAction *action,
   indicator_desktop_shortcuts_nick_exec_with_context (app->shortcuts, g_action_get_name (G_ACTION (action)), NULL);
 }
 
-gboolean
-im_application_list_add (ImApplicationList  *list,
-                         const gchar        *desktop_id)
+typedef struct
 {
   GDesktopAppInfo *info;
-  Application *app;
-  const gchar *id;
-  GSimpleActionGroup *actions;
-  GSimpleAction *launch_action;
-  IndicatorDesktopShortcuts * shortcuts = NULL;
+  IndicatorDesktopShortcuts *shortcuts;
+} AppFiles;
 
-  g_return_val_if_fail (IM_IS_APPLICATION_LIST (list), FALSE);
-  g_return_val_if_fail (desktop_id != NULL, FALSE);
+static void
+app_files_free (gpointer data)
+{
+  AppFiles *files = data;
 
-  if (im_application_list_lookup (list, desktop_id))
-    return TRUE;
+  g_object_unref (files->info);
+  g_clear_object (&files->shortcuts);
+  g_slice_free (AppFiles, files);
+}
 
-  info = g_desktop_app_info_new (desktop_id);
+/* Loads and parses the desktop file of @desktop_id. This does blocking
+ * I/O and is safe to call from any thread. */
+static AppFiles *
+app_files_load (const gchar  *desktop_id,
+                GError      **error)
+{
+  AppFiles *files;
+  GDesktopAppInfo *info;
+  const gchar *filename;
+
+  info = im_app_info_cache_lookup (desktop_id);
   if (!info)
     {
-      g_warning ("an application with id '%s' is not installed", desktop_id);
-      return FALSE;
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                   "an application with id '%s' is not installed", desktop_id);
+      return NULL;
     }
 
-  id = g_app_info_get_id (G_APP_INFO (info));
-  g_return_val_if_fail (id != NULL, FALSE);
+  if (g_app_info_get_id (G_APP_INFO (info)) == NULL)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                   "the application '%s' doesn't have an id", desktop_id);
+      g_object_unref (info);
+      return NULL;
+    }
 
-  {
-    const char * filename = g_desktop_app_info_get_filename(info);
-    if (filename != NULL)
-      shortcuts = indicator_desktop_shortcuts_new(filename, "Messaging Menu");
-  }
+  files = g_slice_new0 (AppFiles);
+  files->info = info;
+
+  filename = g_desktop_app_info_get_filename (info);
+  if (filename != NULL)
+    files->shortcuts = indicator_desktop_shortcuts_new (filename, "Messaging Menu");
+
+  return files;
+}
+
+static void im_application_list_restore_app (ImApplicationList *list,
+                                             Application       *app);
+
+/* Creates the application for @files and publishes it. Must be called
+ * on the main thread. */
+static void
+im_application_list_insert (ImApplicationList *list,
+                            AppFiles          *files)
+{
+  GDesktopAppInfo *info = g_object_ref (files->info);
+  IndicatorDesktopShortcuts *shortcuts = files->shortcuts ? g_object_ref (files->shortcuts) : NULL;
+  Application *app;
+  GSimpleActionGroup *actions;
+  GSimpleAction *launch_action;
 
   app = g_slice_new0 (Application);
+  app->icons = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_variant_unref);
+  app->pending_icons = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  app->pending_bodies = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  app->sources = g_sequence_new ((GDestroyNotify) g_variant_unref);
+  app->deferred_sources = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_variant_unref);
   app->info = info;
-  app->id = im_application_list_canonical_id (id);
+  app->id = im_application_list_canonical_id (g_app_info_get_id (G_APP_INFO (info)));
   app->list = list;
   app->muxer = g_action_muxer_new ();
   app->source_actions = g_simple_action_group_new ();
-  app->message_actions = g_simple_action_group_new ();
-  app->message_sub_actions = g_action_muxer_new ();
+  app->message_actions = im_message_actions_new ();
   app->draws_attention = FALSE;
   app->shortcuts = shortcuts;
 
+  g_signal_connect (app->message_actions, "activate", G_CALLBACK (im_application_list_message_activated), app);
+
+  /* only ever consumed by the muxer it's inserted into */
+  g_action_muxer_set_grouped_signals (app->muxer, TRUE);
+
   actions = g_simple_action_group_new ();
 
   launch_action = g_simple_action_new_stateful ("launch", NULL, g_variant_new_boolean (FALSE));
@@ -856,7 +1561,7 @@ im_application_list_add (ImApplicationList  *list,
   g_action_muxer_insert (app->muxer, NULL, G_ACTION_GROUP (actions));
   g_action_muxer_insert (app->muxer, "src", G_ACTION_GROUP (app->source_actions));
   g_action_muxer_insert (app->muxer, "msg", G_ACTION_GROUP (app->message_actions));
-  g_action_muxer_insert (app->muxer, "msg-actions", G_ACTION_GROUP (app->message_sub_actions));
+  g_action_muxer_insert (app->muxer, "msg-actions", im_message_actions_get_sub_actions (app->message_actions));
 
   g_hash_table_insert (list->applications, (gpointer) app->id, app);
   g_action_muxer_insert (list->muxer, app->id, G_ACTION_GROUP (app->muxer));
@@ -865,12 +1570,111 @@ im_application_list_add (ImApplicationList  *list,
 
   g_signal_emit (app->list, signals[APP_ADDED], 0, app->id, app->info);
 
+  im_application_list_restore_app (list, app);
+
   g_object_unref (launch_action);
   g_object_unref (actions);
+}
+
+gboolean
+im_application_list_add (ImApplicationList  *list,
+                         const gchar        *desktop_id)
+{
+  AppFiles *files;
+  GError *error = NULL;
+
+  g_return_val_if_fail (IM_IS_APPLICATION_LIST (list), FALSE);
+  g_return_val_if_fail (desktop_id != NULL, FALSE);
+
+  if (im_application_list_lookup (list, desktop_id))
+    return TRUE;
+
+  files = app_files_load (desktop_id, &error);
+  if (!files)
+    {
+      g_warning ("%s", error->message);
+      g_error_free (error);
+      return FALSE;
+    }
+
+  im_application_list_insert (list, files);
+  app_files_free (files);
 
   return TRUE;
 }
 
+static void
+im_application_list_load_in_thread (GTask        *task,
+                                    gpointer      source_object,
+                                    gpointer      task_data,
+                                    GCancellable *cancellable)
+{
+  AppFiles *files;
+  GError *error = NULL;
+
+  files = app_files_load (task_data, &error);
+  if (files)
+    g_task_return_pointer (task, files, app_files_free);
+  else
+    g_task_return_error (task, error);
+}
+
+static void
+im_application_list_loaded (GObject      *source_object,
+                            GAsyncResult *result,
+                            gpointer      user_data)
+{
+  ImApplicationList *list = IM_APPLICATION_LIST (source_object);
+  const gchar *desktop_id = g_task_get_task_data (G_TASK (result));
+  AppFiles *files;
+  gchar *id;
+  GError *error = NULL;
+
+  files = g_task_propagate_pointer (G_TASK (result), &error);
+  if (!files)
+    {
+      g_warning ("%s", error->message);
+      g_error_free (error);
+      return;
+    }
+
+  /* skip applications that were removed or added synchronously in the
+   * meantime */
+  id = im_application_list_canonical_id (desktop_id);
+  if (g_hash_table_remove (list->loading, id) && !g_hash_table_contains (list->applications, id))
+    im_application_list_insert (list, files);
+
+  app_files_free (files);
+  g_free (id);
+}
+
+/*
+ * Like im_application_list_add(), but loads the desktop file of
+ * @desktop_id on a worker thread. The application is added from the
+ * main context as soon as its desktop file has been parsed, so that
+ * adding many applications doesn't block on disk I/O.
+ */
+void
+im_application_list_add_async (ImApplicationList *list,
+                               const gchar       *desktop_id)
+{
+  GTask *task;
+
+  g_return_if_fail (IM_IS_APPLICATION_LIST (list));
+  g_return_if_fail (desktop_id != NULL);
+
+  if (im_application_list_lookup (list, desktop_id))
+    return;
+
+  g_hash_table_add (list->loading, im_application_list_canonical_id (desktop_id));
+
+  task = g_task_new (list, NULL, im_application_list_loaded, NULL);
+  g_task_set_task_data (task, g_strdup (desktop_id), g_free);
+  g_task_run_in_thread (task, im_application_list_load_in_thread);
+
+  g_object_unref (task);
+}
+
 void
 im_application_list_remove (ImApplicationList *list,
                             const gchar       *id)
@@ -879,12 +1683,22 @@ im_application_list_remove (ImApplicationList *list,
 
   g_return_if_fail (IM_IS_APPLICATION_LIST (list));
 
+  /* don't add it when it has finished loading */
+  {
+    gchar *canonical_id = im_application_list_canonical_id (id);
+    g_hash_table_remove (list->loading, canonical_id);
+    g_free (canonical_id);
+  }
+
   app = im_application_list_lookup (list, id);
   if (app)
     {
       if (app->proxy || app->cancellable)
         g_signal_emit (app->list, signals[APP_STOPPED], 0, app->id);
+      else
+        im_application_list_remove_all_messages (app);
 
+      im_message_store_remove_app (list->messages, app->id);
       g_hash_table_remove (list->applications, id);
       g_action_muxer_remove (list->muxer, id);
 
@@ -914,7 +1728,7 @@ im_application_list_source_added (Application *app,
                  &id, &label, &maybe_serialized_icon, &count, &time, &string, &draws_attention);
 
   if (g_variant_n_children (maybe_serialized_icon) == 1)
-    g_variant_get_child (maybe_serialized_icon, 0, "v", &serialized_icon);
+    serialized_icon = application_resolve_icon (app, maybe_serialized_icon);
 
   visible = count > 0 || time != 0 || (string != NULL && string[0] != '\0');
 
@@ -925,6 +1739,9 @@ im_application_list_source_added (Application *app,
 
   g_action_map_add_action (G_ACTION_MAP(app->source_actions), G_ACTION (action));
 
+  g_sequence_insert_before (g_sequence_get_iter_at_pos (app->sources, position), g_variant_ref (source));
+  im_application_list_schedule_snapshot (app->list);
+
   g_signal_emit (app->list, signals[SOURCE_ADDED], 0, app->id, action_name, label, serialized_icon, visible);
 
   if (visible && draws_attention && app->draws_attention == FALSE)
@@ -953,12 +1770,19 @@ im_application_list_source_changed (Application *app,
   GVariant *serialized_icon = NULL;
   gboolean visible;
   gchar *action_name;
+  GSequenceIter *iter;
 
   g_variant_get (source, "(&s&s@avux&sb)",
                  &id, &label, &maybe_serialized_icon, &count, &time, &string, &draws_attention);
 
   if (g_variant_n_children (maybe_serialized_icon) == 1)
-    g_variant_get_child (maybe_serialized_icon, 0, "v", &serialized_icon);
+    serialized_icon = application_resolve_icon (app, maybe_serialized_icon);
+
+  if ((iter = application_lookup_source (app, id)))
+    {
+      g_sequence_set (iter, g_variant_ref (source));
+      im_application_list_schedule_snapshot (app->list);
+    }
 
   action_name = escape_action_name (id);
 
@@ -978,240 +1802,1190 @@ im_application_list_source_changed (Application *app,
   g_free (action_name);
 }
 
-static void
-im_application_list_sources_listed (GObject      *source_object,
-                                    GAsyncResult *result,
-                                    gpointer      user_data)
+typedef struct
 {
-  Application *app = user_data;
-  GVariant *sources;
-  GError *error = NULL;
+  Application *app;
+  gchar *ref;
+  guint64 size;     /* as announced in icon-registered */
+} IconRequest;
 
-  if (indicator_messages_application_call_list_sources_finish (app->proxy, &sources, result, &error))
+typedef struct
+{
+  Application *app;
+  gchar *id;
+  GVariant *message;  /* with the placeholder instead of the body */
+  guint64 size;       /* as announced in the placeholder */
+} BodyRequest;
+
+/* Largest icon or body accepted from an application as memfd */
+#define MAX_MEMFD_SIZE (16 * 1024 * 1024)
+
+static gboolean im_application_list_ingest_messages (gpointer user_data);
+static void im_application_list_queue_messages (Application *app,
+                                                GVariant    *messages,
+                                                gboolean     listed);
+static void im_application_list_message_added (Application *app,
+                                               GVariant    *message);
+
+/* Returns the contents of the memfd @fd, which must be exactly
+ * @size bytes long. The fd comes from the application, so it is only
+ * mapped when its seals guarantee that it can neither shrink nor change
+ * while mapped. Otherwise, its contents are copied. */
+static GBytes *
+im_application_list_read_memfd (gint      fd,
+                                guint64   size,
+                                GError  **error)
+{
+  gboolean sealed = FALSE;
+  gchar *data;
+  gsize n_read;
+
+  if (size > MAX_MEMFD_SIZE)
     {
-      GVariantIter iter;
-      GVariant *source;
-      guint i = 0;
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   "memfd of %" G_GUINT64_FORMAT " bytes is too large", size);
+      return NULL;
+    }
 
-      g_variant_iter_init (&iter, sources);
-      while ((source = g_variant_iter_next_value (&iter)))
+#ifdef F_GET_SEALS
+  {
+    gint seals;
+
+    seals = fcntl (fd, F_GET_SEALS);
+    sealed = seals >= 0 && (seals & (F_SEAL_SHRINK | F_SEAL_WRITE)) == (F_SEAL_SHRINK | F_SEAL_WRITE);
+  }
+#endif
+
+  if (sealed)
+    {
+      GMappedFile *mapped;
+      GBytes *bytes;
+
+      mapped = g_mapped_file_new_from_fd (fd, FALSE, error);
+      if (mapped == NULL)
+        return NULL;
+
+      if (g_mapped_file_get_length (mapped) != size)
         {
-          im_application_list_source_added (app, i++, source);
-          g_variant_unref (source);
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                       "memfd is %" G_GSIZE_FORMAT " bytes instead of the announced %" G_GUINT64_FORMAT,
+                       g_mapped_file_get_length (mapped), size);
+          g_mapped_file_unref (mapped);
+          return NULL;
         }
 
-      g_variant_unref (sources);
+      bytes = g_mapped_file_get_bytes (mapped);
+      g_mapped_file_unref (mapped);
+      return bytes;
     }
-  else
+
+  /* one more byte than announced, to notice if the file is larger */
+  data = g_malloc (size + 1);
+  n_read = 0;
+  while (n_read <= size)
     {
-      g_warning ("could not fetch the list of sources: %s", error->message);
-      g_error_free (error);
+      gssize r;
+
+      r = pread (fd, data + n_read, size + 1 - n_read, n_read);
+      if (r < 0 && errno == EINTR)
+        continue;
+
+      if (r < 0)
+        {
+          g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                       "unable to read memfd: %s", g_strerror (errno));
+          g_free (data);
+          return NULL;
+        }
+
+      if (r == 0)
+        break;
+
+      n_read += r;
+    }
+
+  if (n_read != size)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   "memfd size does not match the announced %" G_GUINT64_FORMAT " bytes", size);
+      g_free (data);
+      return NULL;
     }
+
+  return g_bytes_new_take (data, size);
 }
 
-static GIcon *
-get_symbolic_app_icon (GDesktopAppInfo *info)
+static void
+im_application_list_icon_received (GObject      *source_object,
+                                   GAsyncResult *result,
+                                   gpointer      user_data)
 {
-  gchar *x_symbolic_icon;
-  GIcon *icon;
-  const gchar * const *names;
-  gchar *symbolic_name;
-  GIcon *symbolic_icon;
+  IconRequest *request = user_data;
+  Application *app = request->app;
+  const gchar *ref = request->ref;
+  GVariant *handle = NULL;
+  GUnixFDList *fd_list = NULL;
+  GBytes *bytes = NULL;
+  GError *error = NULL;
+  gint fd;
 
-  /* If X-Ubuntu-SymbolicIcon exists, use that. It is always interpreted
-   * as a filename.
-   *
-   * Simply appending -symbolic to the normal icon doesn't work for
-   * icons specified by file name, because the symbolic icon might be in
-   * a different format (symbolic icons tend to be svg and normal icons
-   * png). Also, icons specified by file names don't allow for fallbacks
-   * (without stating the file from this process), and we'd want to fall
-   * back to the normal app icon.
-   *
-   * See lp: #1365408
-   */
-  if ((x_symbolic_icon = g_desktop_app_info_get_string (info, "X-Ubuntu-SymbolicIcon")))
+  if (!indicator_messages_application_call_get_icon_finish (INDICATOR_MESSAGES_APPLICATION (source_object),
+                                                            &handle, &fd_list, result, &error) &&
+      g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
     {
-      GFile *file;
+      /* @app is gone or its remote was unset */
+      g_error_free (error);
+      g_free (request->ref);
+      g_slice_free (IconRequest, request);
+      return;
+    }
 
-      file = g_file_new_for_path (x_symbolic_icon);
-      symbolic_icon = g_file_icon_new (file);
+  if (error == NULL)
+    {
+      fd = g_unix_fd_list_get (fd_list, g_variant_get_handle (handle), &error);
+      if (fd >= 0)
+        {
+          bytes = im_application_list_read_memfd (fd, request->size, &error);
+          close (fd);
+        }
+    }
 
-      g_object_unref (file);
-      g_free (x_symbolic_icon);
+  if (bytes)
+    {
+      /* only insert it if it wasn't unregistered in the meantime */
+      if (g_hash_table_contains (app->pending_icons, ref))
+        {
+          GVariant *icon;
 
-      return symbolic_icon;
+          icon = g_variant_new ("(sv)", "bytes",
+                                g_variant_new_from_bytes (G_VARIANT_TYPE_BYTESTRING, bytes, TRUE));
+          g_hash_table_insert (app->icons, g_strdup (ref), g_variant_ref_sink (icon));
+        }
+
+      g_bytes_unref (bytes);
+    }
+  else
+    {
+      g_warning ("could not fetch icon '%s' of application '%s': %s", ref, app->id, error->message);
+      g_error_free (error);
     }
 
-  icon = g_app_info_get_icon (G_APP_INFO (info));
-  if (icon == NULL)
-    return NULL;
+  g_hash_table_remove (app->pending_icons, ref);
 
-  if (!G_IS_THEMED_ICON (icon))
-    return g_object_ref (icon);
+  /* messages were held back while icons were pending */
+  if (g_hash_table_size (app->pending_icons) == 0 &&
+      app->ingest_id == 0 && !g_queue_is_empty (&app->pending_messages))
+    app->ingest_id = g_idle_add (im_application_list_ingest_messages, app);
 
-  names = g_themed_icon_get_names (G_THEMED_ICON (icon));
-  if (!names || !names[0])
-    return g_object_ref (icon);
+  g_clear_object (&fd_list);
+  if (handle)
+    g_variant_unref (handle);
+  g_free (request->ref);
+  g_slice_free (IconRequest, request);
+}
 
-  symbolic_name = g_strconcat (names[0], "-symbolic", NULL);
+static void
+im_application_list_icon_registered (Application *app,
+                                     const gchar *ref,
+                                     GVariant    *icon)
+{
+  const gchar *kind;
+  GVariant *value;
 
-  symbolic_icon = g_themed_icon_new_from_names ((gchar **) names, -1);
-  g_themed_icon_prepend_name (G_THEMED_ICON (symbolic_icon), symbolic_name);
+  /* large icons are not sent over the bus, but handed out as a sealed
+   * memfd of the announced size, which is mapped read-only instead of
+   * copied */
+  if (g_variant_is_of_type (icon, G_VARIANT_TYPE ("(sv)")))
+    {
+      g_variant_get (icon, "(&sv)", &kind, &value);
 
-  g_free (symbolic_name);
+      if (g_str_equal (kind, "memfd") && g_variant_is_of_type (value, G_VARIANT_TYPE_UINT64))
+        {
+          IconRequest *request;
+
+          request = g_slice_new (IconRequest);
+          request->app = app;
+          request->ref = g_strdup (ref);
+          request->size = g_variant_get_uint64 (value);
+          g_variant_unref (value);
+
+          g_hash_table_add (app->pending_icons, g_strdup (ref));
+          indicator_messages_application_call_get_icon (app->proxy, ref, NULL, app->cancellable,
+                                                        im_application_list_icon_received, request);
+          return;
+        }
 
-  return symbolic_icon;
+      g_variant_unref (value);
+    }
+
+  g_hash_table_insert (app->icons, g_strdup (ref), g_variant_ref (icon));
+}
+
+/* Menu items keep their own reference to the icon, so this only drops
+ * the table entry. */
+static void
+im_application_list_icon_unregistered (Application *app,
+                                       const gchar *ref)
+{
+  g_hash_table_remove (app->icons, ref);
+  g_hash_table_remove (app->pending_icons, ref);
+}
+
+/* Returns TRUE if @body is a placeholder for a body that is handed out
+ * with GetBody, and stores the size of its memfd in @size. */
+static gboolean
+parse_body_placeholder (const gchar *body,
+                        guint64     *size)
+{
+  gchar *end;
+
+  if (!g_str_has_prefix (body, BODY_PLACEHOLDER))
+    return FALSE;
+
+  body += strlen (BODY_PLACEHOLDER);
+  if (!g_ascii_isdigit (*body))
+    return FALSE;
+
+  *size = g_ascii_strtoull (body, &end, 10);
+
+  return *end == '\0' && *size > 0;
+}
+
+/* Returns a copy of @message (of type (savsssxaa{sv}b)) with @body,
+ * which is consumed if it is floating */
+static GVariant *
+message_with_body (GVariant *message,
+                   GVariant *body)
+{
+  const gchar *id;
+  GVariant *icon;
+  const gchar *title;
+  const gchar *subtitle;
+  gint64 time;
+  GVariant *actions;
+  gboolean draws_attention;
+  GVariant *result;
+
+  g_variant_get (message, "(&s@av&s&s&sx@aa{sv}b)",
+                 &id, &icon, &title, &subtitle, NULL, &time, &actions, &draws_attention);
+
+  result = g_variant_new ("(s@avss@sx@aa{sv}b)",
+                          id, icon, title, subtitle, body, time, actions, draws_attention);
+
+  g_variant_unref (icon);
+  g_variant_unref (actions);
+
+  return result;
+}
+
+static void
+body_request_free (BodyRequest *request)
+{
+  g_free (request->id);
+  g_variant_unref (request->message);
+  g_slice_free (BodyRequest, request);
+}
+
+static void
+im_application_list_body_received (GObject      *source_object,
+                                   GAsyncResult *result,
+                                   gpointer      user_data)
+{
+  BodyRequest *request = user_data;
+  Application *app = request->app;
+  GVariant *handle = NULL;
+  GUnixFDList *fd_list = NULL;
+  GBytes *bytes = NULL;
+  GVariant *body = NULL;
+  GVariant *message;
+  GError *error = NULL;
+  gint fd;
+
+  if (!indicator_messages_application_call_get_body_finish (INDICATOR_MESSAGES_APPLICATION (source_object),
+                                                            &handle, &fd_list, result, &error) &&
+      g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    {
+      /* @app is gone or its remote was unset */
+      g_error_free (error);
+      body_request_free (request);
+      return;
+    }
+
+  /* the message was removed or replaced in the meantime */
+  if (g_hash_table_lookup (app->pending_bodies, request->id) != request)
+    {
+      g_clear_error (&error);
+      goto out;
+    }
+
+  if (error == NULL)
+    {
+      fd = g_unix_fd_list_get (fd_list, g_variant_get_handle (handle), &error);
+      if (fd >= 0)
+        {
+          bytes = im_application_list_read_memfd (fd, request->size, &error);
+          close (fd);
+        }
+    }
+
+  if (bytes)
+    {
+      const gchar *data;
+      gsize size;
+      guint64 placeholder_size;
+
+      /* the mapped bytes are used as they are, so they must form a
+       * nul-terminated string without embedded nuls */
+      data = g_bytes_get_data (bytes, &size);
+      if (size == 0 || data[size - 1] != '\0' || !g_utf8_validate (data, size - 1, NULL))
+        g_set_error_literal (&error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "body is not a valid UTF-8 string");
+      else if (parse_body_placeholder (data, &placeholder_size)) /* don't go around in circles */
+        g_set_error_literal (&error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "body is a placeholder");
+      else
+        body = g_variant_new_from_bytes (G_VARIANT_TYPE_STRING, bytes, TRUE);
+
+      g_bytes_unref (bytes);
+    }
+
+  /* rather show the message without its body than not at all */
+  if (body == NULL)
+    {
+      g_warning ("could not fetch the body of message '%s' of application '%s': %s",
+                 request->id, app->id, error->message);
+      g_error_free (error);
+      body = g_variant_new_string ("");
+    }
+
+  message = g_variant_ref_sink (message_with_body (request->message, body));
+  g_hash_table_remove (app->pending_bodies, request->id);
+  im_application_list_message_added (app, message);
+
+  g_variant_unref (message);
+
+out:
+  g_clear_object (&fd_list);
+  if (handle)
+    g_variant_unref (handle);
+  body_request_free (request);
+}
+
+/* Holds back @message until its body, which was too long to be sent
+ * inline, arrived in a sealed memfd */
+static void
+im_application_list_fetch_body (Application    *app,
+                                DecodedMessage *message,
+                                guint64         size)
+{
+  BodyRequest *request;
+
+  request = g_slice_new (BodyRequest);
+  request->app = app;
+  request->id = g_strdup (message->id);
+  request->message = g_variant_ref (message->message);
+  request->size = size;
+
+  /* supersedes the request for an earlier version of the message */
+  g_hash_table_insert (app->pending_bodies, g_strdup (message->id), request);
+  indicator_messages_application_call_get_body (app->proxy, message->id, NULL, app->cancellable,
+                                                im_application_list_body_received, request);
+}
+
+static void
+im_application_list_icons_listed (GObject      *source_object,
+                                  GAsyncResult *result,
+                                  gpointer      user_data)
+{
+  Application *app = user_data;
+  GVariant *icons;
+  GError *error = NULL;
+
+  if (indicator_messages_application_call_list_icons_finish (INDICATOR_MESSAGES_APPLICATION (source_object),
+                                                             &icons, result, &error))
+    {
+      GVariantIter iter;
+      const gchar *ref;
+      GVariant *icon;
+
+      g_variant_iter_init (&iter, icons);
+      while (g_variant_iter_next (&iter, "{&sv}", &ref, &icon))
+        {
+          im_application_list_icon_registered (app, ref, icon);
+          g_variant_unref (icon);
+        }
+
+      g_variant_unref (icons);
+    }
+  else
+    {
+      /* applications using an older libmessaging-menu send all icons
+       * inline */
+      if (!g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD) &&
+          !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        g_warning ("could not fetch the list of icons: %s", error->message);
+
+      g_error_free (error);
+    }
+}
+
+static void
+im_application_list_sources_listed (GObject      *source_object,
+                                    GAsyncResult *result,
+                                    gpointer      user_data)
+{
+  Application *app = user_data;
+  GVariant *sources;
+  GError *error = NULL;
+
+  if (indicator_messages_application_call_list_sources_finish (app->proxy, &sources, result, &error))
+    {
+      GVariantIter iter;
+      GVariant *source;
+      guint i = 0;
+
+      g_variant_iter_init (&iter, sources);
+      while ((source = g_variant_iter_next_value (&iter)))
+        {
+          im_application_list_source_added (app, i++, source);
+          g_variant_unref (source);
+        }
+
+      g_variant_unref (sources);
+    }
+  else
+    {
+      g_warning ("could not fetch the list of sources: %s", error->message);
+      g_error_free (error);
+    }
+}
+
+static GIcon *
+get_symbolic_app_icon (GDesktopAppInfo *info)
+{
+  gchar *x_symbolic_icon;
+  GIcon *icon;
+  const gchar * const *names;
+  gchar *symbolic_name;
+  GIcon *symbolic_icon;
+
+  /* If X-Ubuntu-SymbolicIcon exists, use that. It is always interpreted
+   * as a filename.
+   *
+   * Simply appending -symbolic to the normal icon doesn't work for
+   * icons specified by file name, because the symbolic icon might be in
+   * a different format (symbolic icons tend to be svg and normal icons
+   * png). Also, icons specified by file names don't allow for fallbacks
+   * (without stating the file from this process), and we'd want to fall
+   * back to the normal app icon.
+   *
+   * See lp: #1365408
+   */
+  if ((x_symbolic_icon = g_desktop_app_info_get_string (info, "X-Ubuntu-SymbolicIcon")))
+    {
+      GFile *file;
+
+      file = g_file_new_for_path (x_symbolic_icon);
+      symbolic_icon = g_file_icon_new (file);
+
+      g_object_unref (file);
+      g_free (x_symbolic_icon);
+
+      return symbolic_icon;
+    }
+
+  icon = g_app_info_get_icon (G_APP_INFO (info));
+  if (icon == NULL)
+    return NULL;
+
+  if (!G_IS_THEMED_ICON (icon))
+    return g_object_ref (icon);
+
+  names = g_themed_icon_get_names (G_THEMED_ICON (icon));
+  if (!names || !names[0])
+    return g_object_ref (icon);
+
+  symbolic_name = g_strconcat (names[0], "-symbolic", NULL);
+
+  symbolic_icon = g_themed_icon_new_from_names ((gchar **) names, -1);
+  g_themed_icon_prepend_name (G_THEMED_ICON (symbolic_icon), symbolic_name);
+
+  g_free (symbolic_name);
+
+  return symbolic_icon;
+}
+
+/* Adds @message to @app without updating the root action.  Returns
+ * TRUE if @app started drawing attention because of it. */
+static gboolean
+im_application_list_add_message (Application    *app,
+                                 DecodedMessage *message)
+{
+  GVariant *serialized_icon = NULL;
+  GIcon *app_icon;
+  GVariant *actions = NULL;
+  gboolean attention_changed = FALSE;
+  guint64 body_size;
+
+  if (app->proxy && parse_body_placeholder (g_variant_get_string (message->body, NULL), &body_size))
+    {
+      im_application_list_fetch_body (app, message, body_size);
+      return FALSE;
+    }
+
+  /* a newer version of the message doesn't wait for the old body */
+  if (g_hash_table_size (app->pending_bodies) > 0)
+    g_hash_table_remove (app->pending_bodies, message->id);
+
+  if (g_variant_n_children (message->maybe_serialized_icon) == 1)
+    serialized_icon = application_resolve_icon (app, message->maybe_serialized_icon);
+
+  im_message_actions_add (app->message_actions, message->action_name, message->id, message->draws_attention);
+  application_track_message (app, message->action_name, message->time, message->message);
+
+  {
+    GVariantBuilder actions_builder;
+    GString *prefixed_name;
+    gsize prefix_len;
+    guint i;
+
+    g_variant_builder_init (&actions_builder, G_VARIANT_TYPE ("aa{sv}"));
+
+    /* all sub-actions share the prefix, so build their names in one buffer */
+    prefixed_name = g_string_new (app->id);
+    g_string_append (prefixed_name, ".msg-actions.");
+    g_string_append (prefixed_name, message->action_name);
+    g_string_append_c (prefixed_name, '.');
+    prefix_len = prefixed_name->len;
+
+    for (i = 0; i < message->n_actions; i++)
+      {
+        DecodedAction *decoded = &message->actions[i];
+        const gchar *type = decoded->parameter_type;
+        GVariantBuilder dict_builder;
+
+        im_message_actions_add_sub_action (app->message_actions, message->action_name, decoded->escaped_name, type);
+
+        g_variant_builder_init (&dict_builder, G_VARIANT_TYPE ("a{sv}"));
+
+        g_string_truncate (prefixed_name, prefix_len);
+        g_string_append (prefixed_name, decoded->escaped_name);
+        g_variant_builder_add (&dict_builder, "{sv}", "name", g_variant_new_string (prefixed_name->str));
+
+        if (decoded->label)
+          g_variant_builder_add (&dict_builder, "{sv}", "label", decoded->label);
+
+        if (type)
+          g_variant_builder_add (&dict_builder, "{sv}", "parameter-type", g_variant_new_string (type));
+
+        if (decoded->parameter_hint)
+          g_variant_builder_add (&dict_builder, "{sv}", "parameter-hint", decoded->parameter_hint);
+
+        g_variant_builder_add (&actions_builder, "a{sv}", &dict_builder);
+      }
+
+    actions = g_variant_builder_end (&actions_builder);
+    g_string_free (prefixed_name, TRUE);
+  }
+
+  if (message->draws_attention && !app->draws_attention)
+    {
+      app->draws_attention = TRUE;
+      attention_changed = TRUE;
+    }
+
+  app_icon = get_symbolic_app_icon (app->info);
+
+  g_signal_emit (app->list, signals[MESSAGE_ADDED], 0,
+                 app->id, app_icon, message->action_name, serialized_icon, message->title,
+                 message->subtitle, message->body, actions, message->time, message->draws_attention);
+
+  if (serialized_icon)
+    g_variant_unref (serialized_icon);
+  g_object_unref (app_icon);
+
+  return attention_changed;
 }
 
 static void
 im_application_list_message_added (Application *app,
                                    GVariant    *message)
 {
-  const gchar *id;
-  GVariant *maybe_serialized_icon;
-  const gchar *title;
-  const gchar *subtitle;
-  const gchar *body;
-  gint64 time;
-  GVariantIter *action_iter;
-  gboolean draws_attention;
-  GVariant *serialized_icon = NULL;
-  GSimpleAction *action;
-  GIcon *app_icon;
-  GVariant *actions = NULL;
-  gchar *action_name;
+  DecodedMessage *decoded;
+
+  /* single messages are cheap enough to decode right away */
+  decoded = decoded_message_new_decoded (message);
+
+  /* hold messages back while icons they might refer to are fetched */
+  if (g_hash_table_size (app->pending_icons) > 0)
+    {
+      g_queue_push_tail (&app->pending_messages, decoded);
+      return;
+    }
+
+  if (im_application_list_add_message (app, decoded))
+    im_application_list_update_root_action (app->list);
+
+  im_application_list_evict_messages (app);
+
+  decoded_message_unref (decoded);
+}
+
+/* Adds all messages in @messages (of type a(savsssxaa{sv}b)), with one
+ * batch of action changes and one update of the root action. Messages
+ * of connected applications are decoded on a worker thread and added
+ * once that is done. */
+static void
+im_application_list_messages_added (Application *app,
+                                    GVariant    *messages)
+{
+  GVariantIter iter;
+  GVariant *message;
+  gboolean attention_changed = FALSE;
+
+  if (app->cancellable || g_hash_table_size (app->pending_icons) > 0)
+    {
+      im_application_list_queue_messages (app, messages, FALSE);
+      return;
+    }
+
+  g_action_muxer_begin_batch (app->muxer);
+
+  g_variant_iter_init (&iter, messages);
+  while ((message = g_variant_iter_next_value (&iter)))
+    {
+      DecodedMessage *decoded;
+
+      decoded = decoded_message_new_decoded (message);
+      attention_changed |= im_application_list_add_message (app, decoded);
+
+      decoded_message_unref (decoded);
+      g_variant_unref (message);
+    }
+
+  g_action_muxer_end_batch (app->muxer);
+
+  if (attention_changed)
+    im_application_list_update_root_action (app->list);
+
+  im_application_list_evict_messages (app);
+}
+
+/* Returns TRUE if @message is older than all messages of @app and
+ * would be evicted right after being added. */
+static gboolean
+application_message_beyond_cap (Application    *app,
+                                DecodedMessage *message)
+{
+  ImMessageStore *store = app->list->messages;
+  guint max_messages = app->list->max_messages;
+  gint oldest;
+
+  if (max_messages == 0 || im_message_store_get_n_app_messages (store, app->id) < max_messages)
+    return FALSE;
+
+  oldest = im_message_store_get_oldest_app_row (store, app->id);
+
+  return message->time < im_message_store_get_time (store, oldest);
+}
+
+static gboolean
+im_application_list_ingest_messages (gpointer user_data)
+{
+  Application *app = user_data;
+  gint64 deadline;
+  gboolean attention_changed = FALSE;
+  DecodedMessage *message;
+
+  /* resumed by im_application_list_icon_received() */
+  if (g_hash_table_size (app->pending_icons) > 0)
+    {
+      app->ingest_id = 0;
+      return G_SOURCE_REMOVE;
+    }
+
+  deadline = g_get_monotonic_time () + MESSAGES_INGEST_TIME_SLICE;
+
+  g_action_muxer_begin_batch (app->muxer);
+
+  /* messages are added in order, so stop at the first one that is
+   * still being decoded */
+  while (g_get_monotonic_time () < deadline &&
+         (message = g_queue_peek_head (&app->pending_messages)) &&
+         message->decoded)
+    {
+      g_queue_pop_head (&app->pending_messages);
+
+      /* pages might overlap when messages were added in the meantime.
+       * Everything else replaces known messages, like it does when it
+       * is added right away. */
+      if (!message->listed ||
+          (!im_message_actions_contains (app->message_actions, message->action_name) &&
+           !application_message_beyond_cap (app, message)))
+        attention_changed |= im_application_list_add_message (app, message);
+
+      decoded_message_unref (message);
+    }
+
+  g_action_muxer_end_batch (app->muxer);
+
+  if (attention_changed)
+    im_application_list_update_root_action (app->list);
+
+  im_application_list_evict_messages (app);
+
+  /* resumed by im_application_list_messages_decoded() */
+  message = g_queue_peek_head (&app->pending_messages);
+  if (message == NULL || !message->decoded)
+    {
+      app->ingest_id = 0;
+      return G_SOURCE_REMOVE;
+    }
+
+  return G_SOURCE_CONTINUE;
+}
+
+/* Takes a token from the bucket of @app. Returns FALSE if @app sends
+ * signals faster than list->signal_rate allows. */
+static gboolean
+application_take_token (Application *app)
+{
+  ImApplicationList *list = app->list;
+  gint64 now;
+
+  if (list->signal_rate == 0)
+    return TRUE;
+
+  now = g_get_monotonic_time ();
+  app->tokens += (now - app->tokens_updated) * (gdouble) list->signal_rate / G_USEC_PER_SEC;
+  app->tokens = MIN (app->tokens, MAX (list->signal_burst, 1));
+  app->tokens_updated = now;
+
+  if (app->tokens < 1.0)
+    {
+      app->throttled++;
+      return FALSE;
+    }
+
+  app->tokens -= 1.0;
+  return TRUE;
+}
+
+/* Applies what was throttled since the last time: the last change of
+ * every source, and all messages in one batch. */
+static gboolean
+im_application_list_drain_throttled (gpointer user_data)
+{
+  Application *app = user_data;
+  GHashTableIter iter;
+  GVariant *source;
+
+  app->drain_id = 0;
+
+  g_hash_table_iter_init (&iter, app->deferred_sources);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &source))
+    im_application_list_source_changed (app, source);
+  g_hash_table_remove_all (app->deferred_sources);
+
+  if (app->ingest_id == 0 && !g_queue_is_empty (&app->pending_messages))
+    app->ingest_id = g_idle_add (im_application_list_ingest_messages, app);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+im_application_list_schedule_drain (Application *app)
+{
+  if (app->drain_id == 0)
+    app->drain_id = g_timeout_add (THROTTLE_DRAIN_INTERVAL, im_application_list_drain_throttled, app);
+}
+
+static void
+im_application_list_source_changed_throttled (Application *app,
+                                              GVariant    *source)
+{
+  const gchar *id;
+
+  g_variant_get_child (source, 0, "&s", &id);
+
+  if (application_take_token (app))
+    {
+      /* @source is newer than a change that is still deferred */
+      g_hash_table_remove (app->deferred_sources, id);
+      im_application_list_source_changed (app, source);
+    }
+  else
+    {
+      g_hash_table_insert (app->deferred_sources, g_strdup (id), g_variant_ref (source));
+      im_application_list_schedule_drain (app);
+    }
+}
+
+static void
+im_application_list_message_added_throttled (Application *app,
+                                             GVariant    *message)
+{
+  if (application_take_token (app))
+    {
+      im_application_list_message_added (app, message);
+    }
+  else
+    {
+      /* added with all others that arrive until the next drain */
+      g_queue_push_tail (&app->pending_messages, decoded_message_new_decoded (message));
+      im_application_list_schedule_drain (app);
+    }
+}
+
+static void
+im_application_list_decode_in_thread (GTask        *task,
+                                      gpointer      source_object,
+                                      gpointer      task_data,
+                                      GCancellable *cancellable)
+{
+  GPtrArray *batch = task_data;
+  guint i;
+
+  for (i = 0; i < batch->len; i++)
+    {
+      if (g_cancellable_is_cancelled (cancellable))
+        break;
+
+      decoded_message_decode (g_ptr_array_index (batch, i));
+    }
+
+  g_task_return_boolean (task, TRUE);
+}
+
+static void
+im_application_list_messages_decoded (GObject      *source_object,
+                                      GAsyncResult *result,
+                                      gpointer      user_data)
+{
+  Application *app = user_data;
+  GPtrArray *batch;
+  GError *error = NULL;
+  guint i;
 
-  g_variant_get (message, "(&s@av&s&s&sxaa{sv}b)",
-                 &id, &maybe_serialized_icon, &title, &subtitle, &body, &time, &action_iter, &draws_attention);
+  /* the task is cancelled together with app->cancellable, which
+   * happens when @app is freed or disconnected */
+  if (!g_task_propagate_boolean (G_TASK (result), &error))
+    {
+      g_error_free (error);
+      return;
+    }
 
-  if (g_variant_n_children (maybe_serialized_icon) == 1)
-    g_variant_get_child (maybe_serialized_icon, 0, "v", &serialized_icon);
+  batch = g_task_get_task_data (G_TASK (result));
+  for (i = 0; i < batch->len; i++)
+    {
+      DecodedMessage *decoded = g_ptr_array_index (batch, i);
+      decoded->decoded = TRUE;
+    }
 
-  action_name = escape_action_name (id);
-  action = g_simple_action_new (action_name, G_VARIANT_TYPE_BOOLEAN);
-  g_object_set_qdata(G_OBJECT(action), message_action_draws_attention_quark(), GINT_TO_POINTER(draws_attention));
-  g_signal_connect (action, "activate", G_CALLBACK (im_application_list_message_activated), app);
-  g_action_map_add_action (G_ACTION_MAP(app->message_actions), G_ACTION (action));
+  if (app->ingest_id == 0 && !g_queue_is_empty (&app->pending_messages))
+    app->ingest_id = g_idle_add (im_application_list_ingest_messages, app);
+}
 
-  {
-    GVariant *entry;
-    GSimpleActionGroup *action_group;
-    GVariantBuilder actions_builder;
+/* Queues all messages in @messages to be added in time-sliced chunks
+ * while the main loop is idle. Messages of connected applications are
+ * decoded on a worker thread first. @listed messages come from a
+ * listing, and are skipped if they are known already; all others
+ * replace known messages with the same id. */
+static void
+im_application_list_queue_messages (Application *app,
+                                    GVariant    *messages,
+                                    gboolean     listed)
+{
+  GVariantIter iter;
+  GVariant *message;
+  GPtrArray *batch;
+  guint i;
 
-    g_variant_builder_init (&actions_builder, G_VARIANT_TYPE ("aa{sv}"));
-    action_group = g_simple_action_group_new ();
+  batch = g_ptr_array_new_with_free_func (decoded_message_unref);
 
-    while ((entry = g_variant_iter_next_value (action_iter)))
-      {
-        const gchar *name;
-        GSimpleAction *action;
-        GVariant *label;
-        const gchar *type = NULL;
-        GVariant *hint;
-        GVariantBuilder dict_builder;
-        gchar *prefixed_name;
-        gchar *escaped_name;
+  g_variant_iter_init (&iter, messages);
+  while ((message = g_variant_iter_next_value (&iter)))
+    {
+      DecodedMessage *decoded;
 
-        if (!g_variant_lookup (entry, "name", "&s", &name))
-          {
-            g_warning ("action dictionary for message '%s' is missing 'name' key", id);
-            continue;
-          }
+      decoded = decoded_message_new (message);
+      decoded->listed = listed;
+      g_queue_push_tail (&app->pending_messages, decoded);
+      g_ptr_array_add (batch, decoded_message_ref (decoded));
 
-        label = g_variant_lookup_value (entry, "label", G_VARIANT_TYPE_STRING);
-        g_variant_lookup (entry, "parameter-type", "&g", &type);
-        hint = g_variant_lookup_value (entry, "parameter-hint", NULL);
+      g_variant_unref (message);
+    }
 
-        escaped_name = escape_action_name (name);
-        action = g_simple_action_new (escaped_name, type ? G_VARIANT_TYPE (type) : NULL);
-        g_object_set_data_full (G_OBJECT (action), "message", g_strdup (id), g_free);
-        g_signal_connect (action, "activate", G_CALLBACK (im_application_list_sub_message_activated), app);
-        g_action_map_add_action (G_ACTION_MAP(action_group), G_ACTION (action));
+  if (batch->len > 0 && app->cancellable)
+    {
+      GTask *task;
 
-        g_variant_builder_init (&dict_builder, G_VARIANT_TYPE ("a{sv}"));
+      task = g_task_new (NULL, app->cancellable, im_application_list_messages_decoded, app);
+      g_task_set_task_data (task, batch, (GDestroyNotify) g_ptr_array_unref);
+      g_task_run_in_thread (task, im_application_list_decode_in_thread);
+      g_object_unref (task);
+      return;
+    }
 
-        prefixed_name = g_strjoin (".", app->id, "msg-actions", action_name, escaped_name, NULL);
-        g_variant_builder_add (&dict_builder, "{sv}", "name", g_variant_new_string (prefixed_name));
+  for (i = 0; i < batch->len; i++)
+    {
+      DecodedMessage *decoded = g_ptr_array_index (batch, i);
 
-        if (label)
-          {
-            g_variant_builder_add (&dict_builder, "{sv}", "label", label);
-            g_variant_unref (label);
-          }
+      decoded_message_decode (decoded);
+      decoded->decoded = TRUE;
+    }
+  g_ptr_array_unref (batch);
 
-        if (type)
-          g_variant_builder_add (&dict_builder, "{sv}", "parameter-type", g_variant_new_string (type));
+  if (app->ingest_id == 0 && !g_queue_is_empty (&app->pending_messages))
+    app->ingest_id = g_idle_add (im_application_list_ingest_messages, app);
+}
 
-        if (hint)
-          {
-            g_variant_builder_add (&dict_builder, "{sv}", "parameter-hint", hint);
-            g_variant_unref (hint);
-          }
+static void
+im_application_list_messages_listed (GObject      *source_object,
+                                     GAsyncResult *result,
+                                     gpointer      user_data)
+{
+  Application *app = user_data;
+  GVariant *messages;
+  GError *error = NULL;
 
-        g_variant_builder_add (&actions_builder, "a{sv}", &dict_builder);
+  if (indicator_messages_application_call_list_messages_finish (INDICATOR_MESSAGES_APPLICATION (source_object),
+                                                                &messages, result, &error))
+    {
+      im_application_list_queue_messages (app, messages, TRUE);
+      g_variant_unref (messages);
+    }
+  else
+    {
+      if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        g_warning ("could not fetch the list of messages: %s", error->message);
+      g_error_free (error);
+    }
+}
 
-        g_object_unref (action);
-        g_variant_unref (entry);
-        g_free (prefixed_name);
-        g_free (escaped_name);
-      }
+typedef struct
+{
+  Application *app;
+  guint serial;     /* app->page_serial when the page was requested */
+} PageRequest;
 
-    g_action_muxer_insert (app->message_sub_actions, action_name, G_ACTION_GROUP (action_group));
-    actions = g_variant_builder_end (&actions_builder);
+static void im_application_list_fetch_messages (Application *app);
 
-    g_object_unref (action_group);
-  }
+static void
+im_application_list_messages_page_received (GObject      *source_object,
+                                            GAsyncResult *result,
+                                            gpointer      user_data)
+{
+  PageRequest *request = user_data;
+  Application *app = request->app;
+  guint serial = request->serial;
+  GVariant *messages;
+  GError *error = NULL;
+  gsize n_messages;
+
+  g_slice_free (PageRequest, request);
 
-  if (draws_attention && !app->draws_attention)
+  if (!indicator_messages_application_call_list_messages_before_finish (INDICATOR_MESSAGES_APPLICATION (source_object),
+                                                                        &messages, result, &error))
     {
-      app->draws_attention = TRUE;
-      im_application_list_update_root_action (app->list);
+      /* applications using an older libmessaging-menu only implement
+       * ListMessages */
+      if (g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD))
+        indicator_messages_application_call_list_messages (app->proxy, app->cancellable,
+                                                           im_application_list_messages_listed, app);
+      else if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        g_warning ("could not fetch the list of messages: %s", error->message);
+
+      g_error_free (error);
+      return;
     }
 
-  app_icon = get_symbolic_app_icon (app->info);
+  /* paging started over or the messages were cleared in the meantime */
+  if (serial != app->page_serial)
+    {
+      g_variant_unref (messages);
+      return;
+    }
 
-  g_signal_emit (app->list, signals[MESSAGE_ADDED], 0,
-                 app->id, app_icon, action_name, serialized_icon, title,
-                 subtitle, body, actions, time, draws_attention);
+  /* the next page starts after the oldest message of this one, which
+   * is still the right place if messages were removed in the meantime */
+  n_messages = g_variant_n_children (messages);
+  app->n_fetched += n_messages;
+  if (n_messages == MESSAGES_PAGE_SIZE)
+    {
+      GVariant *last;
 
-  g_free (action_name);
-  g_variant_iter_free (action_iter);
-  g_object_unref (action);
-  if (serialized_icon)
-    g_variant_unref (serialized_icon);
-  g_variant_unref (maybe_serialized_icon);
-  g_object_unref (app_icon);
+      last = g_variant_get_child_value (messages, n_messages - 1);
+      g_free (app->page_id);
+      g_variant_get_child (last, 0, "s", &app->page_id);
+      g_variant_get_child (last, 5, "x", &app->page_time);
+      g_variant_unref (last);
+    }
+
+  im_application_list_queue_messages (app, messages, TRUE);
+  g_variant_unref (messages);
+
+  /* older messages would only be evicted again */
+  if (n_messages == MESSAGES_PAGE_SIZE &&
+      (app->list->max_messages == 0 || app->n_fetched < app->list->max_messages))
+    im_application_list_fetch_messages (app);
 }
 
 static void
-im_application_list_messages_listed (GObject      *source_object,
-                                     GAsyncResult *result,
-                                     gpointer      user_data)
+im_application_list_fetch_messages (Application *app)
+{
+  guint limit = MESSAGES_PAGE_SIZE;
+  PageRequest *request;
+
+  if (app->list->max_messages > 0)
+    limit = MIN (limit, app->list->max_messages - app->n_fetched);
+
+  request = g_slice_new (PageRequest);
+  request->app = app;
+  request->serial = app->page_serial;
+
+  indicator_messages_application_call_list_messages_before (app->proxy,
+                                                            app->page_id ? app->page_time : G_MAXINT64,
+                                                            app->page_id ? app->page_id : "",
+                                                            limit,
+                                                            app->cancellable,
+                                                            im_application_list_messages_page_received,
+                                                            request);
+}
+
+/* Lists all sources and messages of @app */
+static void
+im_application_list_resync (Application *app)
+{
+  indicator_messages_application_call_list_sources (app->proxy, app->cancellable,
+                                                    im_application_list_sources_listed, app);
+  application_reset_paging (app);
+  im_application_list_fetch_messages (app);
+}
+
+static void
+im_application_list_remove_all_sources (Application *app)
+{
+  gchar **action_names;
+  gchar **it;
+
+  action_names = g_action_group_list_actions (G_ACTION_GROUP (app->source_actions));
+  for (it = action_names; *it; it++)
+    im_application_list_source_removed_action (app, *it);
+
+  g_strfreev (action_names);
+}
+
+/* Removes all sources and messages of @app */
+static void
+im_application_list_clear_state (Application *app)
+{
+  im_application_list_remove_all_sources (app);
+  im_application_list_remove_all_messages (app);
+
+  app->generation = 0;
+  app->restored = FALSE;
+}
+
+/* Applies the changes @app made since app->generation, which is much
+ * cheaper than listing everything when most of it is known already. */
+static void
+im_application_list_changes_received (GObject      *source_object,
+                                      GAsyncResult *result,
+                                      gpointer      user_data)
 {
   Application *app = user_data;
+  guint64 generation;
+  gboolean complete;
+  gboolean sources_changed;
+  GVariant *sources;
   GVariant *messages;
+  gchar **removed;
   GError *error = NULL;
 
-  if (indicator_messages_application_call_list_messages_finish (app->proxy, &messages, result, &error))
+  if (!indicator_messages_application_call_get_changes_since_finish (INDICATOR_MESSAGES_APPLICATION (source_object),
+                                                                     &generation, &complete, &sources_changed,
+                                                                     &sources, &messages, &removed,
+                                                                     result, &error))
+    {
+      /* applications using an older libmessaging-menu don't keep a
+       * change log */
+      if (g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD))
+        {
+          im_application_list_clear_state (app);
+          im_application_list_resync (app);
+        }
+      else if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        g_warning ("could not fetch changes of '%s': %s", app->id, error->message);
+
+      g_error_free (error);
+      return;
+    }
+
+  if (complete)
     {
       GVariantIter iter;
-      GVariant *message;
+      GVariant *value;
+      GPtrArray *stale;
+      gchar **it;
+
+      if (sources_changed)
+        {
+          guint i = 0;
+
+          im_application_list_remove_all_sources (app);
+
+          g_variant_iter_init (&iter, sources);
+          while ((value = g_variant_iter_next_value (&iter)))
+            {
+              im_application_list_source_added (app, i++, value);
+              g_variant_unref (value);
+            }
+        }
+
+      /* changed messages are replaced, so remove the old ones along
+       * with the ones that are gone */
+      stale = g_ptr_array_new ();
+      for (it = removed; *it; it++)
+        g_ptr_array_add (stale, *it);
 
       g_variant_iter_init (&iter, messages);
-      while ((message = g_variant_iter_next_value (&iter)))
+      while ((value = g_variant_iter_next_value (&iter)))
         {
-          im_application_list_message_added (app, message);
-          g_variant_unref (message);
+          const gchar *id;
+          gchar *action_name;
+
+          /* @id points into @messages, which outlives @stale */
+          g_variant_get_child (value, 0, "&s", &id);
+          action_name = escape_action_name (id);
+          if (im_message_actions_contains (app->message_actions, action_name))
+            g_ptr_array_add (stale, (gpointer) id);
+
+          g_free (action_name);
+          g_variant_unref (value);
         }
 
-      g_variant_unref (messages);
+      if (stale->len > 0)
+        {
+          g_ptr_array_add (stale, NULL);
+          im_application_list_messages_removed (app, (const gchar * const *) stale->pdata);
+        }
+      g_ptr_array_free (stale, TRUE);
+
+      im_application_list_queue_messages (app, messages, FALSE);
     }
   else
     {
-      g_warning ("could not fetch the list of messages: %s", error->message);
-      g_error_free (error);
+      /* state restored from a snapshot is from an earlier instance */
+      im_application_list_clear_state (app);
+      im_application_list_resync (app);
     }
+
+  app->generation = generation;
+  app->restored = FALSE;
+  im_application_list_schedule_snapshot (app->list);
+
+  g_variant_unref (sources);
+  g_variant_unref (messages);
+  g_strfreev (removed);
 }
 
 static void
@@ -1228,17 +3002,42 @@ im_application_list_unset_remote (Application *app)
     }
   g_clear_object (&app->proxy);
 
+  application_clear_pending_messages (app);
+  application_reset_paging (app);
+  app->generation = 0;
+
+  /* menus drop the items of running applications on app-stopped, but
+   * need to be told about messages that were restored from a snapshot */
+  if (!was_running)
+    im_application_list_remove_all_messages (app);
+
+  g_hash_table_remove_all (app->icons);
+  g_hash_table_remove_all (app->pending_icons);
+  g_sequence_remove_range (g_sequence_get_begin_iter (app->sources),
+                           g_sequence_get_end_iter (app->sources));
+  app->restored = FALSE;
+
+  g_hash_table_remove_all (app->deferred_sources);
+  if (app->drain_id)
+    {
+      g_source_remove (app->drain_id);
+      app->drain_id = 0;
+    }
+  im_application_list_schedule_snapshot (app->list);
+
   /* clear actions by creating a new action group and overriding it in
-   * the muxer */
+   * the muxer. Do it in one batch, so that all removed actions are
+   * announced together instead of one by one. */
   g_object_unref (app->source_actions);
   g_object_unref (app->message_actions);
-  g_object_unref (app->message_sub_actions);
   app->source_actions = g_simple_action_group_new ();
-  app->message_actions = g_simple_action_group_new ();
-  app->message_sub_actions = g_action_muxer_new ();
+  app->message_actions = im_message_actions_new ();
+  g_signal_connect (app->message_actions, "activate", G_CALLBACK (im_application_list_message_activated), app);
+  g_action_muxer_begin_batch (app->muxer);
   g_action_muxer_insert (app->muxer, "src", G_ACTION_GROUP (app->source_actions));
   g_action_muxer_insert (app->muxer, "msg", G_ACTION_GROUP (app->message_actions));
-  g_action_muxer_insert (app->muxer, "msg-actions", G_ACTION_GROUP (app->message_sub_actions));
+  g_action_muxer_insert (app->muxer, "msg-actions", im_message_actions_get_sub_actions (app->message_actions));
+  g_action_muxer_end_batch (app->muxer);
 
   app->draws_attention = FALSE;
   im_application_list_update_root_action (app->list);
@@ -1247,6 +3046,8 @@ im_application_list_unset_remote (Application *app)
 
   if (was_running)
     g_signal_emit (app->list, signals[APP_STOPPED], 0, app->id);
+
+  im_message_store_remove_app (app->list->messages, app->id);
 }
 
 static void
@@ -1276,16 +3077,22 @@ im_application_list_proxy_created (GObject      *source_object,
       return;
     }
 
-  indicator_messages_application_call_list_sources (app->proxy, app->cancellable,
-                                                    im_application_list_sources_listed, app);
-  indicator_messages_application_call_list_messages (app->proxy, app->cancellable,
-                                                     im_application_list_messages_listed, app);
+  /* icons are listed first, so that the table is complete by the time
+   * sources and messages referring to it arrive */
+  indicator_messages_application_call_list_icons (app->proxy, app->cancellable,
+                                                  im_application_list_icons_listed, app);
+  indicator_messages_application_call_get_changes_since (app->proxy, app->generation, app->cancellable,
+                                                         im_application_list_changes_received, app);
 
+  g_signal_connect_swapped (app->proxy, "icon-registered", G_CALLBACK (im_application_list_icon_registered), app);
+  g_signal_connect_swapped (app->proxy, "icon-unregistered", G_CALLBACK (im_application_list_icon_unregistered), app);
   g_signal_connect_swapped (app->proxy, "source-added", G_CALLBACK (im_application_list_source_added), app);
-  g_signal_connect_swapped (app->proxy, "source-changed", G_CALLBACK (im_application_list_source_changed), app);
+  g_signal_connect_swapped (app->proxy, "source-changed", G_CALLBACK (im_application_list_source_changed_throttled), app);
   g_signal_connect_swapped (app->proxy, "source-removed", G_CALLBACK (im_application_list_source_removed), app);
-  g_signal_connect_swapped (app->proxy, "message-added", G_CALLBACK (im_application_list_message_added), app);
+  g_signal_connect_swapped (app->proxy, "message-added", G_CALLBACK (im_application_list_message_added_throttled), app);
+  g_signal_connect_swapped (app->proxy, "messages-added", G_CALLBACK (im_application_list_messages_added), app);
   g_signal_connect_swapped (app->proxy, "message-removed", G_CALLBACK (im_application_list_message_removed), app);
+  g_signal_connect_swapped (app->proxy, "messages-removed", G_CALLBACK (im_application_list_messages_removed), app);
 
   g_action_group_change_action_state (G_ACTION_GROUP (app->muxer), "launch", g_variant_new_boolean (TRUE));
 
@@ -1350,6 +3157,21 @@ im_application_list_get_action_group (ImApplicationList *list)
   return G_ACTION_GROUP (list->muxer);
 }
 
+/*
+ * Returns the store that holds the messages of all applications, newest
+ * first. It is updated before message-added is emitted and after
+ * message-removed, messages-removed, app-stopped and remove-all, so
+ * that handlers of these signals can look up the messages they are
+ * about.
+ */
+ImMessageStore *
+im_application_list_get_message_store (ImApplicationList *list)
+{
+  g_return_val_if_fail (IM_IS_APPLICATION_LIST (list), NULL);
+
+  return list->messages;
+}
+
 GList *
 im_application_list_get_applications (ImApplicationList *list)
 {
@@ -1444,3 +3266,199 @@ im_application_list_set_status (ImApplicationList * list, const gchar * id, cons
 	return;
 }
 
+/* Limits the number of messages per application to @max_messages (0
+ * for no limit). Applications exceeding it lose their oldest messages
+ * right away. */
+void
+im_application_list_set_max_messages (ImApplicationList *list,
+                                      guint              max_messages)
+{
+  GHashTableIter iter;
+  Application *app;
+
+  g_return_if_fail (IM_IS_APPLICATION_LIST (list));
+
+  list->max_messages = max_messages;
+
+  g_hash_table_iter_init (&iter, list->applications);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &app))
+    im_application_list_evict_messages (app);
+}
+
+/* Drops state restored from the snapshot for applications that didn't
+ * come back */
+static gboolean
+im_application_list_expire_snapshot (gpointer user_data)
+{
+  ImApplicationList *list = user_data;
+  GHashTableIter iter;
+  Application *app;
+
+  list->snapshot_expiry_id = 0;
+  g_clear_pointer (&list->snapshot, g_variant_unref);
+
+  g_hash_table_iter_init (&iter, list->applications);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &app))
+    {
+      /* applications that are connecting reconcile on their own */
+      if (app->restored && app->cancellable == NULL)
+        {
+          im_application_list_clear_state (app);
+          g_hash_table_remove_all (app->icons);
+        }
+    }
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Restores sources and messages of @app from list->snapshot, if it
+ * is in there */
+static void
+im_application_list_restore_app (ImApplicationList *list,
+                                 Application       *app)
+{
+  GVariantIter iter;
+  const gchar *id;
+  guint64 generation;
+  GVariant *sources;
+  GVariant *messages;
+  GVariant *icons;
+
+  if (list->snapshot == NULL || app->proxy || app->cancellable)
+    return;
+
+  g_variant_iter_init (&iter, list->snapshot);
+  while (g_variant_iter_next (&iter, "(&st@a(ssavuxsb)@a(savsssxaa{sv}b)@a{sv})",
+                              &id, &generation, &sources, &messages, &icons))
+    {
+      if (g_str_equal (id, app->id))
+        {
+          GVariantIter it;
+          const gchar *ref;
+          GVariant *value;
+          guint i = 0;
+
+          app->generation = generation;
+          app->restored = TRUE;
+
+          g_variant_iter_init (&it, icons);
+          while (g_variant_iter_next (&it, "{&sv}", &ref, &value))
+            g_hash_table_insert (app->icons, g_strdup (ref), value);
+
+          g_variant_iter_init (&it, sources);
+          while ((value = g_variant_iter_next_value (&it)))
+            {
+              im_application_list_source_added (app, i++, value);
+              g_variant_unref (value);
+            }
+
+          im_application_list_messages_added (app, messages);
+        }
+
+      g_variant_unref (sources);
+      g_variant_unref (messages);
+      g_variant_unref (icons);
+    }
+}
+
+/*
+ * Restores sources and messages of applications from the snapshot at
+ * @path, so that they can be shown right away, and keeps the snapshot
+ * up to date from now on. Applications that are added later (for
+ * example, with im_application_list_add_async()) are restored when
+ * they are added. Applications reconcile their restored state with
+ * GetChangesSince() when they connect. Snapshots written with a
+ * different SNAPSHOT_VERSION are ignored.
+ */
+void
+im_application_list_load_snapshot (ImApplicationList *list,
+                                   const gchar       *path)
+{
+  GMappedFile *mapped;
+  GBytes *bytes;
+  GVariant *file;
+  guint32 version;
+  GHashTableIter iter;
+  Application *app;
+  GError *error = NULL;
+
+  g_return_if_fail (IM_IS_APPLICATION_LIST (list));
+  g_return_if_fail (path != NULL);
+
+  g_free (list->snapshot_path);
+  list->snapshot_path = g_strdup (path);
+
+  mapped = g_mapped_file_new (path, FALSE, &error);
+  if (mapped == NULL)
+    {
+      if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        g_warning ("unable to load snapshot: %s", error->message);
+      g_error_free (error);
+      return;
+    }
+
+  /* restored messages and icons point into the mapping */
+  bytes = g_mapped_file_get_bytes (mapped);
+  file = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE (SNAPSHOT_FILE_TYPE), bytes, FALSE));
+
+  /* it is overwritten with the current layout on the next change */
+  g_variant_get_child (file, 0, "u", &version);
+  if (version != SNAPSHOT_VERSION)
+    {
+      g_debug ("ignoring snapshot of version %u", version);
+      g_variant_unref (file);
+      g_bytes_unref (bytes);
+      g_mapped_file_unref (mapped);
+      return;
+    }
+
+  g_clear_pointer (&list->snapshot, g_variant_unref);
+  list->snapshot = g_variant_get_child_value (file, 1);
+  g_variant_unref (file);
+
+  g_hash_table_iter_init (&iter, list->applications);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &app))
+    im_application_list_restore_app (list, app);
+
+  if (list->snapshot_expiry_id == 0)
+    list->snapshot_expiry_id = g_timeout_add_seconds (SNAPSHOT_GRACE_PERIOD,
+                                                      im_application_list_expire_snapshot, list);
+
+  g_bytes_unref (bytes);
+  g_mapped_file_unref (mapped);
+}
+
+/* Limits the rate of SourceChanged and MessageAdded signals of each
+ * application to @rate per second (0 for no limit), with bursts of up
+ * to @burst signals. Throttled signals are coalesced and applied a bit
+ * later. */
+void
+im_application_list_set_flow_control (ImApplicationList *list,
+                                      guint              rate,
+                                      guint              burst)
+{
+  g_return_if_fail (IM_IS_APPLICATION_LIST (list));
+
+  list->signal_rate = rate;
+  list->signal_burst = burst;
+}
+
+/* Returns: a floating #GVariant of type a{st}, mapping application ids
+ * to the number of signals that were throttled */
+GVariant *
+im_application_list_get_throttled_counts (ImApplicationList *list)
+{
+  GVariantBuilder builder;
+  GHashTableIter iter;
+  Application *app;
+
+  g_return_val_if_fail (IM_IS_APPLICATION_LIST (list), NULL);
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{st}"));
+
+  g_hash_table_iter_init (&iter, list->applications);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &app))
+    g_variant_builder_add (&builder, "{st}", app->id, app->throttled);
+
+  return g_variant_builder_end (&builder);
+}
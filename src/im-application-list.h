@@ -23,6 +23,8 @@
 #include <gio/gio.h>
 #include <gio/gdesktopappinfo.h>
 
+#include "im-message-store.h"
+
 #define IM_TYPE_APPLICATION_LIST            (im_application_list_get_type ())
 #define IM_APPLICATION_LIST(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), IM_TYPE_APPLICATION_LIST, ImApplicationList))
 #define IM_APPLICATION_LIST_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass), IM_TYPE_APPLICATION_LIST, ImApplicationListClass))
@@ -39,6 +41,9 @@ ImApplicationList *     im_application_list_new                 (void);
 gboolean                im_application_list_add                 (ImApplicationList *list,
                                                                  const gchar       *desktop_id);
 
+void                    im_application_list_add_async           (ImApplicationList *list,
+                                                                 const gchar       *desktop_id);
+
 void                    im_application_list_remove              (ImApplicationList *list,
                                                                  const gchar       *id);
 
@@ -50,6 +55,8 @@ void                    im_application_list_set_remote          (ImApplicationLi
 
 GActionGroup *          im_application_list_get_action_group    (ImApplicationList *list);
 
+ImMessageStore *        im_application_list_get_message_store   (ImApplicationList *list);
+
 GList *                 im_application_list_get_applications    (ImApplicationList *list);
 
 GDesktopAppInfo *       im_application_list_get_application     (ImApplicationList *list,
@@ -59,4 +66,16 @@ void                    im_application_list_set_status          (ImApplicationLi
                                                                  const gchar       *id,
                                                                  const gchar       *status);
 
+void                    im_application_list_set_max_messages    (ImApplicationList *list,
+                                                                 guint              max_messages);
+
+void                    im_application_list_load_snapshot       (ImApplicationList *list,
+                                                                 const gchar       *path);
+
+void                    im_application_list_set_flow_control    (ImApplicationList *list,
+                                                                 guint              rate,
+                                                                 guint              burst);
+
+GVariant *              im_application_list_get_throttled_counts (ImApplicationList *list);
+
 #endif
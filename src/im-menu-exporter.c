@@ -0,0 +1,790 @@
+/*
+ * Copyright 2013 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "im-menu-exporter.h"
+
+/*
+ * Exports a #GMenuModel on the org.gtk.Menus interface, like
+ * g_dbus_connection_export_menu_model().
+ *
+ * Menus are organized in groups the same way GMenuExporter does it:
+ * sections live in the group of the menu that links to them, each
+ * submenu starts a new group.  Clients subscribe to whole groups with
+ * Start and End, and only menus in subscribed groups are watched.
+ *
+ * Instead of sending one Changed signal per ::items-changed, the
+ * changes to a menu are merged into a sorted list of splices, which is
+ * sent in a single Changed signal once the main loop is idle.  Changes
+ * that touch or overlap are folded into one splice, so that appending
+ * many items one by one results in a single splice.  The items in a
+ * splice are only serialized when the signal is sent.
+ *
+ * Use g_dbus_connection_unregister_object() with the returned id to
+ * stop exporting the menu.
+ */
+
+typedef struct _ImMenuExporter      ImMenuExporter;
+typedef struct _ImMenuExporterGroup ImMenuExporterGroup;
+typedef struct _ImMenuExporterMenu  ImMenuExporterMenu;
+
+typedef struct
+{
+  gchar *name;
+  ImMenuExporterMenu *menu;
+} ImMenuExporterLink;
+
+/* Replaces @removed items of the last state that was sent with the
+ * items [position, position + added) of the current menu. */
+typedef struct
+{
+  guint position;
+  guint removed;
+  guint added;
+} ImMenuExporterSplice;
+
+struct _ImMenuExporterMenu
+{
+  ImMenuExporterGroup *group;
+  guint id;
+  GMenuModel *model;
+  gulong handler_id;        /* non-zero while the group is subscribed */
+  GSequence *item_links;    /* GSList of ImMenuExporterLink per item */
+  GArray *splices;          /* sorted, non-overlapping */
+  gboolean is_new;          /* contents haven't been sent at all */
+  gboolean dirty;           /* in exporter->dirty */
+};
+
+struct _ImMenuExporterGroup
+{
+  ImMenuExporter *exporter;
+  guint id;
+  GHashTable *menus;        /* id -> ImMenuExporterMenu */
+  guint next_menu_id;
+  guint subscribed;
+};
+
+typedef struct
+{
+  ImMenuExporter *exporter;
+  gchar *name;
+  guint watch_id;
+  GHashTable *groups;       /* group id -> number of subscriptions */
+} ImMenuExporterRemote;
+
+struct _ImMenuExporter
+{
+  GDBusConnection *connection;
+  GMainContext *context;
+  gchar *object_path;
+  ImMenuExporterMenu *root;
+  GHashTable *groups;       /* id -> ImMenuExporterGroup */
+  guint next_group_id;
+  GHashTable *remotes;      /* bus name -> ImMenuExporterRemote */
+  GQueue dirty;
+  GSource *pending_source;
+};
+
+static const gchar introspection_xml[] =
+  "<node>"
+  "  <interface name='org.gtk.Menus'>"
+  "    <method name='Start'>"
+  "      <arg type='au' name='groups' direction='in'/>"
+  "      <arg type='a(uuaa{sv})' name='content' direction='out'/>"
+  "    </method>"
+  "    <method name='End'>"
+  "      <arg type='au' name='groups' direction='in'/>"
+  "    </method>"
+  "    <signal name='Changed'>"
+  "      <arg type='a(uuuuaa{sv})' name='changes'/>"
+  "    </signal>"
+  "  </interface>"
+  "</node>";
+
+static ImMenuExporterMenu *     im_menu_exporter_menu_new       (ImMenuExporterGroup *group,
+                                                                 GMenuModel          *model,
+                                                                 gboolean             announce);
+static void                     im_menu_exporter_menu_free      (ImMenuExporterMenu  *menu);
+static gboolean                 im_menu_exporter_dispatch       (gpointer             user_data);
+
+static GDBusInterfaceInfo *
+im_menu_exporter_get_interface_info (void)
+{
+  static GDBusInterfaceInfo *info;
+
+  if (g_once_init_enter (&info))
+    {
+      GDBusNodeInfo *node;
+      GDBusInterfaceInfo *iface;
+
+      node = g_dbus_node_info_new_for_xml (introspection_xml, NULL);
+      iface = g_dbus_interface_info_ref (node->interfaces[0]);
+      g_dbus_node_info_unref (node);
+
+      g_once_init_leave (&info, iface);
+    }
+
+  return info;
+}
+
+static ImMenuExporterGroup *
+im_menu_exporter_group_new (ImMenuExporter *exporter)
+{
+  ImMenuExporterGroup *group;
+
+  group = g_slice_new0 (ImMenuExporterGroup);
+  group->exporter = exporter;
+  group->id = exporter->next_group_id++;
+  group->menus = g_hash_table_new (NULL, NULL);
+
+  g_hash_table_insert (exporter->groups, GUINT_TO_POINTER (group->id), group);
+
+  return group;
+}
+
+static void
+im_menu_exporter_group_check_free (ImMenuExporterGroup *group)
+{
+  if (group->subscribed > 0 || g_hash_table_size (group->menus) > 0)
+    return;
+
+  g_hash_table_remove (group->exporter->groups, GUINT_TO_POINTER (group->id));
+  g_hash_table_unref (group->menus);
+  g_slice_free (ImMenuExporterGroup, group);
+}
+
+static void
+im_menu_exporter_link_free (gpointer data)
+{
+  ImMenuExporterLink *link = data;
+
+  im_menu_exporter_menu_free (link->menu);
+  g_free (link->name);
+  g_slice_free (ImMenuExporterLink, link);
+}
+
+static void
+im_menu_exporter_link_list_free (gpointer data)
+{
+  g_slist_free_full (data, im_menu_exporter_link_free);
+}
+
+static GSList *
+im_menu_exporter_menu_create_links (ImMenuExporterMenu *menu,
+                                    gint                position,
+                                    gboolean            announce)
+{
+  GMenuLinkIter *iter;
+  const gchar *name;
+  GMenuModel *model;
+  GSList *links = NULL;
+
+  iter = g_menu_model_iterate_item_links (menu->model, position);
+  while (g_menu_link_iter_get_next (iter, &name, &model))
+    {
+      ImMenuExporterLink *link;
+      ImMenuExporterGroup *group;
+
+      if (g_str_equal (name, G_MENU_LINK_SECTION))
+        group = menu->group;
+      else
+        group = im_menu_exporter_group_new (menu->group->exporter);
+
+      link = g_slice_new (ImMenuExporterLink);
+      link->name = g_strconcat (":", name, NULL);
+      link->menu = im_menu_exporter_menu_new (group, model, announce);
+      links = g_slist_prepend (links, link);
+
+      g_object_unref (model);
+    }
+  g_object_unref (iter);
+
+  return links;
+}
+
+static void
+im_menu_exporter_menu_mark_dirty (ImMenuExporterMenu *menu)
+{
+  ImMenuExporter *exporter = menu->group->exporter;
+
+  if (menu->dirty)
+    return;
+
+  menu->dirty = TRUE;
+  g_queue_push_tail (&exporter->dirty, menu);
+
+  if (exporter->pending_source == NULL)
+    {
+      /* an idle source, so that a burst of incoming messages is
+       * handled before anything is sent */
+      exporter->pending_source = g_idle_source_new ();
+      g_source_set_callback (exporter->pending_source, im_menu_exporter_dispatch, exporter, NULL);
+      g_source_attach (exporter->pending_source, exporter->context);
+      g_source_unref (exporter->pending_source);
+    }
+}
+
+/* Merges the change of @removed items at @position into @added new
+ * ones into the pending splices of @menu.  All positions refer to the
+ * menu as it was right before the change. */
+static void
+im_menu_exporter_menu_add_splice (ImMenuExporterMenu *menu,
+                                  guint               position,
+                                  guint               removed,
+                                  guint               added)
+{
+  GArray *splices = menu->splices;
+  ImMenuExporterSplice merged;
+  guint start = position;
+  guint end = position + removed;
+  guint merged_removed = 0;
+  guint merged_added = 0;
+  guint first;
+  guint last;
+  guint i;
+
+  for (first = 0; first < splices->len; first++)
+    {
+      ImMenuExporterSplice *splice = &g_array_index (splices, ImMenuExporterSplice, first);
+      if (splice->position + splice->added >= position)
+        break;
+    }
+
+  /* fold in all splices that touch or overlap with the change */
+  for (last = first; last < splices->len; last++)
+    {
+      ImMenuExporterSplice *splice = &g_array_index (splices, ImMenuExporterSplice, last);
+
+      if (splice->position > end)
+        break;
+
+      start = MIN (start, splice->position);
+      end = MAX (end, splice->position + splice->added);
+      merged_removed += splice->removed;
+      merged_added += splice->added;
+    }
+
+  /* items in [start, end) that aren't part of any splice were already
+   * sent and are now being replaced */
+  merged.position = start;
+  merged.removed = merged_removed + (end - start - merged_added);
+  merged.added = end - start - removed + added;
+
+  for (i = last; i < splices->len; i++)
+    {
+      ImMenuExporterSplice *splice = &g_array_index (splices, ImMenuExporterSplice, i);
+      splice->position = splice->position - removed + added;
+    }
+
+  g_array_remove_range (splices, first, last - first);
+  if (merged.removed > 0 || merged.added > 0)
+    g_array_insert_val (splices, first, merged);
+}
+
+static void
+im_menu_exporter_menu_items_changed (GMenuModel *model,
+                                     gint        position,
+                                     gint        removed,
+                                     gint        added,
+                                     gpointer    user_data)
+{
+  ImMenuExporterMenu *menu = user_data;
+  GSequenceIter *it;
+  gint i;
+
+  /* the whole menu will be sent anyway if it is new */
+  if (!menu->is_new)
+    im_menu_exporter_menu_add_splice (menu, position, removed, added);
+
+  im_menu_exporter_menu_mark_dirty (menu);
+
+  if (removed > 0)
+    g_sequence_remove_range (g_sequence_get_iter_at_pos (menu->item_links, position),
+                             g_sequence_get_iter_at_pos (menu->item_links, position + removed));
+
+  it = g_sequence_get_iter_at_pos (menu->item_links, position);
+  for (i = position; i < position + added; i++)
+    g_sequence_insert_before (it, im_menu_exporter_menu_create_links (menu, i, TRUE));
+}
+
+static void
+im_menu_exporter_menu_prepare (ImMenuExporterMenu *menu,
+                               gboolean            announce)
+{
+  gint n_items;
+  gint i;
+
+  menu->handler_id = g_signal_connect (menu->model, "items-changed",
+                                       G_CALLBACK (im_menu_exporter_menu_items_changed), menu);
+  menu->item_links = g_sequence_new (im_menu_exporter_link_list_free);
+
+  n_items = g_menu_model_get_n_items (menu->model);
+  for (i = 0; i < n_items; i++)
+    g_sequence_append (menu->item_links, im_menu_exporter_menu_create_links (menu, i, announce));
+
+  if (announce && n_items > 0)
+    {
+      menu->is_new = TRUE;
+      im_menu_exporter_menu_mark_dirty (menu);
+    }
+}
+
+static void
+im_menu_exporter_menu_unprepare (ImMenuExporterMenu *menu)
+{
+  ImMenuExporter *exporter = menu->group->exporter;
+
+  if (menu->handler_id == 0)
+    return;
+
+  g_signal_handler_disconnect (menu->model, menu->handler_id);
+  menu->handler_id = 0;
+
+  g_clear_pointer (&menu->item_links, g_sequence_free);
+
+  g_array_set_size (menu->splices, 0);
+  menu->is_new = FALSE;
+
+  if (menu->dirty)
+    {
+      g_queue_remove (&exporter->dirty, menu);
+      menu->dirty = FALSE;
+    }
+}
+
+static ImMenuExporterMenu *
+im_menu_exporter_menu_new (ImMenuExporterGroup *group,
+                           GMenuModel          *model,
+                           gboolean             announce)
+{
+  ImMenuExporterMenu *menu;
+
+  menu = g_slice_new0 (ImMenuExporterMenu);
+  menu->group = group;
+  menu->id = group->next_menu_id++;
+  menu->model = g_object_ref (model);
+  menu->splices = g_array_new (FALSE, FALSE, sizeof (ImMenuExporterSplice));
+
+  g_hash_table_insert (group->menus, GUINT_TO_POINTER (menu->id), menu);
+
+  if (group->subscribed > 0)
+    im_menu_exporter_menu_prepare (menu, announce);
+
+  return menu;
+}
+
+static void
+im_menu_exporter_menu_free (ImMenuExporterMenu *menu)
+{
+  ImMenuExporterGroup *group = menu->group;
+
+  im_menu_exporter_menu_unprepare (menu);
+
+  g_hash_table_remove (group->menus, GUINT_TO_POINTER (menu->id));
+  g_array_unref (menu->splices);
+  g_object_unref (menu->model);
+  g_slice_free (ImMenuExporterMenu, menu);
+
+  im_menu_exporter_group_check_free (group);
+}
+
+static GVariant *
+im_menu_exporter_menu_describe_item (ImMenuExporterMenu *menu,
+                                     gint                position)
+{
+  GVariantBuilder builder;
+  GMenuAttributeIter *attributes;
+  const gchar *name;
+  GVariant *value;
+  GSList *links;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+
+  attributes = g_menu_model_iterate_item_attributes (menu->model, position);
+  while (g_menu_attribute_iter_get_next (attributes, &name, &value))
+    {
+      g_variant_builder_add (&builder, "{sv}", name, value);
+      g_variant_unref (value);
+    }
+  g_object_unref (attributes);
+
+  links = g_sequence_get (g_sequence_get_iter_at_pos (menu->item_links, position));
+  for (; links; links = links->next)
+    {
+      ImMenuExporterLink *link = links->data;
+
+      g_variant_builder_add (&builder, "{sv}", link->name,
+                             g_variant_new ("(uu)", link->menu->group->id, link->menu->id));
+    }
+
+  return g_variant_builder_end (&builder);
+}
+
+static GVariant *
+im_menu_exporter_menu_describe_items (ImMenuExporterMenu *menu,
+                                      gint                position,
+                                      gint                n_items)
+{
+  GVariantBuilder builder;
+  gint i;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("aa{sv}"));
+
+  for (i = position; i < position + n_items; i++)
+    g_variant_builder_add_value (&builder, im_menu_exporter_menu_describe_item (menu, i));
+
+  return g_variant_builder_end (&builder);
+}
+
+static gboolean
+im_menu_exporter_dispatch (gpointer user_data)
+{
+  ImMenuExporter *exporter = user_data;
+  GVariantBuilder builder;
+  ImMenuExporterMenu *menu;
+  gboolean empty = TRUE;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(uuuuaa{sv})"));
+
+  while ((menu = g_queue_pop_head (&exporter->dirty)))
+    {
+      guint i;
+
+      if (menu->is_new)
+        {
+          g_variant_builder_add (&builder, "(uuuu@aa{sv})", menu->group->id, menu->id, 0, 0,
+                                 im_menu_exporter_menu_describe_items (menu, 0,
+                                                                       g_menu_model_get_n_items (menu->model)));
+          empty = FALSE;
+        }
+
+      /* splices are sorted and refer to the current menu, so applying
+       * them in order leads to the current state */
+      for (i = 0; !menu->is_new && i < menu->splices->len; i++)
+        {
+          ImMenuExporterSplice *splice = &g_array_index (menu->splices, ImMenuExporterSplice, i);
+
+          g_variant_builder_add (&builder, "(uuuu@aa{sv})", menu->group->id, menu->id,
+                                 splice->position, splice->removed,
+                                 im_menu_exporter_menu_describe_items (menu, splice->position, splice->added));
+          empty = FALSE;
+        }
+
+      g_array_set_size (menu->splices, 0);
+      menu->is_new = FALSE;
+      menu->dirty = FALSE;
+    }
+
+  if (!empty)
+    g_dbus_connection_emit_signal (exporter->connection, NULL, exporter->object_path,
+                                   "org.gtk.Menus", "Changed",
+                                   g_variant_new ("(@a(uuuuaa{sv}))", g_variant_builder_end (&builder)),
+                                   NULL);
+  else
+    g_variant_builder_clear (&builder);
+
+  exporter->pending_source = NULL;
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+im_menu_exporter_flush (ImMenuExporter *exporter)
+{
+  if (exporter->pending_source)
+    {
+      g_source_destroy (exporter->pending_source);
+      im_menu_exporter_dispatch (exporter);
+    }
+}
+
+static void
+im_menu_exporter_group_subscribe (ImMenuExporterGroup *group,
+                                  guint                count)
+{
+  gboolean was_subscribed = group->subscribed > 0;
+
+  group->subscribed += count;
+
+  /* unsubscribed groups only contain their first menu, as sections
+   * are only followed while the group is subscribed */
+  if (!was_subscribed && group->subscribed > 0)
+    {
+      ImMenuExporterMenu *menu = g_hash_table_lookup (group->menus, GUINT_TO_POINTER (0));
+      if (menu)
+        im_menu_exporter_menu_prepare (menu, FALSE);
+    }
+}
+
+static void
+im_menu_exporter_group_unsubscribe (ImMenuExporterGroup *group,
+                                    guint                count)
+{
+  g_return_if_fail (group->subscribed >= count);
+
+  group->subscribed -= count;
+
+  if (group->subscribed == 0)
+    {
+      ImMenuExporterMenu *menu = g_hash_table_lookup (group->menus, GUINT_TO_POINTER (0));
+      if (menu)
+        im_menu_exporter_menu_unprepare (menu);
+
+      im_menu_exporter_group_check_free (group);
+    }
+}
+
+static void
+im_menu_exporter_remote_unsubscribe_all (ImMenuExporterRemote *remote)
+{
+  GHashTableIter it;
+  gpointer id;
+  gpointer count;
+
+  g_hash_table_iter_init (&it, remote->groups);
+  while (g_hash_table_iter_next (&it, &id, &count))
+    {
+      ImMenuExporterGroup *group;
+
+      group = g_hash_table_lookup (remote->exporter->groups, id);
+      if (group)
+        im_menu_exporter_group_unsubscribe (group, GPOINTER_TO_UINT (count));
+    }
+
+  g_hash_table_remove_all (remote->groups);
+}
+
+static void
+im_menu_exporter_remote_free (gpointer data)
+{
+  ImMenuExporterRemote *remote = data;
+
+  im_menu_exporter_remote_unsubscribe_all (remote);
+
+  g_bus_unwatch_name (remote->watch_id);
+  g_hash_table_unref (remote->groups);
+  g_free (remote->name);
+  g_slice_free (ImMenuExporterRemote, remote);
+}
+
+static void
+im_menu_exporter_remote_vanished (GDBusConnection *connection,
+                                  const gchar     *name,
+                                  gpointer         user_data)
+{
+  ImMenuExporterRemote *remote = user_data;
+
+  g_hash_table_remove (remote->exporter->remotes, remote->name);
+}
+
+static ImMenuExporterRemote *
+im_menu_exporter_get_remote (ImMenuExporter *exporter,
+                             const gchar    *name)
+{
+  ImMenuExporterRemote *remote;
+
+  remote = g_hash_table_lookup (exporter->remotes, name);
+  if (remote == NULL)
+    {
+      remote = g_slice_new0 (ImMenuExporterRemote);
+      remote->exporter = exporter;
+      remote->name = g_strdup (name);
+      remote->groups = g_hash_table_new (NULL, NULL);
+      remote->watch_id = g_bus_watch_name_on_connection (exporter->connection, name,
+                                                         G_BUS_NAME_WATCHER_FLAGS_NONE, NULL,
+                                                         im_menu_exporter_remote_vanished,
+                                                         remote, NULL);
+
+      g_hash_table_insert (exporter->remotes, remote->name, remote);
+    }
+
+  return remote;
+}
+
+static GVariant *
+im_menu_exporter_start (ImMenuExporter *exporter,
+                        const gchar    *sender,
+                        GVariant       *group_ids)
+{
+  ImMenuExporterRemote *remote;
+  GVariantBuilder builder;
+  GVariantIter it;
+  guint32 id;
+
+  /* pending changes are relative to what the other subscribers have
+   * already seen */
+  im_menu_exporter_flush (exporter);
+
+  remote = im_menu_exporter_get_remote (exporter, sender);
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(uuaa{sv})"));
+
+  g_variant_iter_init (&it, group_ids);
+  while (g_variant_iter_next (&it, "u", &id))
+    {
+      ImMenuExporterGroup *group;
+      guint count;
+      GHashTableIter menus;
+      ImMenuExporterMenu *menu;
+
+      group = g_hash_table_lookup (exporter->groups, GUINT_TO_POINTER (id));
+      if (group == NULL)
+        continue;
+
+      count = GPOINTER_TO_UINT (g_hash_table_lookup (remote->groups, GUINT_TO_POINTER (id)));
+      g_hash_table_insert (remote->groups, GUINT_TO_POINTER (id), GUINT_TO_POINTER (count + 1));
+
+      im_menu_exporter_group_subscribe (group, 1);
+
+      g_hash_table_iter_init (&menus, group->menus);
+      while (g_hash_table_iter_next (&menus, NULL, (gpointer *) &menu))
+        g_variant_builder_add (&builder, "(uu@aa{sv})", group->id, menu->id,
+                               im_menu_exporter_menu_describe_items (menu, 0,
+                                                                     g_menu_model_get_n_items (menu->model)));
+    }
+
+  return g_variant_new ("(@a(uuaa{sv}))", g_variant_builder_end (&builder));
+}
+
+static void
+im_menu_exporter_end (ImMenuExporter *exporter,
+                      const gchar    *sender,
+                      GVariant       *group_ids)
+{
+  ImMenuExporterRemote *remote;
+  GVariantIter it;
+  guint32 id;
+
+  remote = g_hash_table_lookup (exporter->remotes, sender);
+  if (remote == NULL)
+    return;
+
+  g_variant_iter_init (&it, group_ids);
+  while (g_variant_iter_next (&it, "u", &id))
+    {
+      ImMenuExporterGroup *group;
+      guint count;
+
+      count = GPOINTER_TO_UINT (g_hash_table_lookup (remote->groups, GUINT_TO_POINTER (id)));
+      if (count == 0)
+        continue;
+
+      if (count > 1)
+        g_hash_table_insert (remote->groups, GUINT_TO_POINTER (id), GUINT_TO_POINTER (count - 1));
+      else
+        g_hash_table_remove (remote->groups, GUINT_TO_POINTER (id));
+
+      group = g_hash_table_lookup (exporter->groups, GUINT_TO_POINTER (id));
+      if (group)
+        im_menu_exporter_group_unsubscribe (group, 1);
+    }
+
+  if (g_hash_table_size (remote->groups) == 0)
+    g_hash_table_remove (exporter->remotes, sender);
+}
+
+static void
+im_menu_exporter_method_call (GDBusConnection       *connection,
+                              const gchar           *sender,
+                              const gchar           *object_path,
+                              const gchar           *interface_name,
+                              const gchar           *method_name,
+                              GVariant              *parameters,
+                              GDBusMethodInvocation *invocation,
+                              gpointer               user_data)
+{
+  ImMenuExporter *exporter = user_data;
+  GVariant *group_ids;
+
+  group_ids = g_variant_get_child_value (parameters, 0);
+
+  if (g_str_equal (method_name, "Start"))
+    g_dbus_method_invocation_return_value (invocation, im_menu_exporter_start (exporter, sender, group_ids));
+  else if (g_str_equal (method_name, "End"))
+    {
+      im_menu_exporter_end (exporter, sender, group_ids);
+      g_dbus_method_invocation_return_value (invocation, NULL);
+    }
+  else
+    g_assert_not_reached ();
+
+  g_variant_unref (group_ids);
+}
+
+static void
+im_menu_exporter_free (gpointer user_data)
+{
+  ImMenuExporter *exporter = user_data;
+
+  g_hash_table_unref (exporter->remotes);
+  im_menu_exporter_menu_free (exporter->root);
+  g_hash_table_unref (exporter->groups);
+
+  if (exporter->pending_source)
+    g_source_destroy (exporter->pending_source);
+
+  g_free (exporter->object_path);
+  g_main_context_unref (exporter->context);
+  g_object_unref (exporter->connection);
+
+  g_slice_free (ImMenuExporter, exporter);
+}
+
+/**
+ * im_menu_exporter_export:
+ * @connection: a #GDBusConnection
+ * @object_path: a D-Bus object path
+ * @menu: a #GMenuModel
+ * @error: a pointer to a %NULL #GError, or %NULL
+ *
+ * Exports @menu on @connection at @object_path, merging all changes to
+ * it into one Changed signal per main loop iteration.
+ *
+ * Returns: the ID of the export (never zero), or 0 in case of failure
+ */
+guint
+im_menu_exporter_export (GDBusConnection  *connection,
+                         const gchar      *object_path,
+                         GMenuModel       *menu,
+                         GError          **error)
+{
+  const GDBusInterfaceVTable vtable = {
+    im_menu_exporter_method_call
+  };
+  ImMenuExporter *exporter;
+  guint id;
+
+  g_return_val_if_fail (G_IS_DBUS_CONNECTION (connection), 0);
+  g_return_val_if_fail (g_variant_is_object_path (object_path), 0);
+  g_return_val_if_fail (G_IS_MENU_MODEL (menu), 0);
+
+  exporter = g_slice_new0 (ImMenuExporter);
+  exporter->connection = g_object_ref (connection);
+  exporter->context = g_main_context_ref_thread_default ();
+  exporter->object_path = g_strdup (object_path);
+  exporter->groups = g_hash_table_new (NULL, NULL);
+  exporter->remotes = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, im_menu_exporter_remote_free);
+  g_queue_init (&exporter->dirty);
+
+  exporter->root = im_menu_exporter_menu_new (im_menu_exporter_group_new (exporter), menu, FALSE);
+
+  id = g_dbus_connection_register_object (connection, object_path,
+                                          im_menu_exporter_get_interface_info (),
+                                          &vtable, exporter, im_menu_exporter_free, error);
+  if (id == 0)
+    im_menu_exporter_free (exporter);
+
+  return id;
+}
@@ -19,6 +19,7 @@
 
 #include "im-menu.h"
 #include "im-accounts-service.h"
+#include "im-menu-exporter.h"
 
 struct _ImMenuPrivate
 {
@@ -161,10 +162,10 @@ im_menu_export (ImMenu           *menu,
   g_return_val_if_fail (IM_IS_MENU (menu), FALSE);
 
   priv = im_menu_get_instance_private (menu);
-  return g_dbus_connection_export_menu_model (connection,
-                                              object_path,
-                                              G_MENU_MODEL (priv->toplevel_menu),
-                                              error) > 0;
+  return im_menu_exporter_export (connection,
+                                  object_path,
+                                  G_MENU_MODEL (priv->toplevel_menu),
+                                  error) > 0;
 }
 
 void
@@ -0,0 +1,637 @@
+/*
+ * Copyright 2013 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "im-message-actions.h"
+
+#include <string.h>
+
+/*
+ * ImMessageActions is the #GActionGroup that holds the actions of all
+ * messages of one application.
+ *
+ * Every message has an action with a boolean parameter (activate or
+ * dismiss the message) and any number of sub-actions.  Instead of
+ * creating a #GAction for each of those, messages are rows in a table
+ * and actions are synthesized when they are queried or activated.  All
+ * activations are reported with the ::activate signal.
+ *
+ * The sub-actions, named "<message action>.<sub-action>", are in a
+ * separate group (see im_message_actions_get_sub_actions()) that is a
+ * view of the same table, so that both can be inserted into a
+ * #GActionMuxer with different prefixes.
+ *
+ * None of the actions have a state and all of them are enabled.
+ *
+ * All names and ids are kept in a #GStringChunk, which deduplicates
+ * them and releases them in one go when the group is finalized.
+ * Removing a message doesn't release its strings; the chunk is rebuilt
+ * from the remaining messages once most of it is unused.
+ */
+
+/* The string chunk is only rebuilt once it has grown to this size */
+#define STRINGS_MIN_COMPACT_SIZE 65536
+
+typedef struct
+{
+  const gchar *name;
+  GVariantType *parameter_type;
+} SubAction;
+
+typedef struct
+{
+  const gchar *action_name;
+  const gchar *id;
+  gboolean draws_attention;
+  SubAction *sub_actions;
+  guint n_sub_actions;
+} MessageRow;
+
+typedef GObjectClass ImMessageActionsClass;
+typedef GObjectClass ImMessageSubActionsClass;
+
+typedef struct _ImMessageSubActions ImMessageSubActions;
+
+struct _ImMessageActions
+{
+  GObject parent;
+
+  GHashTable *messages;         /* action name -> MessageRow */
+  guint n_sub_actions;          /* of all messages */
+  guint n_drawing_attention;
+  ImMessageSubActions *sub_actions;
+
+  GStringChunk *strings;        /* all names and ids in messages */
+  gsize strings_size;           /* bytes inserted into strings */
+  gsize strings_live;           /* bytes of the strings still in use */
+};
+
+struct _ImMessageSubActions
+{
+  GObject parent;
+
+  ImMessageActions *actions;    /* not owned, cleared when it goes away */
+};
+
+enum
+{
+  ACTIVATE,
+  N_SIGNALS
+};
+
+static guint signals[N_SIGNALS];
+
+static void im_message_actions_group_init     (GActionGroupInterface *iface);
+static void im_message_sub_actions_group_init (GActionGroupInterface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (ImMessageActions, im_message_actions, G_TYPE_OBJECT,
+                         G_IMPLEMENT_INTERFACE (G_TYPE_ACTION_GROUP, im_message_actions_group_init));
+
+G_DEFINE_TYPE_WITH_CODE (ImMessageSubActions, im_message_sub_actions, G_TYPE_OBJECT,
+                         G_IMPLEMENT_INTERFACE (G_TYPE_ACTION_GROUP, im_message_sub_actions_group_init));
+
+static void
+message_row_free (gpointer data)
+{
+  MessageRow *row = data;
+  guint i;
+
+  for (i = 0; i < row->n_sub_actions; i++)
+    {
+      if (row->sub_actions[i].parameter_type)
+        g_variant_type_free (row->sub_actions[i].parameter_type);
+    }
+  g_free (row->sub_actions);
+
+  g_slice_free (MessageRow, row);
+}
+
+/* Returns the number of bytes @row's strings take in the string chunk */
+static gsize
+message_row_get_strings_size (MessageRow *row)
+{
+  gsize size;
+  guint i;
+
+  size = strlen (row->action_name) + 1 + strlen (row->id) + 1;
+  for (i = 0; i < row->n_sub_actions; i++)
+    size += strlen (row->sub_actions[i].name) + 1;
+
+  return size;
+}
+
+static const gchar *
+im_message_actions_intern (ImMessageActions *actions,
+                           const gchar      *string)
+{
+  gsize size = strlen (string) + 1;
+
+  actions->strings_size += size;
+  actions->strings_live += size;
+
+  return g_string_chunk_insert_const (actions->strings, string);
+}
+
+/* Moves the strings of all messages into a new string chunk, if most
+ * of the current one belongs to messages that were removed. */
+static void
+im_message_actions_compact_strings (ImMessageActions *actions)
+{
+  GStringChunk *strings;
+  GHashTable *messages;
+  GHashTableIter iter;
+  MessageRow *row;
+
+  if (actions->strings_size < STRINGS_MIN_COMPACT_SIZE ||
+      actions->strings_size < 2 * actions->strings_live)
+    return;
+
+  strings = g_string_chunk_new (4096);
+  messages = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, message_row_free);
+
+  g_hash_table_iter_init (&iter, actions->messages);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &row))
+    {
+      guint i;
+
+      row->action_name = g_string_chunk_insert_const (strings, row->action_name);
+      row->id = g_string_chunk_insert_const (strings, row->id);
+      for (i = 0; i < row->n_sub_actions; i++)
+        row->sub_actions[i].name = g_string_chunk_insert_const (strings, row->sub_actions[i].name);
+
+      g_hash_table_insert (messages, (gpointer) row->action_name, row);
+    }
+
+  g_hash_table_steal_all (actions->messages);
+  g_hash_table_unref (actions->messages);
+  actions->messages = messages;
+
+  g_string_chunk_free (actions->strings);
+  actions->strings = strings;
+  actions->strings_size = actions->strings_live;
+}
+
+static SubAction *
+message_row_lookup_sub_action (MessageRow  *row,
+                               const gchar *name)
+{
+  guint i;
+
+  for (i = 0; i < row->n_sub_actions; i++)
+    if (g_str_equal (row->sub_actions[i].name, name))
+      return &row->sub_actions[i];
+
+  return NULL;
+}
+
+/* Finds the sub-action @name ("<message action>.<sub-action>") and the
+ * row of its message. Message action names may contain dots
+ * themselves, so every dot is tried as the separator. */
+static MessageRow *
+im_message_actions_lookup_sub_action (ImMessageActions  *actions,
+                                      const gchar       *name,
+                                      SubAction        **sub_action)
+{
+  MessageRow *row;
+  const gchar *dot;
+
+  *sub_action = NULL;
+
+  for (dot = strchr (name, '.'); dot; dot = strchr (dot + 1, '.'))
+    {
+      gchar *action_name;
+
+      action_name = g_strndup (name, dot - name);
+      row = g_hash_table_lookup (actions->messages, action_name);
+      g_free (action_name);
+
+      if (row && (*sub_action = message_row_lookup_sub_action (row, dot + 1)))
+        return row;
+    }
+
+  return NULL;
+}
+
+static gchar **
+im_message_actions_list_actions (GActionGroup *group)
+{
+  return im_message_actions_list_messages (IM_MESSAGE_ACTIONS (group));
+}
+
+static void
+im_message_actions_fill_query (const GVariantType  *type,
+                               gboolean            *enabled,
+                               const GVariantType **parameter_type,
+                               const GVariantType **state_type,
+                               GVariant           **state_hint,
+                               GVariant           **state)
+{
+  if (enabled)
+    *enabled = TRUE;
+
+  if (parameter_type)
+    *parameter_type = type;
+
+  if (state_type)
+    *state_type = NULL;
+
+  if (state_hint)
+    *state_hint = NULL;
+
+  if (state)
+    *state = NULL;
+}
+
+static gboolean
+im_message_actions_check_parameter (const gchar        *action_name,
+                                    const GVariantType *parameter_type,
+                                    GVariant           *parameter)
+{
+  if (parameter_type ? parameter != NULL && g_variant_is_of_type (parameter, parameter_type)
+                     : parameter == NULL)
+    return TRUE;
+
+  g_warning ("invalid parameter for activating message action '%s'", action_name);
+  return FALSE;
+}
+
+static gboolean
+im_message_actions_query_action (GActionGroup        *group,
+                                 const gchar         *action_name,
+                                 gboolean            *enabled,
+                                 const GVariantType **parameter_type,
+                                 const GVariantType **state_type,
+                                 GVariant           **state_hint,
+                                 GVariant           **state)
+{
+  ImMessageActions *actions = IM_MESSAGE_ACTIONS (group);
+
+  if (!g_hash_table_contains (actions->messages, action_name))
+    return FALSE;
+
+  im_message_actions_fill_query (G_VARIANT_TYPE_BOOLEAN, enabled, parameter_type,
+                                 state_type, state_hint, state);
+  return TRUE;
+}
+
+static void
+im_message_actions_activate_action (GActionGroup *group,
+                                    const gchar  *action_name,
+                                    GVariant     *parameter)
+{
+  ImMessageActions *actions = IM_MESSAGE_ACTIONS (group);
+  MessageRow *row;
+
+  row = g_hash_table_lookup (actions->messages, action_name);
+  if (row == NULL || !im_message_actions_check_parameter (action_name, G_VARIANT_TYPE_BOOLEAN, parameter))
+    return;
+
+  g_signal_emit (actions, signals[ACTIVATE], 0, row->action_name, row->id, NULL, parameter);
+}
+
+static void
+im_message_actions_change_action_state (GActionGroup *group,
+                                        const gchar  *action_name,
+                                        GVariant     *value)
+{
+  /* message actions are stateless */
+}
+
+static void
+im_message_actions_group_init (GActionGroupInterface *iface)
+{
+  iface->list_actions = im_message_actions_list_actions;
+  iface->query_action = im_message_actions_query_action;
+  iface->activate_action = im_message_actions_activate_action;
+  iface->change_action_state = im_message_actions_change_action_state;
+}
+
+static gchar **
+im_message_sub_actions_list_actions (GActionGroup *group)
+{
+  ImMessageActions *actions = ((ImMessageSubActions *) group)->actions;
+  GHashTableIter iter;
+  MessageRow *row;
+  gchar **names;
+  guint i = 0;
+
+  if (actions == NULL)
+    return g_new0 (gchar *, 1);
+
+  names = g_new (gchar *, actions->n_sub_actions + 1);
+
+  g_hash_table_iter_init (&iter, actions->messages);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &row))
+    {
+      guint j;
+
+      for (j = 0; j < row->n_sub_actions; j++)
+        names[i++] = g_strconcat (row->action_name, ".", row->sub_actions[j].name, NULL);
+    }
+  names[i] = NULL;
+
+  return names;
+}
+
+static gboolean
+im_message_sub_actions_query_action (GActionGroup        *group,
+                                     const gchar         *action_name,
+                                     gboolean            *enabled,
+                                     const GVariantType **parameter_type,
+                                     const GVariantType **state_type,
+                                     GVariant           **state_hint,
+                                     GVariant           **state)
+{
+  ImMessageActions *actions = ((ImMessageSubActions *) group)->actions;
+  SubAction *sub_action;
+
+  if (actions == NULL || !im_message_actions_lookup_sub_action (actions, action_name, &sub_action))
+    return FALSE;
+
+  im_message_actions_fill_query (sub_action->parameter_type, enabled, parameter_type,
+                                 state_type, state_hint, state);
+  return TRUE;
+}
+
+static void
+im_message_sub_actions_activate_action (GActionGroup *group,
+                                        const gchar  *action_name,
+                                        GVariant     *parameter)
+{
+  ImMessageActions *actions = ((ImMessageSubActions *) group)->actions;
+  MessageRow *row;
+  SubAction *sub_action;
+
+  if (actions == NULL)
+    return;
+
+  row = im_message_actions_lookup_sub_action (actions, action_name, &sub_action);
+  if (row == NULL || !im_message_actions_check_parameter (action_name, sub_action->parameter_type, parameter))
+    return;
+
+  g_signal_emit (actions, signals[ACTIVATE], 0, row->action_name, row->id, sub_action->name, parameter);
+}
+
+static void
+im_message_sub_actions_group_init (GActionGroupInterface *iface)
+{
+  iface->list_actions = im_message_sub_actions_list_actions;
+  iface->query_action = im_message_sub_actions_query_action;
+  iface->activate_action = im_message_sub_actions_activate_action;
+  iface->change_action_state = im_message_actions_change_action_state;
+}
+
+static void
+im_message_sub_actions_class_init (ImMessageSubActionsClass *klass)
+{
+}
+
+static void
+im_message_sub_actions_init (ImMessageSubActions *sub_actions)
+{
+}
+
+static void
+im_message_actions_finalize (GObject *object)
+{
+  ImMessageActions *actions = IM_MESSAGE_ACTIONS (object);
+
+  actions->sub_actions->actions = NULL;
+  g_object_unref (actions->sub_actions);
+  g_hash_table_unref (actions->messages);
+  g_string_chunk_free (actions->strings);
+
+  G_OBJECT_CLASS (im_message_actions_parent_class)->finalize (object);
+}
+
+static void
+im_message_actions_class_init (ImMessageActionsClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = im_message_actions_finalize;
+
+  /*
+   * ImMessageActions::activate:
+   * @actions: the #ImMessageActions
+   * @action_name: the action name of the message
+   * @message_id: the id of the message
+   * @sub_action_name: the (escaped) name of the sub-action, or %NULL if
+   *   the message itself was activated
+   * @parameter: the parameter of the activation
+   */
+  signals[ACTIVATE] = g_signal_new ("activate",
+                                    IM_TYPE_MESSAGE_ACTIONS,
+                                    G_SIGNAL_RUN_LAST,
+                                    0,
+                                    NULL, NULL,
+                                    g_cclosure_marshal_generic,
+                                    G_TYPE_NONE,
+                                    4,
+                                    G_TYPE_STRING,
+                                    G_TYPE_STRING,
+                                    G_TYPE_STRING,
+                                    G_TYPE_VARIANT);
+}
+
+static void
+im_message_actions_init (ImMessageActions *actions)
+{
+  actions->messages = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, message_row_free);
+  actions->strings = g_string_chunk_new (4096);
+  actions->sub_actions = g_object_new (im_message_sub_actions_get_type (), NULL);
+  actions->sub_actions->actions = actions;
+}
+
+ImMessageActions *
+im_message_actions_new (void)
+{
+  return g_object_new (IM_TYPE_MESSAGE_ACTIONS, NULL);
+}
+
+/*
+ * Returns: (transfer none): the group of the sub-actions of all
+ * messages in @actions
+ */
+GActionGroup *
+im_message_actions_get_sub_actions (ImMessageActions *actions)
+{
+  g_return_val_if_fail (IM_IS_MESSAGE_ACTIONS (actions), NULL);
+
+  return G_ACTION_GROUP (actions->sub_actions);
+}
+
+/*
+ * Adds the action of the message with @message_id, replacing the
+ * actions of a message that had the same @action_name.
+ */
+void
+im_message_actions_add (ImMessageActions *actions,
+                        const gchar      *action_name,
+                        const gchar      *message_id,
+                        gboolean          draws_attention)
+{
+  MessageRow *row;
+
+  g_return_if_fail (IM_IS_MESSAGE_ACTIONS (actions));
+  g_return_if_fail (action_name != NULL);
+  g_return_if_fail (message_id != NULL);
+
+  im_message_actions_remove (actions, action_name);
+
+  row = g_slice_new0 (MessageRow);
+  row->action_name = im_message_actions_intern (actions, action_name);
+  row->id = im_message_actions_intern (actions, message_id);
+  row->draws_attention = draws_attention;
+
+  g_hash_table_insert (actions->messages, (gpointer) row->action_name, row);
+
+  if (draws_attention)
+    actions->n_drawing_attention++;
+
+  g_action_group_action_added (G_ACTION_GROUP (actions), action_name);
+}
+
+/*
+ * Adds a sub-action called @sub_action_name to the message with
+ * @action_name. @parameter_type is a type string, or %NULL if the
+ * sub-action doesn't take a parameter.
+ */
+void
+im_message_actions_add_sub_action (ImMessageActions *actions,
+                                   const gchar      *action_name,
+                                   const gchar      *sub_action_name,
+                                   const gchar      *parameter_type)
+{
+  MessageRow *row;
+  SubAction *sub_action;
+  gchar *full_name;
+
+  g_return_if_fail (IM_IS_MESSAGE_ACTIONS (actions));
+  g_return_if_fail (sub_action_name != NULL);
+  g_return_if_fail (parameter_type == NULL || g_variant_type_string_is_valid (parameter_type));
+
+  row = g_hash_table_lookup (actions->messages, action_name);
+  g_return_if_fail (row != NULL);
+
+  if (message_row_lookup_sub_action (row, sub_action_name))
+    return;
+
+  row->sub_actions = g_renew (SubAction, row->sub_actions, row->n_sub_actions + 1);
+  sub_action = &row->sub_actions[row->n_sub_actions++];
+  sub_action->name = im_message_actions_intern (actions, sub_action_name);
+  sub_action->parameter_type = parameter_type ? g_variant_type_new (parameter_type) : NULL;
+  actions->n_sub_actions++;
+
+  full_name = g_strconcat (action_name, ".", sub_action_name, NULL);
+  g_action_group_action_added (G_ACTION_GROUP (actions->sub_actions), full_name);
+  g_free (full_name);
+}
+
+/*
+ * Removes the message with @action_name and all of its sub-actions.
+ * Does nothing if there is no such message.
+ */
+void
+im_message_actions_remove (ImMessageActions *actions,
+                           const gchar      *action_name)
+{
+  MessageRow *row;
+  guint i;
+
+  g_return_if_fail (IM_IS_MESSAGE_ACTIONS (actions));
+  g_return_if_fail (action_name != NULL);
+
+  row = g_hash_table_lookup (actions->messages, action_name);
+  if (row == NULL)
+    return;
+
+  /* emitted before the actions are gone, as GActionGroup requires */
+  for (i = 0; i < row->n_sub_actions; i++)
+    {
+      gchar *full_name;
+
+      full_name = g_strconcat (row->action_name, ".", row->sub_actions[i].name, NULL);
+      g_action_group_action_removed (G_ACTION_GROUP (actions->sub_actions), full_name);
+      g_free (full_name);
+    }
+
+  g_action_group_action_removed (G_ACTION_GROUP (actions), row->action_name);
+
+  actions->n_sub_actions -= row->n_sub_actions;
+  if (row->draws_attention)
+    actions->n_drawing_attention--;
+  actions->strings_live -= message_row_get_strings_size (row);
+
+  g_hash_table_remove (actions->messages, row->action_name);
+
+  im_message_actions_compact_strings (actions);
+}
+
+/*
+ * Returns whether there is a message with @action_name. Cheaper than
+ * g_action_group_has_action(), which lists all actions.
+ */
+gboolean
+im_message_actions_contains (ImMessageActions *actions,
+                             const gchar      *action_name)
+{
+  g_return_val_if_fail (IM_IS_MESSAGE_ACTIONS (actions), FALSE);
+
+  return g_hash_table_contains (actions->messages, action_name);
+}
+
+guint
+im_message_actions_get_n_messages (ImMessageActions *actions)
+{
+  g_return_val_if_fail (IM_IS_MESSAGE_ACTIONS (actions), 0);
+
+  return g_hash_table_size (actions->messages);
+}
+
+/*
+ * Returns: (transfer full): the action names of all messages, without
+ * their sub-actions
+ */
+gchar **
+im_message_actions_list_messages (ImMessageActions *actions)
+{
+  GHashTableIter iter;
+  const gchar *action_name;
+  gchar **names;
+  guint i = 0;
+
+  g_return_val_if_fail (IM_IS_MESSAGE_ACTIONS (actions), NULL);
+
+  names = g_new (gchar *, g_hash_table_size (actions->messages) + 1);
+
+  g_hash_table_iter_init (&iter, actions->messages);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &action_name, NULL))
+    names[i++] = g_strdup (action_name);
+  names[i] = NULL;
+
+  return names;
+}
+
+/*
+ * Returns whether any of the messages draws attention.
+ */
+gboolean
+im_message_actions_get_draws_attention (ImMessageActions *actions)
+{
+  g_return_val_if_fail (IM_IS_MESSAGE_ACTIONS (actions), FALSE);
+
+  return actions->n_drawing_attention > 0;
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright 2013 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __IM_MESSAGE_ACTIONS_H__
+#define __IM_MESSAGE_ACTIONS_H__
+
+#include <gio/gio.h>
+
+#define IM_TYPE_MESSAGE_ACTIONS    (im_message_actions_get_type ())
+#define IM_MESSAGE_ACTIONS(obj)    (G_TYPE_CHECK_INSTANCE_CAST ((obj), IM_TYPE_MESSAGE_ACTIONS, ImMessageActions))
+#define IM_IS_MESSAGE_ACTIONS(obj) (G_TYPE_CHECK_INSTANCE_TYPE ((obj), IM_TYPE_MESSAGE_ACTIONS))
+
+typedef struct _ImMessageActions ImMessageActions;
+
+GType               im_message_actions_get_type             (void) G_GNUC_CONST;
+
+ImMessageActions *  im_message_actions_new                  (void);
+
+GActionGroup *      im_message_actions_get_sub_actions      (ImMessageActions *actions);
+
+void                im_message_actions_add                  (ImMessageActions *actions,
+                                                             const gchar      *action_name,
+                                                             const gchar      *message_id,
+                                                             gboolean          draws_attention);
+
+void                im_message_actions_add_sub_action       (ImMessageActions *actions,
+                                                             const gchar      *action_name,
+                                                             const gchar      *sub_action_name,
+                                                             const gchar      *parameter_type);
+
+void                im_message_actions_remove               (ImMessageActions *actions,
+                                                             const gchar      *action_name);
+
+gboolean            im_message_actions_contains             (ImMessageActions *actions,
+                                                             const gchar      *action_name);
+
+guint               im_message_actions_get_n_messages       (ImMessageActions *actions);
+
+gchar **            im_message_actions_list_messages        (ImMessageActions *actions);
+
+gboolean            im_message_actions_get_draws_attention  (ImMessageActions *actions);
+
+#endif
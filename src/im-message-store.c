@@ -0,0 +1,456 @@
+/*
+ * Copyright 2013 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "im-message-store.h"
+
+/*
+ * ImMessageStore is a table of messages, sorted newest first, that is
+ * kept in one array per column: times, application indexes, ids and
+ * the messages themselves.  Searching by time only touches the times,
+ * and going through the messages of one application only touches the
+ * application indexes.
+ *
+ * Ids are interned in the store, so that rows can be compared by
+ * pointer.  Application ids are stored once and referred to by index.
+ *
+ * A secondary index maps the ids of every application to the time of
+ * the message, which is enough to find its row with a binary search.
+ *
+ * ImApplicationList keeps the messages of all applications in one
+ * store.  Menus that show all messages in time order use it as the
+ * record of their items, with row i being item i of the menu.
+ */
+
+struct _ImMessageStore
+{
+  /* columns, newest message first */
+  GArray *times;                /* gint64 */
+  GArray *apps;                 /* guint, index into app_ids */
+  GArray *ids;                  /* const gchar *, interned in strings */
+  GArray *messages;             /* GVariant *, or NULL */
+
+  GHashTable *strings;          /* interned string -> reference count */
+  GPtrArray *app_ids;           /* app index -> application id */
+  GHashTable *app_indexes;      /* application id -> app index + 1 */
+  GPtrArray *app_messages;      /* app index -> (interned id -> gint64 time) */
+};
+
+static const gchar *
+im_message_store_ref_string (ImMessageStore *store,
+                             const gchar    *string)
+{
+  gpointer interned;
+  gpointer count;
+
+  if (g_hash_table_lookup_extended (store->strings, string, &interned, &count))
+    {
+      g_hash_table_steal (store->strings, interned);
+    }
+  else
+    {
+      interned = g_strdup (string);
+      count = GUINT_TO_POINTER (0);
+    }
+
+  g_hash_table_insert (store->strings, interned, GUINT_TO_POINTER (GPOINTER_TO_UINT (count) + 1));
+
+  return interned;
+}
+
+static void
+im_message_store_unref_string (ImMessageStore *store,
+                               const gchar    *interned)
+{
+  guint count;
+
+  count = GPOINTER_TO_UINT (g_hash_table_lookup (store->strings, interned));
+
+  if (count > 1)
+    {
+      g_hash_table_steal (store->strings, interned);
+      g_hash_table_insert (store->strings, (gpointer) interned, GUINT_TO_POINTER (count - 1));
+    }
+  else
+    {
+      g_hash_table_remove (store->strings, interned);
+    }
+}
+
+static gint
+im_message_store_lookup_app (ImMessageStore *store,
+                             const gchar    *app_id)
+{
+  return GPOINTER_TO_INT (g_hash_table_lookup (store->app_indexes, app_id)) - 1;
+}
+
+static guint
+im_message_store_ensure_app (ImMessageStore *store,
+                             const gchar    *app_id)
+{
+  gint app;
+
+  app = im_message_store_lookup_app (store, app_id);
+  if (app >= 0)
+    return app;
+
+  app = store->app_ids->len;
+  g_ptr_array_add (store->app_ids, g_strdup (app_id));
+  g_ptr_array_add (store->app_messages, g_hash_table_new_full (g_str_hash, g_str_equal, NULL, g_free));
+  g_hash_table_insert (store->app_indexes, g_ptr_array_index (store->app_ids, app), GINT_TO_POINTER (app + 1));
+
+  return app;
+}
+
+/* Returns the first row that is older than @time, or, if @inclusive is
+ * TRUE, the first row that is not newer than @time. */
+static guint
+im_message_store_bisect (ImMessageStore *store,
+                         gint64          time,
+                         gboolean        inclusive)
+{
+  const gint64 *times = (const gint64 *) store->times->data;
+  guint lo = 0;
+  guint hi = store->times->len;
+
+  while (lo < hi)
+    {
+      guint mid = lo + (hi - lo) / 2;
+
+      if (times[mid] > time || (!inclusive && times[mid] == time))
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  return lo;
+}
+
+ImMessageStore *
+im_message_store_new (void)
+{
+  ImMessageStore *store;
+
+  store = g_slice_new (ImMessageStore);
+  store->times = g_array_new (FALSE, FALSE, sizeof (gint64));
+  store->apps = g_array_new (FALSE, FALSE, sizeof (guint));
+  store->ids = g_array_new (FALSE, FALSE, sizeof (const gchar *));
+  store->messages = g_array_new (FALSE, FALSE, sizeof (GVariant *));
+  store->strings = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  store->app_ids = g_ptr_array_new_with_free_func (g_free);
+  store->app_indexes = g_hash_table_new (g_str_hash, g_str_equal);
+  store->app_messages = g_ptr_array_new_with_free_func ((GDestroyNotify) g_hash_table_unref);
+
+  return store;
+}
+
+void
+im_message_store_free (ImMessageStore *store)
+{
+  g_return_if_fail (store != NULL);
+
+  im_message_store_remove_all (store);
+
+  g_array_unref (store->times);
+  g_array_unref (store->apps);
+  g_array_unref (store->ids);
+  g_array_unref (store->messages);
+  g_ptr_array_unref (store->app_messages);
+  g_hash_table_unref (store->app_indexes);
+  g_ptr_array_unref (store->app_ids);
+  g_hash_table_unref (store->strings);
+
+  g_slice_free (ImMessageStore, store);
+}
+
+/*
+ * Inserts a message after all messages that are at least as new as
+ * @time and returns its row. @app_id must not have a message with @id
+ * in @store yet. @message is kept alongside, if it isn't NULL.
+ */
+guint
+im_message_store_insert (ImMessageStore *store,
+                         const gchar    *app_id,
+                         const gchar    *id,
+                         gint64          time,
+                         GVariant       *message)
+{
+  guint app;
+  const gchar *interned;
+  gint64 *indexed_time;
+  guint n_messages;
+  guint row;
+
+  g_return_val_if_fail (store != NULL, 0);
+  g_return_val_if_fail (app_id != NULL && id != NULL, 0);
+
+  app = im_message_store_ensure_app (store, app_id);
+  g_return_val_if_fail (!g_hash_table_contains (g_ptr_array_index (store->app_messages, app), id), 0);
+
+  interned = im_message_store_ref_string (store, id);
+  if (message)
+    g_variant_ref (message);
+
+  /* applications send their messages newest first, which makes
+   * appending the common case */
+  n_messages = store->times->len;
+  if (n_messages == 0 || time <= g_array_index (store->times, gint64, n_messages - 1))
+    row = n_messages;
+  else
+    row = im_message_store_bisect (store, time, FALSE);
+
+  g_array_insert_val (store->times, row, time);
+  g_array_insert_val (store->apps, row, app);
+  g_array_insert_val (store->ids, row, interned);
+  g_array_insert_val (store->messages, row, message);
+
+  indexed_time = g_new (gint64, 1);
+  *indexed_time = time;
+  g_hash_table_insert (g_ptr_array_index (store->app_messages, app), (gpointer) interned, indexed_time);
+
+  return row;
+}
+
+/*
+ * Returns the row of the message with @id from @app_id, or -1 if there
+ * is no such message.
+ */
+gint
+im_message_store_lookup (ImMessageStore *store,
+                         const gchar    *app_id,
+                         const gchar    *id)
+{
+  gint app;
+  gpointer interned;
+  gpointer time;
+  guint row;
+
+  g_return_val_if_fail (store != NULL, -1);
+  g_return_val_if_fail (app_id != NULL && id != NULL, -1);
+
+  app = im_message_store_lookup_app (store, app_id);
+  if (app < 0)
+    return -1;
+
+  if (!g_hash_table_lookup_extended (g_ptr_array_index (store->app_messages, app), id, &interned, &time))
+    return -1;
+
+  /* messages with the same time are next to each other */
+  for (row = im_message_store_bisect (store, *(gint64 *) time, TRUE);
+       row < store->times->len && g_array_index (store->times, gint64, row) == *(gint64 *) time;
+       row++)
+    {
+      if (g_array_index (store->apps, guint, row) == (guint) app &&
+          g_array_index (store->ids, const gchar *, row) == interned)
+        return row;
+    }
+
+  g_warn_if_reached ();
+  return -1;
+}
+
+void
+im_message_store_remove_row (ImMessageStore *store,
+                             guint           row)
+{
+  guint app;
+  const gchar *id;
+  GVariant *message;
+
+  g_return_if_fail (store != NULL);
+  g_return_if_fail (row < store->times->len);
+
+  app = g_array_index (store->apps, guint, row);
+  id = g_array_index (store->ids, const gchar *, row);
+  message = g_array_index (store->messages, GVariant *, row);
+
+  g_hash_table_remove (g_ptr_array_index (store->app_messages, app), id);
+
+  g_array_remove_index (store->times, row);
+  g_array_remove_index (store->apps, row);
+  g_array_remove_index (store->ids, row);
+  g_array_remove_index (store->messages, row);
+
+  im_message_store_unref_string (store, id);
+  if (message)
+    g_variant_unref (message);
+}
+
+/* Removes all messages of @app_id */
+void
+im_message_store_remove_app (ImMessageStore *store,
+                             const gchar    *app_id)
+{
+  gint app;
+  guint n_app_messages;
+  gint row;
+
+  g_return_if_fail (store != NULL);
+  g_return_if_fail (app_id != NULL);
+
+  app = im_message_store_lookup_app (store, app_id);
+  if (app < 0)
+    return;
+
+  n_app_messages = g_hash_table_size (g_ptr_array_index (store->app_messages, app));
+  for (row = (gint) store->times->len - 1; row >= 0 && n_app_messages > 0; row--)
+    {
+      if (g_array_index (store->apps, guint, row) == (guint) app)
+        {
+          im_message_store_remove_row (store, row);
+          n_app_messages--;
+        }
+    }
+}
+
+void
+im_message_store_remove_all (ImMessageStore *store)
+{
+  guint i;
+
+  g_return_if_fail (store != NULL);
+
+  for (i = 0; i < store->messages->len; i++)
+    {
+      GVariant *message = g_array_index (store->messages, GVariant *, i);
+
+      if (message)
+        g_variant_unref (message);
+    }
+
+  g_array_set_size (store->times, 0);
+  g_array_set_size (store->apps, 0);
+  g_array_set_size (store->ids, 0);
+  g_array_set_size (store->messages, 0);
+
+  for (i = 0; i < store->app_messages->len; i++)
+    g_hash_table_remove_all (g_ptr_array_index (store->app_messages, i));
+
+  g_hash_table_remove_all (store->strings);
+}
+
+guint
+im_message_store_get_n_messages (ImMessageStore *store)
+{
+  g_return_val_if_fail (store != NULL, 0);
+
+  return store->times->len;
+}
+
+guint
+im_message_store_get_n_app_messages (ImMessageStore *store,
+                                     const gchar    *app_id)
+{
+  gint app;
+
+  g_return_val_if_fail (store != NULL, 0);
+  g_return_val_if_fail (app_id != NULL, 0);
+
+  app = im_message_store_lookup_app (store, app_id);
+  if (app < 0)
+    return 0;
+
+  return g_hash_table_size (g_ptr_array_index (store->app_messages, app));
+}
+
+const gchar *
+im_message_store_get_id (ImMessageStore *store,
+                         guint           row)
+{
+  g_return_val_if_fail (store != NULL, NULL);
+  g_return_val_if_fail (row < store->times->len, NULL);
+
+  return g_array_index (store->ids, const gchar *, row);
+}
+
+gint64
+im_message_store_get_time (ImMessageStore *store,
+                           guint           row)
+{
+  g_return_val_if_fail (store != NULL, 0);
+  g_return_val_if_fail (row < store->times->len, 0);
+
+  return g_array_index (store->times, gint64, row);
+}
+
+GVariant *
+im_message_store_get_message (ImMessageStore *store,
+                              guint           row)
+{
+  g_return_val_if_fail (store != NULL, NULL);
+  g_return_val_if_fail (row < store->times->len, NULL);
+
+  return g_array_index (store->messages, GVariant *, row);
+}
+
+/*
+ * Returns the rows of all messages of @app_id, newest first, and
+ * stores their number in @n_rows. Free the result with g_free().
+ */
+guint *
+im_message_store_get_app_rows (ImMessageStore *store,
+                               const gchar    *app_id,
+                               guint          *n_rows)
+{
+  gint app;
+  guint *rows;
+  guint n;
+  guint row;
+
+  g_return_val_if_fail (store != NULL, NULL);
+  g_return_val_if_fail (app_id != NULL && n_rows != NULL, NULL);
+
+  app = im_message_store_lookup_app (store, app_id);
+  n = app >= 0 ? g_hash_table_size (g_ptr_array_index (store->app_messages, app)) : 0;
+  rows = g_new (guint, n);
+
+  *n_rows = 0;
+  for (row = 0; *n_rows < n; row++)
+    {
+      if (g_array_index (store->apps, guint, row) == (guint) app)
+        rows[(*n_rows)++] = row;
+    }
+
+  return rows;
+}
+
+/*
+ * Returns the row of the oldest message of @app_id, or -1 if it has no
+ * messages.
+ */
+gint
+im_message_store_get_oldest_app_row (ImMessageStore *store,
+                                     const gchar    *app_id)
+{
+  const guint *apps;
+  gint app;
+  gint row;
+
+  g_return_val_if_fail (store != NULL, -1);
+  g_return_val_if_fail (app_id != NULL, -1);
+
+  app = im_message_store_lookup_app (store, app_id);
+  if (app < 0)
+    return -1;
+
+  apps = (const guint *) store->apps->data;
+  for (row = (gint) store->apps->len - 1; row >= 0; row--)
+    {
+      if (apps[row] == (guint) app)
+        return row;
+    }
+
+  return -1;
+}
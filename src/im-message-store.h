@@ -0,0 +1,67 @@
+/*
+ * Copyright 2013 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __IM_MESSAGE_STORE_H__
+#define __IM_MESSAGE_STORE_H__
+
+#include <glib.h>
+
+typedef struct _ImMessageStore ImMessageStore;
+
+ImMessageStore *    im_message_store_new                    (void);
+
+void                im_message_store_free                   (ImMessageStore *store);
+
+guint               im_message_store_insert                 (ImMessageStore *store,
+                                                             const gchar    *app_id,
+                                                             const gchar    *id,
+                                                             gint64          time,
+                                                             GVariant       *message);
+
+gint                im_message_store_lookup                 (ImMessageStore *store,
+                                                             const gchar    *app_id,
+                                                             const gchar    *id);
+
+void                im_message_store_remove_row             (ImMessageStore *store,
+                                                             guint           row);
+
+void                im_message_store_remove_app             (ImMessageStore *store,
+                                                             const gchar    *app_id);
+
+void                im_message_store_remove_all             (ImMessageStore *store);
+
+guint               im_message_store_get_n_messages         (ImMessageStore *store);
+
+guint               im_message_store_get_n_app_messages     (ImMessageStore *store,
+                                                             const gchar    *app_id);
+
+const gchar *       im_message_store_get_id                 (ImMessageStore *store,
+                                                             guint           row);
+
+gint64              im_message_store_get_time               (ImMessageStore *store,
+                                                             guint           row);
+
+GVariant *          im_message_store_get_message            (ImMessageStore *store,
+                                                             guint           row);
+
+guint *             im_message_store_get_app_rows           (ImMessageStore *store,
+                                                             const gchar    *app_id,
+                                                             guint          *n_rows);
+
+gint                im_message_store_get_oldest_app_row     (ImMessageStore *store,
+                                                             const gchar    *app_id);
+
+#endif
@@ -18,6 +18,7 @@
  */
 
 #include "im-phone-menu.h"
+#include "im-message-store.h"
 
 #include <string.h>
 #include <glib/gi18n.h>
@@ -31,6 +32,8 @@ struct _ImPhoneMenu
   GMenu *message_section;
   GMenu *source_section;
   GMenu *clear_section;
+
+  ImMessageStore *messages;     /* of the application list; row i is item i of message_section */
 };
 
 G_DEFINE_TYPE (ImPhoneMenu, im_phone_menu, IM_TYPE_MENU);
@@ -96,9 +99,14 @@ im_phone_menu_constructed (GObject *object)
   im_menu_append_section (IM_MENU (menu), G_MENU_MODEL (menu->clear_section));
 
   applist = im_menu_get_application_list (IM_MENU (menu));
+  menu->messages = im_application_list_get_message_store (applist);
+
+  /* items are only ever added in message-added */
+  g_warn_if_fail (im_message_store_get_n_messages (menu->messages) == 0);
 
   g_signal_connect_swapped (applist, "message-added", G_CALLBACK (im_phone_menu_add_message), menu);
   g_signal_connect_swapped (applist, "message-removed", G_CALLBACK (im_phone_menu_remove_message), menu);
+  g_signal_connect_swapped (applist, "messages-removed", G_CALLBACK (im_phone_menu_remove_messages), menu);
   g_signal_connect_swapped (applist, "app-stopped", G_CALLBACK (im_phone_menu_remove_application), menu);
   g_signal_connect_swapped (applist, "remove-all", G_CALLBACK (im_phone_menu_remove_all), menu);
 
@@ -117,12 +125,6 @@ im_phone_menu_dispose (GObject *object)
   G_OBJECT_CLASS (im_phone_menu_parent_class)->dispose (object);
 }
 
-static void
-im_phone_menu_finalize (GObject *object)
-{
-  G_OBJECT_CLASS (im_phone_menu_parent_class)->finalize (object);
-}
-
 static void
 im_phone_menu_class_init (ImPhoneMenuClass *klass)
 {
@@ -130,7 +132,6 @@ im_phone_menu_class_init (ImPhoneMenuClass *klass)
 
   object_class->constructed = im_phone_menu_constructed;
   object_class->dispose = im_phone_menu_dispose;
-  object_class->finalize = im_phone_menu_finalize;
 }
 
 static void
@@ -152,33 +153,21 @@ im_phone_menu_new (ImApplicationList  *applist, gboolean greeter)
                        NULL);
 }
 
-static gint64
-im_phone_menu_get_message_time (GMenuModel *model,
-                                gint        i)
-{
-  gint64 time;
-
-  g_menu_model_get_item_attribute (model, i, "x-canonical-time", "x", &time);
-
-  return time;
-}
-
 void
 im_phone_menu_add_message (ImPhoneMenu     *menu,
                            const gchar     *app_id,
                            GIcon           *app_icon,
                            const gchar     *id,
                            GVariant        *serialized_icon,
-                           const gchar     *title,
-                           const gchar     *subtitle,
-                           const gchar     *body,
+                           GVariant        *title,
+                           GVariant        *subtitle,
+                           GVariant        *body,
                            GVariant        *actions,
                            gint64           time)
 {
   GMenuItem *item;
   gchar *action_name;
-  gint n_messages;
-  gint pos;
+  gint row;
   GVariant *serialized_app_icon;
   gboolean show_data;
 
@@ -188,15 +177,16 @@ im_phone_menu_add_message (ImPhoneMenu     *menu,
   show_data = im_menu_show_data(IM_MENU (menu));
   action_name = g_strconcat (app_id, ".msg.", id, NULL);
 
-  item = g_menu_item_new (title, NULL);
+  item = g_menu_item_new (NULL, NULL);
+  g_menu_item_set_attribute_value (item, G_MENU_ATTRIBUTE_LABEL, title);
   g_menu_item_set_action_and_target_value (item, action_name, g_variant_new_boolean (TRUE));
 
   g_menu_item_set_attribute (item, "x-canonical-type", "s", "com.canonical.indicator.messages.messageitem");
   g_menu_item_set_attribute (item, "x-canonical-message-id", "s", id);
   if (show_data)
-    g_menu_item_set_attribute (item, "x-canonical-subtitle", "s", subtitle);
+    g_menu_item_set_attribute_value (item, "x-canonical-subtitle", subtitle);
   if (show_data)
-    g_menu_item_set_attribute (item, "x-canonical-text", "s", body);
+    g_menu_item_set_attribute_value (item, "x-canonical-text", body);
   g_menu_item_set_attribute (item, "x-canonical-time", "x", time);
 
   if (serialized_icon)
@@ -211,13 +201,10 @@ im_phone_menu_add_message (ImPhoneMenu     *menu,
   if (actions && show_data)
     g_menu_item_set_attribute (item, "x-canonical-message-actions", "v", actions);
 
-  n_messages = g_menu_model_get_n_items (G_MENU_MODEL (menu->message_section));
-  pos = 0;
-  while (pos < n_messages &&
-         time < im_phone_menu_get_message_time (G_MENU_MODEL (menu->message_section), pos))
-    pos++;
-
-  g_menu_insert_item (menu->message_section, pos, item);
+  /* the message was added to the store already */
+  row = im_message_store_lookup (menu->messages, app_id, id);
+  if (row >= 0)
+    g_menu_insert_item (menu->message_section, row, item);
 
   im_phone_menu_update_clear_section (menu);
 
@@ -225,24 +212,74 @@ im_phone_menu_add_message (ImPhoneMenu     *menu,
   g_object_unref (item);
 }
 
+static void
+im_phone_menu_remove_message_item (ImPhoneMenu *menu,
+                                   const gchar *app_id,
+                                   const gchar *id)
+{
+  gint row;
+
+  row = im_message_store_lookup (menu->messages, app_id, id);
+  if (row >= 0)
+    g_menu_remove (menu->message_section, row);
+}
+
 void
 im_phone_menu_remove_message (ImPhoneMenu     *menu,
                               const gchar     *app_id,
                               const gchar     *id)
 {
-  gchar *action_name;
-
   g_return_if_fail (IM_IS_PHONE_MENU (menu));
   g_return_if_fail (app_id != NULL);
 
-  action_name = g_strconcat (app_id, ".msg.", id, NULL);
-  im_phone_menu_foreach_item_with_action (G_MENU_MODEL (menu->message_section),
-                                          action_name,
-                                          (ImMenuForeachFunc) g_menu_remove);
+  im_phone_menu_remove_message_item (menu, app_id, id);
 
   im_phone_menu_update_clear_section (menu);
+}
 
-  g_free (action_name);
+static gint
+compare_rows_descending (gconstpointer a,
+                         gconstpointer b,
+                         gpointer      user_data)
+{
+  gint row_a = *(const gint *) a;
+  gint row_b = *(const gint *) b;
+
+  return row_b - row_a;
+}
+
+/* Removes the items of all messages in @ids, finding each of them
+ * through the message store instead of scanning the menu. The store
+ * still has the messages, so the items are removed from the last one
+ * on to keep the rows of the others valid. */
+void
+im_phone_menu_remove_messages (ImPhoneMenu         *menu,
+                               const gchar         *app_id,
+                               const gchar * const *ids)
+{
+  gint *rows;
+  guint n_rows = 0;
+  guint i;
+
+  g_return_if_fail (IM_IS_PHONE_MENU (menu));
+  g_return_if_fail (app_id != NULL);
+
+  rows = g_new (gint, g_strv_length ((gchar **) ids));
+  for (i = 0; ids[i]; i++)
+    {
+      gint row = im_message_store_lookup (menu->messages, app_id, ids[i]);
+
+      if (row >= 0)
+        rows[n_rows++] = row;
+    }
+
+  g_qsort_with_data (rows, n_rows, sizeof (gint), compare_rows_descending, NULL);
+  for (i = 0; i < n_rows; i++)
+    g_menu_remove (menu->message_section, rows[i]);
+
+  g_free (rows);
+
+  im_phone_menu_update_clear_section (menu);
 }
 
 void
@@ -327,11 +364,19 @@ void
 im_phone_menu_remove_application (ImPhoneMenu     *menu,
                                   const gchar     *app_id)
 {
+  guint *rows;
+  guint n_rows;
+
   g_return_if_fail (IM_IS_PHONE_MENU (menu));
   g_return_if_fail (app_id != NULL);
 
   im_phone_menu_remove_all_for_app (menu->source_section, app_id);
-  im_phone_menu_remove_all_for_app (menu->message_section, app_id);
+
+  /* the store still has the messages, so start with the oldest */
+  rows = im_message_store_get_app_rows (menu->messages, app_id, &n_rows);
+  while (n_rows > 0)
+    g_menu_remove (menu->message_section, rows[--n_rows]);
+  g_free (rows);
 
   im_phone_menu_update_clear_section (menu);
 }
@@ -41,9 +41,9 @@ void                im_phone_menu_add_message           (ImPhoneMenu        *men
                                                          GIcon              *app_icon,
                                                          const gchar        *id,
                                                          GVariant           *serialized_icon,
-                                                         const gchar        *title,
-                                                         const gchar        *subtitle,
-                                                         const gchar        *body,
+                                                         GVariant           *title,
+                                                         GVariant           *subtitle,
+                                                         GVariant           *body,
                                                          GVariant           *actions,
                                                          gint64              time);
 
@@ -51,6 +51,10 @@ void                im_phone_menu_remove_message        (ImPhoneMenu        *men
                                                          const gchar        *app_id,
                                                          const gchar        *id);
 
+void                im_phone_menu_remove_messages       (ImPhoneMenu        *menu,
+                                                         const gchar        *app_id,
+                                                         const gchar * const *ids);
+
 void                im_phone_menu_add_source            (ImPhoneMenu        *menu,
                                                          const gchar        *app_id,
                                                          const gchar        *id,
@@ -34,14 +34,19 @@ with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "im-phone-menu.h"
 #include "im-desktop-menu.h"
 #include "im-application-list.h"
+#include "im-action-exporter.h"
+#include "im-app-info-cache.h"
+#include "message-body.h"
 
 #define NUM_STATUSES 5
 
 static ImApplicationList *applications;
 
 static IndicatorMessagesService *messages_service;
+static const gchar *capabilities[] = { BODY_CAPABILITY, NULL };
 static GHashTable *menus;
 static GSettings *settings;
+static GSettingsStrvSet *registered_apps;
 
 enum {
 	DBUS_ERROR_BAD_DESKTOP_FILE,
@@ -68,7 +73,7 @@ register_application (IndicatorMessagesService *service,
 	sender = g_dbus_method_invocation_get_sender (invocation);
 
 	im_application_list_set_remote (applications, desktop_id, bus, sender, menu_path);
-	g_settings_strv_append_unique (settings, "applications", desktop_id);
+	g_settings_strv_set_add (registered_apps, desktop_id);
 
 	indicator_messages_service_complete_register_application (service, invocation);
 
@@ -82,7 +87,7 @@ unregister_application (IndicatorMessagesService *service,
 			gpointer user_data)
 {
 	im_application_list_remove (applications, desktop_id);
-	g_settings_strv_remove (settings, "applications", desktop_id);
+	g_settings_strv_set_remove (registered_apps, desktop_id);
 
 	indicator_messages_service_complete_unregister_application (service, invocation);
 
@@ -106,7 +111,7 @@ set_status (IndicatorMessagesService *service,
 			      g_str_equal (status_str, "offline"),
 			      FALSE);
 
-	appinfo = g_desktop_app_info_new (desktop_id);
+	appinfo = im_app_info_cache_lookup (desktop_id);
 	if (!appinfo) {
 		g_warning ("could not set status for '%s', there's no desktop file with that id", desktop_id);
 		return TRUE;
@@ -132,7 +137,7 @@ app_stopped (IndicatorMessagesService *service,
 	GDesktopAppInfo *appinfo;
 	const gchar *id;
 
-	appinfo = g_desktop_app_info_new (desktop_id);
+	appinfo = im_app_info_cache_lookup (desktop_id);
 	if (!appinfo)
 		return TRUE;
 
@@ -145,6 +150,17 @@ app_stopped (IndicatorMessagesService *service,
 	return TRUE;
 }
 
+static gboolean
+get_throttled_signals (IndicatorMessagesService *service,
+		       GDBusMethodInvocation *invocation,
+		       gpointer user_data)
+{
+	indicator_messages_service_complete_get_throttled_signals (service, invocation,
+								   im_application_list_get_throttled_counts (applications));
+
+	return TRUE;
+}
+
 /* The status has been set by the user, let's tell the world! */
 static void
 status_set_by_user (ImApplicationList * list, const gchar * status, gpointer user_data)
@@ -166,9 +182,9 @@ on_bus_acquired (GDBusConnection *bus,
 	/* Register some errors */
 	g_dbus_error_register_error (dbus_error_quark(), DBUS_ERROR_BAD_DESKTOP_FILE, "BadDesktopFile");
 
-	g_dbus_connection_export_action_group (bus, INDICATOR_MESSAGES_DBUS_OBJECT,
-					       im_application_list_get_action_group (applications),
-					       &error);
+	im_action_exporter_export (bus, INDICATOR_MESSAGES_DBUS_OBJECT,
+				   im_application_list_get_action_group (applications),
+				   &error);
 	if (error) {
 		g_warning ("unable to export action group on dbus: %s", error->message);
 		g_error_free (error);
@@ -213,11 +229,37 @@ sig_term_handler (gpointer user_data)
 {
 	GMainLoop *mainloop = user_data;
 
+	/* don't lose registrations that weren't written yet */
+	g_settings_strv_set_flush (registered_apps);
+
 	g_main_loop_quit (mainloop);
 
 	return FALSE;
 }
 
+static void
+max_messages_changed (GSettings   *settings,
+		      const gchar *key,
+		      gpointer     user_data)
+{
+	ImApplicationList *applications = user_data;
+
+	im_application_list_set_max_messages (applications,
+					      g_settings_get_uint (settings, "max-messages"));
+}
+
+static void
+flow_control_changed (GSettings   *settings,
+		      const gchar *key,
+		      gpointer     user_data)
+{
+	ImApplicationList *applications = user_data;
+
+	im_application_list_set_flow_control (applications,
+					      g_settings_get_uint (settings, "max-signal-rate"),
+					      g_settings_get_uint (settings, "max-signal-burst"));
+}
+
 int
 main (int argc, char ** argv)
 {
@@ -239,6 +281,7 @@ main (int argc, char ** argv)
 
 	/* Bring up the service DBus interface */
 	messages_service = indicator_messages_service_skeleton_new ();
+	indicator_messages_service_set_capabilities (messages_service, capabilities);
 
 	flags = G_BUS_NAME_OWNER_FLAGS_ALLOW_REPLACEMENT;
 	if (argc >= 2 && g_str_equal (argv[1], "--replace"))
@@ -255,19 +298,32 @@ main (int argc, char ** argv)
 			  G_CALLBACK (set_status), NULL);
 	g_signal_connect (messages_service, "handle-application-stopped-running",
 			  G_CALLBACK (app_stopped), NULL);
+	g_signal_connect (messages_service, "handle-get-throttled-signals",
+			  G_CALLBACK (get_throttled_signals), NULL);
 
 	applications = im_application_list_new ();
 	g_signal_connect (applications, "status-set",
 			  G_CALLBACK (status_set_by_user), NULL);
 
 	settings = g_settings_new ("com.canonical.indicator.messages");
+	g_signal_connect (settings, "changed::max-messages",
+			  G_CALLBACK (max_messages_changed), applications);
+	max_messages_changed (settings, "max-messages", applications);
+	g_signal_connect (settings, "changed::max-signal-rate",
+			  G_CALLBACK (flow_control_changed), applications);
+	g_signal_connect (settings, "changed::max-signal-burst",
+			  G_CALLBACK (flow_control_changed), applications);
+	flow_control_changed (settings, NULL, applications);
+	registered_apps = g_settings_strv_set_new (settings, "applications");
 	{
 		gchar **app_ids;
 		gchar **id;
 
+		/* desktop files are loaded in parallel, and applications
+		 * appear one by one as soon as theirs is parsed */
 		app_ids = g_settings_get_strv (settings, "applications");
 		for (id = app_ids; *id; id++)
-			im_application_list_add (applications, *id);
+			im_application_list_add_async (applications, *id);
 
 		g_strfreev (app_ids);
 	}
@@ -278,6 +334,17 @@ main (int argc, char ** argv)
 	g_hash_table_insert (menus, "desktop", im_desktop_menu_new (applications));
 	g_hash_table_insert (menus, "desktop_greeter", im_desktop_menu_new (applications));
 
+	/* show what was there before the service was restarted, before
+	 * applications had a chance to reconnect */
+	{
+		gchar *snapshot_path;
+
+		snapshot_path = g_build_filename (g_get_user_runtime_dir (), "indicator-messages", "snapshot", NULL);
+		im_application_list_load_snapshot (applications, snapshot_path);
+
+		g_free (snapshot_path);
+	}
+
 	g_unix_signal_add(SIGTERM, sig_term_handler, mainloop);
 
 	g_main_loop_run(mainloop);
@@ -285,6 +352,7 @@ main (int argc, char ** argv)
 	/* Clean up */
 	g_hash_table_unref (menus);
 	g_object_unref (messages_service);
+	g_settings_strv_set_free (registered_apps);
 	g_object_unref (settings);
 	g_object_unref (applications);
 	return 0;
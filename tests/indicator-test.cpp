@@ -19,6 +19,10 @@
 
 #include <gtest/gtest.h>
 #include <gio/gio.h>
+#include <glib/gstdio.h>
+
+#include <signal.h>
+#include <sys/wait.h>
 
 #include "indicator-fixture.h"
 #include "accounts-service-mock.h"
@@ -35,6 +39,7 @@ protected:
 	}
 
 	std::shared_ptr<AccountsServiceMock> as;
+	std::string runtimeDir;
 
 	virtual void SetUp() override
 	{
@@ -43,6 +48,13 @@ protected:
 
 		g_setenv("XDG_DATA_DIRS", XDG_DATA_DIRS, TRUE);
 
+		/* keep the service's snapshot away from the user's and from other tests */
+		auto dir = g_dir_make_tmp("indicator-messages-test-XXXXXX", nullptr);
+		ASSERT_NE(nullptr, dir);
+		runtimeDir = dir;
+		g_free(dir);
+		g_setenv("XDG_RUNTIME_DIR", runtimeDir.c_str(), TRUE);
+
 		as = std::make_shared<AccountsServiceMock>();
 		addMock(*as);
 
@@ -54,6 +66,53 @@ protected:
 		as.reset();
 
 		IndicatorFixture::TearDown();
+
+		auto snapshotDir = g_build_filename(runtimeDir.c_str(), "indicator-messages", nullptr);
+		auto snapshot = g_build_filename(snapshotDir, "snapshot", nullptr);
+		g_remove(snapshot);
+		g_rmdir(snapshotDir);
+		g_rmdir(runtimeDir.c_str());
+		g_free(snapshot);
+		g_free(snapshotDir);
+	}
+
+	/* Stops the service, which writes its snapshot on the way out */
+	void stopService (GDBusConnection * bus)
+	{
+		GVariant * reply = g_dbus_connection_call_sync(bus,
+			"org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus",
+			"GetConnectionUnixProcessID", g_variant_new("(s)", "com.canonical.indicator.messages"),
+			G_VARIANT_TYPE("(u)"), G_DBUS_CALL_FLAGS_NONE, -1, nullptr, nullptr);
+		ASSERT_NE(nullptr, reply);
+
+		guint32 pid;
+		g_variant_get(reply, "(u)", &pid);
+		g_variant_unref(reply);
+
+		bool running = true;
+		auto watch = g_bus_watch_name_on_connection(bus, "com.canonical.indicator.messages",
+			G_BUS_NAME_WATCHER_FLAGS_NONE, nullptr,
+			[](GDBusConnection * connection, const gchar * name, gpointer user_data) {
+				*reinterpret_cast<bool *>(user_data) = false;
+			}, &running, nullptr);
+
+		kill(pid, SIGTERM);
+		EXPECT_EVENTUALLY_EQ(false, running);
+
+		g_bus_unwatch_name(watch);
+	}
+
+	/* Starts another instance of the service, which restores the
+	 * snapshot of the previous one. It inherits the environment of the
+	 * test, unless @envp is given. */
+	GPid startService (gchar ** envp = nullptr)
+	{
+		gchar * argv[] = { (gchar *) INDICATOR_MESSAGES_SERVICE_BINARY, nullptr };
+		GPid pid = 0;
+
+		g_spawn_async(nullptr, argv, envp, G_SPAWN_DO_NOT_REAP_CHILD, nullptr, nullptr, &pid, nullptr);
+
+		return pid;
 	}
 
 };
@@ -207,3 +266,487 @@ TEST_F(IndicatorTest, IconNotification) {
 
 	EXPECT_EVENTUALLY_ACTION_STATE("messages", normalicon);
 }
+
+static void
+messagesRemovedSignal (GDBusConnection * connection, const gchar * sender, const gchar * path, const gchar * interface, const gchar * signal, GVariant * params, gpointer user_data) {
+	auto removed = reinterpret_cast<std::vector<std::vector<std::string>> *>(user_data);
+	const gchar ** ids;
+
+	g_variant_get(params, "(^a&s)", &ids);
+	removed->push_back(std::vector<std::string>(ids, ids + g_strv_length((gchar **) ids)));
+	g_free(ids);
+}
+
+static MessagingMenuMessage *
+newMessage (const std::string& id, gint64 time) {
+	return messaging_menu_message_new(id.c_str(), nullptr, id.c_str(), nullptr, nullptr, time);
+}
+
+TEST_F(IndicatorTest, MaxMessages) {
+	setActions("/com/canonical/indicator/messages");
+
+	auto app = std::shared_ptr<MessagingMenuApp>(messaging_menu_app_new("test.desktop"), [](MessagingMenuApp * app) { g_clear_object(&app); });
+	ASSERT_NE(nullptr, app);
+	messaging_menu_app_register(app.get());
+
+	EXPECT_EVENTUALLY_ACTION_EXISTS("test.launch");
+
+	messaging_menu_app_set_max_messages(app.get(), 3);
+
+	for (int i = 1; i <= 3; i++) {
+		auto msg = newMessage("m" + std::to_string(i), i);
+		messaging_menu_app_append_message(app.get(), msg, nullptr, FALSE);
+		g_object_unref(msg);
+	}
+
+	EXPECT_EVENTUALLY_ACTION_EXISTS("test.msg.m3");
+	EXPECT_ACTION_EXISTS("test.msg.m1");
+
+	std::vector<std::vector<std::string>> removed;
+	auto bus = g_bus_get_sync(G_BUS_TYPE_SESSION, nullptr, nullptr);
+	auto subscription = g_dbus_connection_signal_subscribe(bus, nullptr,
+		"com.canonical.indicator.messages.application", "MessagesRemoved",
+		nullptr, nullptr, G_DBUS_SIGNAL_FLAGS_NONE,
+		messagesRemovedSignal, &removed, nullptr);
+
+	/* the two oldest make room, and are removed with a single signal */
+	GList * messages = nullptr;
+	messages = g_list_append(messages, newMessage("m4", 4));
+	messages = g_list_append(messages, newMessage("m5", 5));
+	messaging_menu_app_append_messages(app.get(), messages, nullptr, FALSE);
+	g_list_free_full(messages, g_object_unref);
+
+	EXPECT_EVENTUALLY_ACTION_EXISTS("test.msg.m5");
+	EXPECT_EVENTUALLY_ACTION_DOES_NOT_EXIST("test.msg.m2");
+	EXPECT_ACTION_DOES_NOT_EXIST("test.msg.m1");
+	EXPECT_ACTION_EXISTS("test.msg.m3");
+	EXPECT_ACTION_EXISTS("test.msg.m4");
+
+	EXPECT_EVENTUALLY_EQ(1u, removed.size());
+	EXPECT_EQ(std::vector<std::string>({"m1", "m2"}), removed[0]);
+
+	/* lowering the limit evicts right away */
+	messaging_menu_app_set_max_messages(app.get(), 2);
+
+	EXPECT_EVENTUALLY_ACTION_DOES_NOT_EXIST("test.msg.m3");
+	EXPECT_EVENTUALLY_EQ(2u, removed.size());
+	EXPECT_EQ(std::vector<std::string>({"m3"}), removed[1]);
+
+	setMenu("/com/canonical/indicator/messages/phone");
+
+	EXPECT_EVENTUALLY_MENU_ATTRIB(std::vector<int>({0, 0, 0}), "x-canonical-message-id", "m5");
+	EXPECT_MENU_ATTRIB(std::vector<int>({0, 0, 1}), "x-canonical-message-id", "m4");
+
+	g_dbus_connection_signal_unsubscribe(bus, subscription);
+	g_object_unref(bus);
+}
+
+TEST_F(IndicatorTest, MessagesAddedReplaces) {
+	setActions("/com/canonical/indicator/messages");
+
+	auto app = std::shared_ptr<MessagingMenuApp>(messaging_menu_app_new("test.desktop"), [](MessagingMenuApp * app) { g_clear_object(&app); });
+	ASSERT_NE(nullptr, app);
+	messaging_menu_app_register(app.get());
+
+	EXPECT_EVENTUALLY_ACTION_EXISTS("test.launch");
+
+	auto msg = newMessage("m1", 1);
+	messaging_menu_app_append_message(app.get(), msg, nullptr, FALSE);
+	g_object_unref(msg);
+
+	setMenu("/com/canonical/indicator/messages/phone");
+
+	EXPECT_EVENTUALLY_MENU_ATTRIB(std::vector<int>({0, 0, 0}), "label", "m1");
+
+	/* a batch with a known id replaces that message, like a single
+	 * MessageAdded does */
+	auto bus = g_bus_get_sync(G_BUS_TYPE_SESSION, nullptr, nullptr);
+	g_dbus_connection_emit_signal(bus, nullptr,
+		"/com/canonical/indicator/messages/test_desktop",
+		"com.canonical.indicator.messages.application", "MessagesAdded",
+		g_variant_new_parsed("([('m1', @av [], 'Updated', '', '', @x 1, @aa{sv} [], false)],)"),
+		nullptr);
+
+	EXPECT_EVENTUALLY_MENU_ATTRIB(std::vector<int>({0, 0, 0}), "label", "Updated");
+	EXPECT_ACTION_EXISTS("test.msg.m1");
+
+	g_object_unref(bus);
+}
+
+TEST_F(IndicatorTest, ServiceMaxMessages) {
+	setActions("/com/canonical/indicator/messages");
+
+	auto app = std::shared_ptr<MessagingMenuApp>(messaging_menu_app_new("test.desktop"), [](MessagingMenuApp * app) { g_clear_object(&app); });
+	ASSERT_NE(nullptr, app);
+	messaging_menu_app_register(app.get());
+
+	EXPECT_EVENTUALLY_ACTION_EXISTS("test.launch");
+
+	/* more than the service's default max-messages of 500 */
+	GList * messages = nullptr;
+	for (int i = 1; i <= 510; i++)
+		messages = g_list_prepend(messages, newMessage("m" + std::to_string(i), i));
+	messaging_menu_app_append_messages(app.get(), messages, nullptr, FALSE);
+	g_list_free_full(messages, g_object_unref);
+
+	setMenu("/com/canonical/indicator/messages/phone");
+
+	EXPECT_EVENTUALLY_MENU_ATTRIB(std::vector<int>({0, 0, 0}), "x-canonical-message-id", "m510");
+	EXPECT_EVENTUALLY_MENU_ATTRIB(std::vector<int>({0, 0, 499}), "x-canonical-message-id", "m11");
+
+	EXPECT_ACTION_EXISTS("test.msg.m11");
+	EXPECT_ACTION_DOES_NOT_EXIST("test.msg.m10");
+	EXPECT_ACTION_DOES_NOT_EXIST("test.msg.m1");
+}
+
+TEST_F(IndicatorTest, LargeBody) {
+	setActions("/com/canonical/indicator/messages");
+
+	auto app = std::shared_ptr<MessagingMenuApp>(messaging_menu_app_new("test.desktop"), [](MessagingMenuApp * app) { g_clear_object(&app); });
+	ASSERT_NE(nullptr, app);
+	messaging_menu_app_register(app.get());
+
+	EXPECT_EVENTUALLY_ACTION_EXISTS("test.launch");
+
+	/* too long to be sent inline, so it is fetched separately */
+	std::string body(100 * 1024, 'x');
+	auto msg = messaging_menu_message_new("large", nullptr, "Large", nullptr, body.c_str(), 1);
+	messaging_menu_app_append_message(app.get(), msg, nullptr, FALSE);
+	g_object_unref(msg);
+
+	EXPECT_EVENTUALLY_ACTION_EXISTS("test.msg.large");
+
+	setMenu("/com/canonical/indicator/messages/phone");
+
+	EXPECT_EVENTUALLY_MENU_ATTRIB(std::vector<int>({0, 0, 0}), "x-canonical-message-id", "large");
+	EXPECT_MENU_ATTRIB(std::vector<int>({0, 0, 0}), "x-canonical-text", body);
+}
+
+struct ChangesReply {
+	GMainLoop * loop;
+	GVariant * reply;
+};
+
+/* Calls GetChangesSince on the application exported by this process
+ * for test.desktop. The call goes through the bus and back, so it
+ * needs the main loop to run. */
+static GVariant *
+getChangesSince (GDBusConnection * bus, guint64 since) {
+	ChangesReply data = { g_main_loop_new(nullptr, FALSE), nullptr };
+
+	g_dbus_connection_call(bus, g_dbus_connection_get_unique_name(bus),
+		"/com/canonical/indicator/messages/test_desktop",
+		"com.canonical.indicator.messages.application", "GetChangesSince",
+		g_variant_new("(t)", since), G_VARIANT_TYPE("(tbba(ssavuxsb)a(savsssxaa{sv}b)as)"),
+		G_DBUS_CALL_FLAGS_NONE, -1, nullptr,
+		[](GObject * obj, GAsyncResult * res, gpointer user_data) {
+			auto data = reinterpret_cast<ChangesReply *>(user_data);
+			data->reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(obj), res, nullptr);
+			g_main_loop_quit(data->loop);
+		}, &data);
+
+	g_main_loop_run(data.loop);
+	g_main_loop_unref(data.loop);
+
+	return data.reply;
+}
+
+static std::vector<std::string>
+changedMessageIds (GVariant * reply) {
+	std::vector<std::string> ids;
+	GVariant * messages = g_variant_get_child_value(reply, 4);
+	GVariantIter iter;
+	GVariant * message;
+
+	g_variant_iter_init(&iter, messages);
+	while ((message = g_variant_iter_next_value(&iter))) {
+		const gchar * id;
+
+		g_variant_get_child(message, 0, "&s", &id);
+		ids.push_back(id);
+		g_variant_unref(message);
+	}
+
+	g_variant_unref(messages);
+	return ids;
+}
+
+static std::vector<std::string>
+removedMessageIds (GVariant * reply) {
+	const gchar ** removed;
+
+	g_variant_get_child(reply, 5, "^a&s", &removed);
+	std::vector<std::string> ids(removed, removed + g_strv_length((gchar **) removed));
+	g_free(removed);
+
+	return ids;
+}
+
+TEST_F(IndicatorTest, ChangesSince) {
+	setActions("/com/canonical/indicator/messages");
+
+	auto app = std::shared_ptr<MessagingMenuApp>(messaging_menu_app_new("test.desktop"), [](MessagingMenuApp * app) { g_clear_object(&app); });
+	ASSERT_NE(nullptr, app);
+	messaging_menu_app_register(app.get());
+
+	EXPECT_EVENTUALLY_ACTION_EXISTS("test.launch");
+
+	auto bus = g_bus_get_sync(G_BUS_TYPE_SESSION, nullptr, nullptr);
+	guint64 start;
+	gboolean complete;
+
+	/* a generation of another instance can't be answered with a delta */
+	auto reply = getChangesSince(bus, 0);
+	ASSERT_NE(nullptr, reply);
+	g_variant_get_child(reply, 0, "t", &start);
+	g_variant_get_child(reply, 1, "b", &complete);
+	EXPECT_FALSE(complete);
+	g_variant_unref(reply);
+
+	reply = getChangesSince(bus, start + 1);
+	ASSERT_NE(nullptr, reply);
+	g_variant_get_child(reply, 1, "b", &complete);
+	EXPECT_FALSE(complete);
+	g_variant_unref(reply);
+
+	/* a message that was added and removed again is only reported as removed */
+	auto msg = newMessage("added-removed", 1);
+	messaging_menu_app_append_message(app.get(), msg, nullptr, FALSE);
+	g_object_unref(msg);
+	messaging_menu_app_remove_message_by_id(app.get(), "added-removed");
+
+	msg = newMessage("added", 2);
+	messaging_menu_app_append_message(app.get(), msg, nullptr, FALSE);
+	g_object_unref(msg);
+
+	reply = getChangesSince(bus, start);
+	ASSERT_NE(nullptr, reply);
+	g_variant_get_child(reply, 1, "b", &complete);
+	EXPECT_TRUE(complete);
+	EXPECT_EQ(std::vector<std::string>({"added"}), changedMessageIds(reply));
+	EXPECT_EQ(std::vector<std::string>({"added-removed"}), removedMessageIds(reply));
+	g_variant_unref(reply);
+
+	/* more changes than the log keeps */
+	GList * messages = nullptr;
+	std::vector<std::string> ids;
+	for (int i = 0; i < 600; i++) {
+		ids.push_back("m" + std::to_string(i));
+		messages = g_list_prepend(messages, newMessage(ids.back(), 10 + i));
+	}
+	messaging_menu_app_append_messages(app.get(), messages, nullptr, FALSE);
+	g_list_free_full(messages, g_object_unref);
+
+	std::vector<const gchar *> removeIds;
+	for (auto& id : ids)
+		removeIds.push_back(id.c_str());
+	removeIds.push_back(nullptr);
+	messaging_menu_app_remove_messages(app.get(), removeIds.data());
+
+	guint64 latest;
+	reply = getChangesSince(bus, start);
+	ASSERT_NE(nullptr, reply);
+	g_variant_get_child(reply, 0, "t", &latest);
+	g_variant_get_child(reply, 1, "b", &complete);
+	EXPECT_FALSE(complete);
+	g_variant_unref(reply);
+
+	/* recent generations are still in the log */
+	reply = getChangesSince(bus, latest - 1);
+	ASSERT_NE(nullptr, reply);
+	g_variant_get_child(reply, 1, "b", &complete);
+	EXPECT_TRUE(complete);
+	EXPECT_EQ(std::vector<std::string>(), changedMessageIds(reply));
+	EXPECT_EQ(std::vector<std::string>({"m599"}), removedMessageIds(reply));
+	g_variant_unref(reply);
+
+	reply = getChangesSince(bus, latest);
+	ASSERT_NE(nullptr, reply);
+	g_variant_get_child(reply, 1, "b", &complete);
+	EXPECT_TRUE(complete);
+	EXPECT_EQ(std::vector<std::string>(), removedMessageIds(reply));
+	g_variant_unref(reply);
+
+	g_object_unref(bus);
+}
+
+TEST_F(IndicatorTest, ServiceRestart) {
+	setActions("/com/canonical/indicator/messages");
+
+	auto app = std::shared_ptr<MessagingMenuApp>(messaging_menu_app_new("test.desktop"), [](MessagingMenuApp * app) { g_clear_object(&app); });
+	ASSERT_NE(nullptr, app);
+	messaging_menu_app_register(app.get());
+
+	EXPECT_EVENTUALLY_ACTION_EXISTS("test.launch");
+
+	for (int i = 1; i <= 3; i++) {
+		auto msg = newMessage("m" + std::to_string(i), i);
+		messaging_menu_app_append_message(app.get(), msg, nullptr, FALSE);
+		g_object_unref(msg);
+	}
+
+	EXPECT_EVENTUALLY_ACTION_EXISTS("test.msg.m3");
+
+	auto bus = g_bus_get_sync(G_BUS_TYPE_SESSION, nullptr, nullptr);
+	stopService(bus);
+
+	/* the new instance only learns about these from GetChangesSince */
+	messaging_menu_app_remove_message_by_id(app.get(), "m1");
+	auto msg = newMessage("m4", 4);
+	messaging_menu_app_append_message(app.get(), msg, nullptr, FALSE);
+	g_object_unref(msg);
+
+	auto pid = startService();
+	ASSERT_NE(0, pid);
+
+	setActions("/com/canonical/indicator/messages");
+
+	EXPECT_EVENTUALLY_ACTION_EXISTS("test.msg.m4");
+	EXPECT_EVENTUALLY_ACTION_DOES_NOT_EXIST("test.msg.m1");
+	EXPECT_ACTION_EXISTS("test.msg.m2");
+	EXPECT_ACTION_EXISTS("test.msg.m3");
+
+	setMenu("/com/canonical/indicator/messages/phone");
+
+	EXPECT_EVENTUALLY_MENU_ATTRIB(std::vector<int>({0, 0, 0}), "x-canonical-message-id", "m4");
+	EXPECT_MENU_ATTRIB(std::vector<int>({0, 0, 1}), "x-canonical-message-id", "m3");
+	EXPECT_MENU_ATTRIB(std::vector<int>({0, 0, 2}), "x-canonical-message-id", "m2");
+
+	kill(pid, SIGTERM);
+	waitpid(pid, nullptr, 0);
+	g_spawn_close_pid(pid);
+
+	g_object_unref(bus);
+}
+
+TEST_F(IndicatorTest, SnapshotVersion) {
+	setActions("/com/canonical/indicator/messages");
+
+	auto app = std::shared_ptr<MessagingMenuApp>(messaging_menu_app_new("test.desktop"), [](MessagingMenuApp * app) { g_clear_object(&app); });
+	ASSERT_NE(nullptr, app);
+	messaging_menu_app_register(app.get());
+
+	EXPECT_EVENTUALLY_ACTION_EXISTS("test.launch");
+
+	auto msg = newMessage("m1", 1);
+	messaging_menu_app_append_message(app.get(), msg, nullptr, FALSE);
+	g_object_unref(msg);
+
+	EXPECT_EVENTUALLY_ACTION_EXISTS("test.msg.m1");
+
+	auto bus = g_bus_get_sync(G_BUS_TYPE_SESSION, nullptr, nullptr);
+	stopService(bus);
+
+	/* a snapshot of another layout, which would be taken for current
+	 * state of the application if it was read */
+	guint64 generation;
+	auto reply = getChangesSince(bus, 0);
+	ASSERT_NE(nullptr, reply);
+	g_variant_get_child(reply, 0, "t", &generation);
+	g_variant_unref(reply);
+
+	auto snapshot = g_variant_ref_sink(g_variant_new("(u@a(sta(ssavuxsb)a(savsssxaa{sv}b)a{sv}))", 2,
+		g_variant_new_parsed("[('test.desktop', %t, @a(ssavuxsb) [], [('stale', @av [], 'Stale', '', '', @x 2, @aa{sv} [], false)], @a{sv} {})]", generation)));
+	auto snapshotDir = g_build_filename(runtimeDir.c_str(), "indicator-messages", nullptr);
+	auto snapshotPath = g_build_filename(snapshotDir, "snapshot", nullptr);
+	g_mkdir_with_parents(snapshotDir, 0700);
+	EXPECT_TRUE(g_file_set_contents(snapshotPath, (const gchar *) g_variant_get_data(snapshot), g_variant_get_size(snapshot), nullptr));
+	g_free(snapshotPath);
+	g_free(snapshotDir);
+	g_variant_unref(snapshot);
+
+	auto pid = startService();
+	ASSERT_NE(0, pid);
+
+	setActions("/com/canonical/indicator/messages");
+
+	EXPECT_EVENTUALLY_ACTION_EXISTS("test.msg.m1");
+	EXPECT_ACTION_DOES_NOT_EXIST("test.msg.stale");
+
+	kill(pid, SIGTERM);
+	waitpid(pid, nullptr, 0);
+	g_spawn_close_pid(pid);
+
+	g_object_unref(bus);
+}
+
+TEST_F(IndicatorTest, ThrottledSignals) {
+	setActions("/com/canonical/indicator/messages");
+
+	auto app = std::shared_ptr<MessagingMenuApp>(messaging_menu_app_new("test.desktop"), [](MessagingMenuApp * app) { g_clear_object(&app); });
+	ASSERT_NE(nullptr, app);
+	messaging_menu_app_register(app.get());
+
+	EXPECT_EVENTUALLY_ACTION_EXISTS("test.launch");
+
+	auto bus = g_bus_get_sync(G_BUS_TYPE_SESSION, nullptr, nullptr);
+	stopService(bus);
+
+	/* the service keeps its settings in memory, so a new instance is
+	 * started with a keyfile that allows one signal per second */
+	auto configDir = g_build_filename(runtimeDir.c_str(), "config", nullptr);
+	auto settingsDir = g_build_filename(configDir, "glib-2.0", "settings", nullptr);
+	auto keyfile = g_build_filename(settingsDir, "keyfile", nullptr);
+	g_mkdir_with_parents(settingsDir, 0700);
+	EXPECT_TRUE(g_file_set_contents(keyfile,
+		"[com/canonical/indicator/messages]\n"
+		"max-signal-rate=1\n"
+		"max-signal-burst=1\n", -1, nullptr));
+
+	auto envp = g_get_environ();
+	envp = g_environ_setenv(envp, "GSETTINGS_BACKEND", "keyfile", TRUE);
+	envp = g_environ_setenv(envp, "XDG_CONFIG_HOME", configDir, TRUE);
+	auto pid = startService(envp);
+	g_strfreev(envp);
+	ASSERT_NE(0, pid);
+
+	setActions("/com/canonical/indicator/messages");
+	EXPECT_EVENTUALLY_ACTION_EXISTS("test.launch");
+
+	messaging_menu_app_append_source(app.get(), "src", nullptr, "Source");
+
+	/* one SourceChanged and one MessageAdded per iteration */
+	for (int i = 1; i <= 20; i++) {
+		messaging_menu_app_set_source_count(app.get(), "src", i);
+
+		auto msg = newMessage("m" + std::to_string(i), i);
+		messaging_menu_app_append_message(app.get(), msg, nullptr, FALSE);
+		g_object_unref(msg);
+
+		while (g_main_context_iteration(nullptr, FALSE));
+	}
+
+	/* the last state of the source and all messages still arrive */
+	auto finalState = std::shared_ptr<GVariant>(g_variant_ref_sink(g_variant_new_parsed("(uint32 20, int64 0, '', false)")), [](GVariant * var) { g_variant_unref(var); });
+	EXPECT_EVENTUALLY_ACTION_STATE("test.src.src", finalState);
+	EXPECT_EVENTUALLY_ACTION_EXISTS("test.msg.m20");
+	EXPECT_ACTION_EXISTS("test.msg.m1");
+
+	auto reply = g_dbus_connection_call_sync(bus, "com.canonical.indicator.messages",
+		"/com/canonical/indicator/messages/service", "com.canonical.indicator.messages.service",
+		"GetThrottledSignals", nullptr, G_VARIANT_TYPE("(a{st})"), G_DBUS_CALL_FLAGS_NONE, -1, nullptr, nullptr);
+	ASSERT_NE(nullptr, reply);
+
+	auto counts = g_variant_get_child_value(reply, 0);
+	guint64 throttled = 0;
+	EXPECT_TRUE(g_variant_lookup(counts, "test.desktop", "t", &throttled));
+	EXPECT_LT(0u, throttled);
+	g_variant_unref(counts);
+	g_variant_unref(reply);
+
+	kill(pid, SIGTERM);
+	waitpid(pid, nullptr, 0);
+	g_spawn_close_pid(pid);
+
+	g_remove(keyfile);
+	g_rmdir(settingsDir);
+	auto glibDir = g_path_get_dirname(settingsDir);
+	g_rmdir(glibDir);
+	g_rmdir(configDir);
+	g_free(glibDir);
+	g_free(keyfile);
+	g_free(settingsDir);
+	g_free(configDir);
+
+	g_object_unref(bus);
+}
@@ -0,0 +1,260 @@
+/*
+An indicator to show information that is in messaging applications
+that the user is using.
+
+Copyright 2013 Canonical Ltd.
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License version 3, as published
+by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranties of
+MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <gtest/gtest.h>
+
+extern "C" {
+#include "im-action-exporter.h"
+}
+
+#define ACTIONS_PATH "/com/canonical/indicator/messages/test"
+
+struct Changes
+{
+	guint n_signals;
+	GVariant *last;
+};
+
+static void
+actionsChanged (GDBusConnection *connection,
+		const gchar *sender,
+		const gchar *object_path,
+		const gchar *interface_name,
+		const gchar *signal_name,
+		GVariant *parameters,
+		gpointer user_data)
+{
+	Changes *changes = (Changes *) user_data;
+
+	changes->n_signals++;
+
+	if (changes->last)
+		g_variant_unref (changes->last);
+	changes->last = g_variant_ref (parameters);
+}
+
+static gboolean
+wakeUp (gpointer user_data)
+{
+	return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+timedOut (gpointer user_data)
+{
+	*(gboolean *) user_data = TRUE;
+	return G_SOURCE_REMOVE;
+}
+
+static void
+addAction (GActionMap *actions,
+	   const gchar *name)
+{
+	GSimpleAction *action = g_simple_action_new (name, NULL);
+
+	g_action_map_add_action (actions, G_ACTION (action));
+	g_object_unref (action);
+}
+
+static void
+addStatefulAction (GActionMap *actions,
+		   const gchar *name,
+		   gint32 state)
+{
+	GSimpleAction *action = g_simple_action_new_stateful (name, NULL, g_variant_new_int32 (state));
+
+	g_action_map_add_action (actions, G_ACTION (action));
+	g_object_unref (action);
+}
+
+static void
+setState (GActionMap *actions,
+	  const gchar *name,
+	  gint32 state)
+{
+	g_simple_action_set_state (G_SIMPLE_ACTION (g_action_map_lookup_action (actions, name)),
+				   g_variant_new_int32 (state));
+}
+
+/* Returns the state in the description of @name in @additions */
+static gint32
+addedState (GVariant *additions,
+	    const gchar *name)
+{
+	GVariant *states;
+	gint32 value = -1;
+
+	/* the state is a maybe, faked as an array of variants */
+	if (g_variant_lookup (additions, name, "(bg@av)", NULL, NULL, &states)) {
+		if (g_variant_n_children (states) == 1)
+			g_variant_get_child (states, 0, "<i>", &value);
+		g_variant_unref (states);
+	}
+
+	return value;
+}
+
+class ActionExporterTest : public ::testing::Test
+{
+	protected:
+		GTestDBus *bus;
+		GDBusConnection *service;
+		GDBusConnection *client;
+
+		virtual void SetUp() {
+			bus = g_test_dbus_new (G_TEST_DBUS_NONE);
+			g_test_dbus_up (bus);
+
+			service = connect ();
+			client = connect ();
+		}
+
+		virtual void TearDown() {
+			g_dbus_connection_close_sync (client, NULL, NULL);
+			g_object_unref (client);
+			g_dbus_connection_close_sync (service, NULL, NULL);
+			g_object_unref (service);
+
+			g_test_dbus_down (bus);
+			g_object_unref (bus);
+		}
+
+		GDBusConnection *connect () {
+			GDBusConnection *connection;
+
+			connection = g_dbus_connection_new_for_address_sync (g_test_dbus_get_bus_address (bus),
+									     (GDBusConnectionFlags) (G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+												     G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION),
+									     NULL, NULL, NULL);
+			g_assert (connection);
+
+			return connection;
+		}
+
+		/* Spins the main loop for @ms milliseconds */
+		void spin (guint ms) {
+			gboolean done = FALSE;
+
+			g_timeout_add (ms, timedOut, &done);
+			while (!done)
+				g_main_context_iteration (NULL, TRUE);
+		}
+
+		/* Spins the main loop until @changes saw a signal, or a few
+		 * seconds have passed */
+		void waitForSignal (Changes &changes) {
+			gint64 deadline = g_get_monotonic_time () + 5 * G_USEC_PER_SEC;
+			guint wake_up_id = g_timeout_add (50, wakeUp, NULL);
+
+			while (changes.n_signals == 0 && g_get_monotonic_time () < deadline)
+				g_main_context_iteration (NULL, TRUE);
+
+			g_source_remove (wake_up_id);
+		}
+};
+
+TEST_F(ActionExporterTest, CoalesceChanges) {
+	GSimpleActionGroup *group;
+	GActionMap *actions;
+	GSimpleAction *action;
+	Changes changes = { 0, NULL };
+	guint export_id;
+	guint signal_id;
+	GVariant *removals;
+	GVariant *enable_changes;
+	GVariant *state_changes;
+	GVariant *additions;
+	gboolean enabled;
+	gint32 state;
+
+	group = g_simple_action_group_new ();
+	actions = G_ACTION_MAP (group);
+
+	addStatefulAction (actions, "counter", 0);
+	addAction (actions, "removed");
+	addAction (actions, "toggled");
+	addStatefulAction (actions, "readded", 0);
+
+	export_id = im_action_exporter_export (service, ACTIONS_PATH, G_ACTION_GROUP (group), NULL);
+	ASSERT_NE (0u, export_id);
+
+	signal_id = g_dbus_connection_signal_subscribe (client, g_dbus_connection_get_unique_name (service),
+							"org.gtk.Actions", "Changed", ACTIONS_PATH, NULL,
+							G_DBUS_SIGNAL_FLAGS_NONE, actionsChanged, &changes, NULL);
+
+	/* a burst of changes in one main loop iteration */
+	setState (actions, "counter", 1);
+	setState (actions, "counter", 2);
+	setState (actions, "counter", 3);
+
+	g_action_map_remove_action (actions, "removed");
+
+	addAction (actions, "transient");
+	g_action_map_remove_action (actions, "transient");
+
+	action = G_SIMPLE_ACTION (g_action_map_lookup_action (actions, "toggled"));
+	g_simple_action_set_enabled (action, FALSE);
+	g_simple_action_set_enabled (action, TRUE);
+	g_simple_action_set_enabled (action, FALSE);
+
+	addStatefulAction (actions, "added", 1);
+	setState (actions, "added", 2);
+
+	g_action_map_remove_action (actions, "readded");
+	addStatefulAction (actions, "readded", 5);
+	setState (actions, "readded", 6);
+
+	waitForSignal (changes);
+	spin (200);
+
+	EXPECT_EQ (1u, changes.n_signals);
+	ASSERT_TRUE (changes.last != NULL);
+
+	g_variant_get (changes.last, "(@as@a{sb}@a{sv}@a{s(bgav)})",
+		       &removals, &enable_changes, &state_changes, &additions);
+
+	/* "transient" was never seen, "readded" is replaced */
+	EXPECT_EQ (2u, g_variant_n_children (removals));
+	EXPECT_EQ (1u, g_variant_n_children (enable_changes));
+	EXPECT_EQ (1u, g_variant_n_children (state_changes));
+	EXPECT_EQ (2u, g_variant_n_children (additions));
+
+	EXPECT_TRUE (g_variant_lookup (enable_changes, "toggled", "b", &enabled));
+	EXPECT_FALSE (enabled);
+
+	EXPECT_TRUE (g_variant_lookup (state_changes, "counter", "i", &state));
+	EXPECT_EQ (3, state);
+
+	/* added actions carry their final state, and no separate state change */
+	EXPECT_EQ (2, addedState (additions, "added"));
+	EXPECT_EQ (6, addedState (additions, "readded"));
+	EXPECT_TRUE (g_variant_lookup_value (additions, "transient", NULL) == NULL);
+
+	g_variant_unref (removals);
+	g_variant_unref (enable_changes);
+	g_variant_unref (state_changes);
+	g_variant_unref (additions);
+
+	g_variant_unref (changes.last);
+	g_dbus_connection_signal_unsubscribe (client, signal_id);
+	g_dbus_connection_unregister_object (service, export_id);
+	g_object_unref (group);
+}
@@ -20,6 +20,7 @@ with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <glib.h>
 #include <gio/gio.h>
 #include <gtest/gtest.h>
+#include <string.h>
 
 extern "C" {
 #include "gactionmuxer.h"
@@ -180,6 +181,73 @@ TEST(GActionMuxerTest, AddAndRemove) {
 	g_object_unref (group3);
 }
 
+TEST(GActionMuxerTest, CountAndIterate) {
+	const GActionEntry entries1[] = { { "one" }, { "two" } };
+	const GActionEntry entries2[] = { { "foo" } };
+	GSimpleActionGroup *group1;
+	GSimpleActionGroup *group2;
+	GActionMuxer *muxer;
+	GActionMuxer *nested;
+	GActionMuxerIter iter;
+	const gchar *name;
+	gchar **actions;
+	guint n;
+
+#if G_ENCODE_VERSION(GLIB_MAJOR_VERSION, GLIB_MINOR_VERSION) <= GLIB_VERSION_2_34
+	g_type_init ();
+#endif
+
+	group1 = g_simple_action_group_new ();
+	g_action_map_add_action_entries (G_ACTION_MAP (group1),
+					 entries1,
+					 G_N_ELEMENTS (entries1),
+					 NULL);
+
+	group2 = g_simple_action_group_new ();
+	g_action_map_add_action_entries (G_ACTION_MAP (group2),
+					 entries2,
+					 G_N_ELEMENTS (entries2),
+					 NULL);
+
+	muxer = g_action_muxer_new ();
+	EXPECT_EQ (0, g_action_muxer_get_n_actions (muxer));
+
+	nested = g_action_muxer_new ();
+	g_action_muxer_insert (nested, "inner", G_ACTION_GROUP (group1));
+
+	g_action_muxer_insert (muxer, "outer", G_ACTION_GROUP (nested));
+	g_action_muxer_insert (muxer, NULL, G_ACTION_GROUP (group2));
+	EXPECT_EQ (3, g_action_muxer_get_n_actions (muxer));
+
+	n = 0;
+	actions = g_action_group_list_actions (G_ACTION_GROUP (muxer));
+	g_action_muxer_iter_init (&iter, muxer);
+	while (g_action_muxer_iter_next (&iter, &name)) {
+		EXPECT_TRUE (strv_contains (actions, name));
+		n++;
+	}
+	EXPECT_EQ (g_strv_length (actions), n);
+	EXPECT_TRUE (strv_contains (actions, "outer.inner.one"));
+	g_strfreev (actions);
+
+	/* the cache follows changes in nested groups */
+	g_action_map_remove_action (G_ACTION_MAP (group1), "one");
+	EXPECT_EQ (2, g_action_muxer_get_n_actions (muxer));
+	EXPECT_FALSE (g_action_group_has_action (G_ACTION_GROUP (muxer), "outer.inner.one"));
+
+	g_action_muxer_remove (muxer, "outer");
+	EXPECT_EQ (1, g_action_muxer_get_n_actions (muxer));
+	actions = g_action_group_list_actions (G_ACTION_GROUP (muxer));
+	EXPECT_EQ (1, g_strv_length (actions));
+	EXPECT_TRUE (strv_contains (actions, "foo"));
+	g_strfreev (actions);
+
+	g_object_unref (muxer);
+	g_object_unref (nested);
+	g_object_unref (group1);
+	g_object_unref (group2);
+}
+
 static gboolean
 g_variant_equal0 (gconstpointer one,
 		  gconstpointer two)
@@ -405,3 +473,93 @@ TEST(GActionMuxerTest, ActivateAction) {
 	g_object_unref (group);
 	g_object_unref (muxer);
 }
+
+typedef struct {
+	guint n_emissions;
+	guint n_added;
+	guint n_removed;
+	guint n_single_signals;
+} TestBatchClosure;
+
+static void
+batch_actions_changed (GActionMuxer *muxer,
+		       gchar **removed,
+		       gchar **added,
+		       gpointer user_data)
+{
+	TestBatchClosure *c = (TestBatchClosure *)user_data;
+	c->n_emissions++;
+	c->n_removed += g_strv_length (removed);
+	c->n_added += g_strv_length (added);
+}
+
+static void
+batch_single_signal (GActionGroup *group,
+		     gchar *action_name,
+		     gpointer user_data)
+{
+	TestBatchClosure *c = (TestBatchClosure *)user_data;
+	c->n_single_signals++;
+}
+
+TEST(GActionMuxerTest, Batch) {
+	const GActionEntry entries[] = { { "one" }, { "two" }, { "three" } };
+	GSimpleActionGroup *group;
+	GActionMuxer *muxer;
+	GActionMuxer *nested;
+	TestBatchClosure closure = { 0, 0, 0, 0 };
+
+	group = g_simple_action_group_new ();
+	g_action_map_add_action_entries (G_ACTION_MAP (group),
+					 entries,
+					 G_N_ELEMENTS (entries),
+					 NULL);
+
+	muxer = g_action_muxer_new ();
+	nested = g_action_muxer_new ();
+	g_action_muxer_set_grouped_signals (nested, TRUE);
+	g_action_muxer_insert (muxer, "outer", G_ACTION_GROUP (nested));
+
+	g_signal_connect (muxer, "actions-changed",
+			  G_CALLBACK (batch_actions_changed), (gpointer) &closure);
+	g_signal_connect (muxer, "action-added",
+			  G_CALLBACK (batch_single_signal), (gpointer) &closure);
+	g_signal_connect (muxer, "action-removed",
+			  G_CALLBACK (batch_single_signal), (gpointer) &closure);
+
+	/* inserting a group into the nested muxer arrives as one batch */
+	g_action_muxer_insert (nested, "inner", G_ACTION_GROUP (group));
+	EXPECT_EQ (1, closure.n_emissions);
+	EXPECT_EQ (3, closure.n_added);
+	EXPECT_EQ (0, closure.n_removed);
+	EXPECT_EQ (3, closure.n_single_signals);
+	EXPECT_TRUE (g_action_group_has_action (G_ACTION_GROUP (muxer), "outer.inner.two"));
+
+	/* an action added and removed in the same batch is never announced */
+	memset (&closure, 0, sizeof closure);
+	g_action_muxer_begin_batch (muxer);
+	g_action_map_add_action_entries (G_ACTION_MAP (group), entries, 1, NULL);
+	g_action_map_remove_action (G_ACTION_MAP (group), "two");
+	g_action_map_add_action_entries (G_ACTION_MAP (group), entries + 1, 1, NULL);
+	g_action_map_remove_action (G_ACTION_MAP (group), "two");
+	EXPECT_EQ (0, closure.n_emissions);
+	EXPECT_EQ (0, closure.n_single_signals);
+	EXPECT_FALSE (g_action_group_has_action (G_ACTION_GROUP (muxer), "outer.inner.two"));
+	g_action_muxer_end_batch (muxer);
+	EXPECT_EQ (1, closure.n_emissions);
+	EXPECT_EQ (1, closure.n_added); /* replaced "one" */
+	EXPECT_EQ (2, closure.n_removed); /* replaced "one", removed "two" */
+
+	/* grouped muxers don't emit individual signals */
+	memset (&closure, 0, sizeof closure);
+	g_action_muxer_set_grouped_signals (muxer, TRUE);
+	g_action_muxer_remove (muxer, "outer");
+	EXPECT_EQ (1, closure.n_emissions);
+	EXPECT_EQ (2, closure.n_removed);
+	EXPECT_EQ (0, closure.n_single_signals);
+	EXPECT_EQ (0, g_action_muxer_get_n_actions (muxer));
+
+	g_object_unref (muxer);
+	g_object_unref (nested);
+	g_object_unref (group);
+}
@@ -0,0 +1,296 @@
+/*
+An indicator to show information that is in messaging applications
+that the user is using.
+
+Copyright 2013 Canonical Ltd.
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License version 3, as published
+by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranties of
+MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "im-menu-exporter.h"
+}
+
+#define MENU_PATH "/com/canonical/indicator/messages/test"
+
+typedef std::vector<std::string> Labels;
+
+static Labels
+menuLabels (GMenuModel *menu)
+{
+	Labels labels;
+	gint n_items;
+	gint i;
+
+	n_items = g_menu_model_get_n_items (menu);
+	for (i = 0; i < n_items; i++) {
+		gchar *label = NULL;
+
+		g_menu_model_get_item_attribute (menu, i, G_MENU_ATTRIBUTE_LABEL, "s", &label);
+		labels.push_back (label ? label : "");
+		g_free (label);
+	}
+
+	return labels;
+}
+
+static Labels
+itemLabels (GVariant *items)
+{
+	Labels labels;
+	GVariantIter iter;
+	GVariant *item;
+
+	g_variant_iter_init (&iter, items);
+	while ((item = g_variant_iter_next_value (&iter))) {
+		const gchar *label = "";
+
+		g_variant_lookup (item, G_MENU_ATTRIBUTE_LABEL, "&s", &label);
+		labels.push_back (label);
+		g_variant_unref (item);
+	}
+
+	return labels;
+}
+
+/* What a client sees of the exported menu: the contents returned by
+ * Start, with all splices of the Changed signals replayed on top */
+struct Remote
+{
+	Labels labels;
+	guint n_signals;
+	gboolean failed;
+};
+
+static void
+menusChanged (GDBusConnection *connection,
+	      const gchar *sender,
+	      const gchar *object_path,
+	      const gchar *interface_name,
+	      const gchar *signal_name,
+	      GVariant *parameters,
+	      gpointer user_data)
+{
+	Remote *remote = (Remote *) user_data;
+	GVariantIter *changes;
+	guint group;
+	guint menu;
+	guint position;
+	guint removed;
+	GVariant *items;
+
+	remote->n_signals++;
+
+	g_variant_get (parameters, "(a(uuuu@aa{sv}))", &changes);
+	while (g_variant_iter_next (changes, "(uuuu@aa{sv})", &group, &menu, &position, &removed, &items)) {
+		Labels added = itemLabels (items);
+
+		if (group != 0 || menu != 0 || position + removed > remote->labels.size ())
+			remote->failed = TRUE;
+		else {
+			remote->labels.erase (remote->labels.begin () + position,
+					      remote->labels.begin () + position + removed);
+			remote->labels.insert (remote->labels.begin () + position, added.begin (), added.end ());
+		}
+
+		g_variant_unref (items);
+	}
+	g_variant_iter_free (changes);
+}
+
+static gboolean
+wakeUp (gpointer user_data)
+{
+	return G_SOURCE_CONTINUE;
+}
+
+static void
+callFinished (GObject *source,
+	      GAsyncResult *result,
+	      gpointer user_data)
+{
+	GVariant **reply = (GVariant **) user_data;
+
+	*reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source), result, NULL);
+}
+
+class MenuExporterTest : public ::testing::Test
+{
+	protected:
+		GTestDBus *bus;
+		GDBusConnection *service;
+		GDBusConnection *client;
+
+		virtual void SetUp() {
+			bus = g_test_dbus_new (G_TEST_DBUS_NONE);
+			g_test_dbus_up (bus);
+
+			service = connect ();
+			client = connect ();
+		}
+
+		virtual void TearDown() {
+			g_dbus_connection_close_sync (client, NULL, NULL);
+			g_object_unref (client);
+			g_dbus_connection_close_sync (service, NULL, NULL);
+			g_object_unref (service);
+
+			g_test_dbus_down (bus);
+			g_object_unref (bus);
+		}
+
+		GDBusConnection *connect () {
+			GDBusConnection *connection;
+
+			connection = g_dbus_connection_new_for_address_sync (g_test_dbus_get_bus_address (bus),
+									     (GDBusConnectionFlags) (G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+												     G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION),
+									     NULL, NULL, NULL);
+			g_assert (connection);
+
+			return connection;
+		}
+
+		/* Spins the main loop until @remote shows @expected, or a few
+		 * seconds have passed */
+		void waitFor (Remote &remote, const Labels &expected) {
+			gint64 deadline = g_get_monotonic_time () + 5 * G_USEC_PER_SEC;
+			guint wake_up_id = g_timeout_add (50, wakeUp, NULL);
+
+			while (remote.labels != expected && !remote.failed && g_get_monotonic_time () < deadline)
+				g_main_context_iteration (NULL, TRUE);
+
+			g_source_remove (wake_up_id);
+		}
+
+		void subscribe (Remote &remote) {
+			GVariant *reply = NULL;
+			GVariantIter *menus;
+			guint group;
+			guint menu;
+			GVariant *items;
+			guint wake_up_id;
+			gint64 deadline;
+
+			/* the service handles Start in this thread */
+			g_dbus_connection_call (client, g_dbus_connection_get_unique_name (service), MENU_PATH,
+						"org.gtk.Menus", "Start", g_variant_new_parsed ("([uint32 0],)"),
+						G_VARIANT_TYPE ("(a(uuaa{sv}))"), G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+						callFinished, &reply);
+
+			deadline = g_get_monotonic_time () + 5 * G_USEC_PER_SEC;
+			wake_up_id = g_timeout_add (50, wakeUp, NULL);
+			while (reply == NULL && g_get_monotonic_time () < deadline)
+				g_main_context_iteration (NULL, TRUE);
+			g_source_remove (wake_up_id);
+
+			ASSERT_TRUE (reply != NULL);
+
+			g_variant_get (reply, "(a(uu@aa{sv}))", &menus);
+			while (g_variant_iter_next (menus, "(uu@aa{sv})", &group, &menu, &items)) {
+				if (group == 0 && menu == 0)
+					remote.labels = itemLabels (items);
+				g_variant_unref (items);
+			}
+			g_variant_iter_free (menus);
+			g_variant_unref (reply);
+		}
+
+		void randomSplices (guint32 seed) {
+			GRand *rand;
+			GMenu *menu;
+			Remote remote = { Labels (), 0, FALSE };
+			guint next_label = 0;
+			guint export_id;
+			guint signal_id;
+			gint round;
+			gint i;
+
+			rand = g_rand_new_with_seed (seed);
+			menu = g_menu_new ();
+
+			for (i = 0; i < 10; i++) {
+				gchar *label = g_strdup_printf ("%u", next_label++);
+				g_menu_append (menu, label, NULL);
+				g_free (label);
+			}
+
+			export_id = im_menu_exporter_export (service, MENU_PATH, G_MENU_MODEL (menu), NULL);
+			ASSERT_NE (0u, export_id);
+
+			signal_id = g_dbus_connection_signal_subscribe (client, g_dbus_connection_get_unique_name (service),
+									"org.gtk.Menus", "Changed", MENU_PATH, NULL,
+									G_DBUS_SIGNAL_FLAGS_NONE, menusChanged, &remote, NULL);
+
+			subscribe (remote);
+			EXPECT_EQ (menuLabels (G_MENU_MODEL (menu)), remote.labels);
+
+			for (round = 0; round < 50; round++) {
+				gint n_changes = g_rand_int_range (rand, 1, 12);
+
+				/* all changes happen in one main loop iteration, so
+				 * they must be merged into at most one signal */
+				for (i = 0; i < n_changes; i++) {
+					gint n_items = g_menu_model_get_n_items (G_MENU_MODEL (menu));
+					gint position = g_rand_int_range (rand, 0, n_items + 1);
+					gchar *label = g_strdup_printf ("%u", next_label++);
+
+					switch (g_rand_int_range (rand, 0, 3)) {
+					case 0:
+						g_menu_insert (menu, position, label, NULL);
+						break;
+
+					case 1:
+						if (position < n_items)
+							g_menu_remove (menu, position);
+						break;
+
+					case 2:
+						if (position < n_items) {
+							g_menu_remove (menu, position);
+							g_menu_insert (menu, position, label, NULL);
+						}
+						break;
+					}
+
+					g_free (label);
+				}
+
+				waitFor (remote, menuLabels (G_MENU_MODEL (menu)));
+				ASSERT_FALSE (remote.failed) << "seed " << seed << ", round " << round;
+				ASSERT_EQ (menuLabels (G_MENU_MODEL (menu)), remote.labels) << "seed " << seed << ", round " << round;
+				EXPECT_GE ((guint) round + 1, remote.n_signals);
+			}
+
+			EXPECT_LT (0u, remote.n_signals);
+
+			g_dbus_connection_signal_unsubscribe (client, signal_id);
+			g_dbus_connection_unregister_object (service, export_id);
+			g_object_unref (menu);
+			g_rand_free (rand);
+		}
+};
+
+TEST_F(MenuExporterTest, RandomSplices) {
+	guint32 seed;
+
+	for (seed = 1; seed <= 10; seed++)
+		randomSplices (seed);
+}
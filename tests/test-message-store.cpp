@@ -0,0 +1,165 @@
+/*
+An indicator to show information that is in messaging applications
+that the user is using.
+
+Copyright 2013 Canonical Ltd.
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License version 3, as published
+by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranties of
+MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <glib.h>
+#include <gtest/gtest.h>
+
+extern "C" {
+#include "im-message-store.h"
+}
+
+TEST(ImMessageStoreTest, InsertOrder) {
+	ImMessageStore *store;
+
+	store = im_message_store_new ();
+
+	EXPECT_EQ (0, im_message_store_insert (store, "app", "a", 10, NULL));
+	EXPECT_EQ (0, im_message_store_insert (store, "app", "b", 30, NULL));
+	EXPECT_EQ (1, im_message_store_insert (store, "app", "c", 20, NULL));
+
+	/* messages with equal times are kept in the order they were added */
+	EXPECT_EQ (2, im_message_store_insert (store, "app", "d", 20, NULL));
+	EXPECT_EQ (1, im_message_store_insert (store, "other", "e", 30, NULL));
+
+	ASSERT_EQ (5, im_message_store_get_n_messages (store));
+	EXPECT_STREQ ("b", im_message_store_get_id (store, 0));
+	EXPECT_STREQ ("e", im_message_store_get_id (store, 1));
+	EXPECT_STREQ ("c", im_message_store_get_id (store, 2));
+	EXPECT_STREQ ("d", im_message_store_get_id (store, 3));
+	EXPECT_STREQ ("a", im_message_store_get_id (store, 4));
+
+	EXPECT_EQ (30, im_message_store_get_time (store, 1));
+	EXPECT_EQ (20, im_message_store_get_time (store, 3));
+
+	EXPECT_EQ (3, im_message_store_lookup (store, "app", "d"));
+	EXPECT_EQ (1, im_message_store_lookup (store, "other", "e"));
+
+	im_message_store_free (store);
+}
+
+TEST(ImMessageStoreTest, LookupAfterRemovals) {
+	ImMessageStore *store;
+	gint row;
+
+	store = im_message_store_new ();
+
+	/* the same id in different applications is a different message */
+	im_message_store_insert (store, "app", "1", 100, NULL);
+	im_message_store_insert (store, "other", "1", 100, NULL);
+	im_message_store_insert (store, "app", "2", 100, NULL);
+	im_message_store_insert (store, "app", "3", 50, NULL);
+	im_message_store_insert (store, "other", "4", 200, NULL);
+
+	row = im_message_store_lookup (store, "other", "1");
+	ASSERT_EQ (2, row);
+	im_message_store_remove_row (store, row);
+
+	EXPECT_EQ (-1, im_message_store_lookup (store, "other", "1"));
+	EXPECT_EQ (1, im_message_store_lookup (store, "app", "1"));
+	EXPECT_EQ (2, im_message_store_lookup (store, "app", "2"));
+	EXPECT_EQ (3, im_message_store_lookup (store, "app", "3"));
+
+	im_message_store_remove_row (store, 0);
+
+	EXPECT_EQ (-1, im_message_store_lookup (store, "other", "4"));
+	EXPECT_EQ (0, im_message_store_lookup (store, "app", "1"));
+	EXPECT_EQ (1, im_message_store_lookup (store, "app", "2"));
+	EXPECT_EQ (2, im_message_store_lookup (store, "app", "3"));
+
+	EXPECT_EQ (-1, im_message_store_lookup (store, "app", "4"));
+	EXPECT_EQ (-1, im_message_store_lookup (store, "unknown", "1"));
+
+	/* a removed message can be added again */
+	EXPECT_EQ (2, im_message_store_insert (store, "other", "1", 100, NULL));
+	EXPECT_EQ (2, im_message_store_lookup (store, "other", "1"));
+	EXPECT_EQ (1, im_message_store_lookup (store, "app", "2"));
+	EXPECT_EQ (3, im_message_store_lookup (store, "app", "3"));
+
+	im_message_store_free (store);
+}
+
+TEST(ImMessageStoreTest, RemoveAll) {
+	ImMessageStore *store;
+	GVariant *message;
+
+	store = im_message_store_new ();
+
+	message = g_variant_ref_sink (g_variant_new_string ("message"));
+	im_message_store_insert (store, "app", "1", 1, message);
+	im_message_store_insert (store, "app", "2", 2, NULL);
+	im_message_store_insert (store, "other", "3", 3, NULL);
+
+	EXPECT_EQ (message, im_message_store_get_message (store, 2));
+	EXPECT_TRUE (im_message_store_get_message (store, 1) == NULL);
+
+	im_message_store_remove_all (store);
+
+	EXPECT_EQ (0, im_message_store_get_n_messages (store));
+	EXPECT_EQ (0, im_message_store_get_n_app_messages (store, "app"));
+	EXPECT_EQ (0, im_message_store_get_n_app_messages (store, "other"));
+	EXPECT_EQ (-1, im_message_store_lookup (store, "app", "1"));
+	EXPECT_EQ (-1, im_message_store_get_oldest_app_row (store, "app"));
+	g_variant_unref (message);
+
+	EXPECT_EQ (0, im_message_store_insert (store, "app", "1", 1, NULL));
+	EXPECT_EQ (0, im_message_store_lookup (store, "app", "1"));
+	EXPECT_EQ (1, im_message_store_get_n_app_messages (store, "app"));
+
+	im_message_store_free (store);
+}
+
+TEST(ImMessageStoreTest, AppCounts) {
+	ImMessageStore *store;
+	guint *rows;
+	guint n_rows;
+
+	store = im_message_store_new ();
+
+	EXPECT_EQ (0, im_message_store_get_n_app_messages (store, "app"));
+
+	im_message_store_insert (store, "app", "1", 10, NULL);
+	im_message_store_insert (store, "other", "2", 20, NULL);
+	im_message_store_insert (store, "app", "3", 30, NULL);
+	im_message_store_insert (store, "app", "4", 5, NULL);
+
+	EXPECT_EQ (3, im_message_store_get_n_app_messages (store, "app"));
+	EXPECT_EQ (1, im_message_store_get_n_app_messages (store, "other"));
+	EXPECT_EQ (0, im_message_store_get_n_app_messages (store, "unknown"));
+
+	rows = im_message_store_get_app_rows (store, "app", &n_rows);
+	ASSERT_EQ (3, n_rows);
+	EXPECT_STREQ ("3", im_message_store_get_id (store, rows[0]));
+	EXPECT_STREQ ("1", im_message_store_get_id (store, rows[1]));
+	EXPECT_STREQ ("4", im_message_store_get_id (store, rows[2]));
+	g_free (rows);
+
+	EXPECT_EQ (3, im_message_store_get_oldest_app_row (store, "app"));
+	EXPECT_EQ (1, im_message_store_get_oldest_app_row (store, "other"));
+
+	im_message_store_remove_row (store, im_message_store_lookup (store, "app", "3"));
+	EXPECT_EQ (2, im_message_store_get_n_app_messages (store, "app"));
+
+	im_message_store_remove_app (store, "app");
+	EXPECT_EQ (0, im_message_store_get_n_app_messages (store, "app"));
+	EXPECT_EQ (1, im_message_store_get_n_app_messages (store, "other"));
+	ASSERT_EQ (1, im_message_store_get_n_messages (store));
+	EXPECT_STREQ ("2", im_message_store_get_id (store, 0));
+
+	im_message_store_free (store);
+}